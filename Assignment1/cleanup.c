@@ -31,6 +31,8 @@ struct data
     char message[MESSAGE_LENGTH];
     char operation;
     long client_id;
+    long request_id;
+    long reply_channel;
 };
 
 struct msg_buffer
@@ -10,28 +10,41 @@
  *
  */
 
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ipc.h>
 #include <sys/msg.h>
+#include <sys/prctl.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #include <limits.h>
+#include <time.h>
 
 #define MESSAGE_LENGTH 100
 #define SERVER_RECEIVES_ON_CHANNEL 1
+#define FIRST_REPLY_CHANNEL 2
+#define PROBE_TIMEOUT_NS 5000000000L
+#define PROBE_QUEUE_SAMPLE_NS 1000000L
+#define PARTIAL_REPLY 'p'
 
 /**
  * @brief The buffer structure for the message queue
- * NOTE: Here operation = r would mean that we are getting response from server
+ * NOTE: Here operation = r would mean that we are getting response from server.
+ * The server sends the reply to reply_channel and copies request_id into it. A request whose
+ * answer does not fit in one message gets PARTIAL_REPLY messages before its reply.
  */
 struct data
 {
     char message[MESSAGE_LENGTH];
     char operation;
     long client_id;
+    long request_id;
+    long reply_channel;
 };
 
 struct msg_buffer
@@ -42,12 +55,64 @@ struct msg_buffer
 
 /**
 Here we use data struct which keeps track of which operation is being performed. 1 stands for ping,
-2 stands for file search, 3 stands for within file search and 4 starts of cleanup. Here the important
+2 stands for file search, 3 stands for within file search, 4 starts of cleanup and 5 stands for
+content search. Here the important
 part is r. r stands for reply. When the server is replying to a client it uses r to ensure it doesn't
 get mixed up by anything else. We also faced major issues while trying to use wait() since forgetting
 wait leads to race conditions and it calling itself for an infinite number of times.
+
+Every client receives its replies on a channel of its own, FIRST_REPLY_CHANNEL plus its process id,
+which no other process reads from, and every request carries a request id that the reply echoes.
+A reply is therefore taken off the queue exactly once, by the client waiting for it, and is never
+put back on the queue.
 */
 
+// Request id of the last request of this client
+static long last_request_id = 0;
+
+/**
+ * @brief Fills in the fields every request carries and sends it to the server
+ *
+ * @return long the request id, -1 if the request could not be sent
+ */
+long send_request(int msg_queue_id, int client_id, char operation, struct msg_buffer *msg_buf)
+{
+    msg_buf->msg_type = SERVER_RECEIVES_ON_CHANNEL;
+    msg_buf->data.client_id = client_id;
+    msg_buf->data.operation = operation;
+    msg_buf->data.request_id = ++last_request_id;
+    msg_buf->data.reply_channel = FIRST_REPLY_CHANNEL + getpid();
+
+    if (msgsnd(msg_queue_id, msg_buf, sizeof(msg_buf->data), 0) == -1)
+    {
+        return -1;
+    }
+    return msg_buf->data.request_id;
+}
+
+/**
+ * @brief Waits on the reply channel of this client for the reply to a request, or for one of the
+ * partial replies that come before it. A reply to an older request cannot be waited for any
+ * more, so it is dropped instead of being put back.
+ *
+ * @return int 0 once the reply or a partial reply is in msg_buf, -1 on error
+ */
+int await_reply(int msg_queue_id, long request_id, struct msg_buffer *msg_buf)
+{
+    while (1)
+    {
+        if (msgrcv(msg_queue_id, msg_buf, sizeof(msg_buf->data), FIRST_REPLY_CHANNEL + getpid(), 0) == -1)
+        {
+            return -1;
+        }
+        if ((msg_buf->data.operation == 'r' || msg_buf->data.operation == PARTIAL_REPLY) && msg_buf->data.request_id == request_id)
+        {
+            return 0;
+        }
+        fprintf(stderr, "[Client] Dropped a reply to request %ld while waiting for request %ld\n", msg_buf->data.request_id, request_id);
+    }
+}
+
 /**
  * @brief The function to contact the Ping Server
  * In this function, the client process will send a message to the Ping Server
@@ -63,44 +128,18 @@ void client_ping(int msg_queue_id, int client_id, struct msg_buffer msg_buf)
     msg_buf.data.message[1] = 'i';
     msg_buf.data.message[2] = '\0';
 
-    msg_buf.msg_type = SERVER_RECEIVES_ON_CHANNEL;
-    msg_buf.data.client_id = client_id;
-    msg_buf.data.operation = '1';
-
-    if (msgsnd(msg_queue_id, &msg_buf, sizeof(msg_buf.data), 0) == -1)
+    long request_id = send_request(msg_queue_id, client_id, '1', &msg_buf);
+    if (request_id == -1)
     {
         perror("[Client: Ping] Message could not be sent, please try again");
         exit(EXIT_FAILURE);
     }
-    else
+    if (await_reply(msg_queue_id, request_id, &msg_buf) == -1)
     {
-        while (1)
-        {
-            if (msgrcv(msg_queue_id, &msg_buf, sizeof(msg_buf.data), client_id, 0) == -1)
-            {
-                perror("[Client: Ping] Error while receiving message from the Ping Server");
-            }
-            else
-            {
-                // Logging for debugging
-                // printf("[Client: Ping] Message recieved from the Ping Server %ld: %s using %c\n", msg_buf.msg_type, msg_buf.data.message, msg_buf.data.operation);
-
-                if (msg_buf.msg_type == client_id && msg_buf.data.operation == 'r')
-                {
-                    printf("[Client: Ping] Message received from the Ping Server: %s\n", msg_buf.data.message);
-                    return;
-                }
-                else
-                {
-                    // push the message back to the queue
-                    if (msgsnd(msg_queue_id, &msg_buf, MESSAGE_LENGTH, 0) == -1)
-                    {
-                        perror("[Client: Ping] Message could not be sent, please try again");
-                    }
-                }
-            }
-        }
+        perror("[Client: Ping] Error while receiving message from the Ping Server");
+        return;
     }
+    printf("[Client: Ping] Message received from the Ping Server: %s\n", msg_buf.data.message);
 }
 
 /**
@@ -113,44 +152,18 @@ void client_file_search(int msg_queue_id, int client_id, struct msg_buffer msg_b
     printf("Enter the filename: ");
     scanf("%s", msg_buf.data.message);
 
-    msg_buf.msg_type = SERVER_RECEIVES_ON_CHANNEL;
-    msg_buf.data.client_id = client_id;
-    msg_buf.data.operation = '2';
-
-    if (msgsnd(msg_queue_id, &msg_buf, sizeof(msg_buf.data), 0) == -1)
+    long request_id = send_request(msg_queue_id, client_id, '2', &msg_buf);
+    if (request_id == -1)
     {
         perror("[Client: File Search] Message could not be sent, please try again");
         exit(EXIT_FAILURE);
     }
-    else
+    if (await_reply(msg_queue_id, request_id, &msg_buf) == -1)
     {
-        while (1)
-        {
-            if (msgrcv(msg_queue_id, &msg_buf, sizeof(msg_buf.data), client_id, 0) == -1)
-            {
-                perror("[Client: File Search] Error while receiving message from the files search server");
-            }
-            else
-            {
-                // Logging for debugging
-                // printf("[Client: File Search] Some message recieved from the files search server %ld: %s using %c\n", msg_buf.msg_type, msg_buf.data.message, msg_buf.data.operation);
-
-                if (msg_buf.msg_type == client_id && msg_buf.data.operation == 'r')
-                {
-                    printf("[Client: File Search] Correct message received from the files search server: %s\n", msg_buf.data.message);
-                    return;
-                }
-                else
-                {
-                    // push the message back to the queue
-                    if (msgsnd(msg_queue_id, &msg_buf, MESSAGE_LENGTH, 0) == -1)
-                    {
-                        perror("[Client: File Search] Incorrect message couldn't be put back into queue");
-                    }
-                }
-            }
-        }
+        perror("[Client: File Search] Error while receiving message from the files search server");
+        return;
     }
+    printf("[Client: File Search] Correct message received from the files search server: %s\n", msg_buf.data.message);
 }
 
 /**
@@ -162,44 +175,343 @@ void client_word_count(int msg_queue_id, int client_id, struct msg_buffer msg_bu
     printf("Enter the filename: ");
     scanf("%s", msg_buf.data.message);
 
-    msg_buf.msg_type = SERVER_RECEIVES_ON_CHANNEL;
-    msg_buf.data.client_id = client_id;
-    msg_buf.data.operation = '3';
-
-    if (msgsnd(msg_queue_id, &msg_buf, sizeof(msg_buf.data), 0) == -1) // send message to server
+    long request_id = send_request(msg_queue_id, client_id, '3', &msg_buf);
+    if (request_id == -1) // send message to server
     {
         printf("[Client: Word Count] Message could not be sent, please try again\n");
         exit(EXIT_FAILURE);
     }
+    if (await_reply(msg_queue_id, request_id, &msg_buf) == -1) // receive the reply on the channel of this client
+    {
+        perror("[Client: Word Count] Error while receiving message from the files word count server");
+        return;
+    }
+    printf("[Client: Word Count] Correct message received from the files word count server: %s\n", msg_buf.data.message);
+}
+
+/**
+ * @brief The function to contact the Content Search Server.
+ * Sends the file or directory and the pattern, separated by a '\0', prints where the matching
+ * lines are as the pages of them arrive, and then the number of matching lines
+ *
+ */
+void client_content_search(int msg_queue_id, int client_id, struct msg_buffer msg_buf)
+{
+    char path[MESSAGE_LENGTH];
+    char pattern[MESSAGE_LENGTH];
+    printf("Enter the file or directory: ");
+    scanf("%99s", path);
+    printf("Enter the pattern: ");
+    scanf(" %99[^\n]", pattern);
+
+    if (strlen(path) + strlen(pattern) + 2 > MESSAGE_LENGTH)
+    {
+        printf("[Client: Content Search] The path and the pattern do not fit in one message\n");
+        return;
+    }
+    strcpy(msg_buf.data.message, path);
+    strcpy(msg_buf.data.message + strlen(path) + 1, pattern);
+
+    long request_id = send_request(msg_queue_id, client_id, '5', &msg_buf);
+    if (request_id == -1)
+    {
+        perror("[Client: Content Search] Message could not be sent, please try again");
+        exit(EXIT_FAILURE);
+    }
+    // The matches come page by page, the counts come last
+    do
+    {
+        if (await_reply(msg_queue_id, request_id, &msg_buf) == -1)
+        {
+            perror("[Client: Content Search] Error while receiving message from the content search server");
+            return;
+        }
+        if (msg_buf.data.operation == PARTIAL_REPLY)
+        {
+            printf("%s", msg_buf.data.message);
+        }
+    } while (msg_buf.data.operation == PARTIAL_REPLY);
+    printf("[Client: Content Search] Correct message received from the content search server: %s\n", msg_buf.data.message);
+}
+
+/**
+ * @brief Returns the current CLOCK_MONOTONIC time in nanoseconds
+ *
+ * @return long
+ */
+long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+int compare_longs(const void *a, const void *b)
+{
+    long x = *(const long *)a;
+    long y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Nearest-rank percentile, the same method the Assignment2 benchmark uses
+ *
+ * @param sorted round trips in ns, ascending
+ * @param count
+ * @param p between 0 and 1
+ * @return double the percentile in us
+ */
+double percentile_us(const long *sorted, long count, double p)
+{
+    long rank = (long)(p * count + 0.999999);
+    if (rank < 1)
+        rank = 1;
+    if (rank > count)
+        rank = count;
+    return sorted[rank - 1] / 1e3;
+}
+
+// Number of messages waiting in the queue
+long queue_depth(int msg_queue_id)
+{
+    struct msqid_ds stats;
+    return msgctl(msg_queue_id, IPC_STAT, &stats) == -1 ? 0 : (long)stats.msg_qnum;
+}
+
+/**
+ * State shared by the sending and the receiving side of a probe. Ping i has request id
+ * first_request_id + i and was due at due[i].
+ */
+struct probe
+{
+    int msg_queue_id;
+    long count;
+    long first_request_id;
+    long sent;
+    long received;
+    long last_progress;
+    long *due;
+    long *rtts;
+    pthread_mutex_t lock;
+    pthread_cond_t progress;
+};
+
+/**
+ * @brief Receiving side of a probe: takes the replies off the reply channel as they arrive, so
+ * a round trip ends when the reply is there, not when the sender gets round to it
+ *
+ * @param arg
+ * @return void*
+ */
+void *probe_receiver(void *arg)
+{
+    struct probe *probe = (struct probe *)arg;
+    struct msg_buffer msg_buf;
+    while (1)
+    {
+        if (msgrcv(probe->msg_queue_id, &msg_buf, sizeof(msg_buf.data), FIRST_REPLY_CHANNEL + getpid(), 0) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("[Client: Probe] Error while receiving a reply");
+            return NULL;
+        }
+        long now = now_ns();
+
+        pthread_mutex_lock(&probe->lock);
+        long index = msg_buf.data.request_id - probe->first_request_id;
+        if (msg_buf.data.operation == 'r' && index >= 0 && index < probe->sent)
+        {
+            probe->rtts[probe->received++] = now - probe->due[index];
+            probe->last_progress = now;
+            pthread_cond_signal(&probe->progress);
+        }
+        int done = probe->received == probe->count;
+        pthread_mutex_unlock(&probe->lock);
+        if (done)
+        {
+            return NULL;
+        }
+    }
+}
+
+/**
+ * @brief Waits until target replies have arrived
+ *
+ * @param probe
+ * @param target
+ * @return int 0, or -1 when no reply has arrived for PROBE_TIMEOUT_NS
+ */
+int probe_wait(struct probe *probe, long target)
+{
+    int result = 0;
+    pthread_mutex_lock(&probe->lock);
+    while (probe->received < target)
+    {
+        long deadline = probe->last_progress + PROBE_TIMEOUT_NS;
+        struct timespec until = {deadline / 1000000000L, deadline % 1000000000L};
+        if (pthread_cond_timedwait(&probe->progress, &probe->lock, &until) == ETIMEDOUT && now_ns() >= probe->last_progress + PROBE_TIMEOUT_NS)
+        {
+            result = -1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&probe->lock);
+    return result;
+}
+
+/**
+ * @brief Probe mode: sends count pings through the queue to the Ping Server and reports the
+ * round trip times and the throughput. With a rate the pings are sent on a fixed schedule
+ * whether or not the replies keep up (open loop), and a round trip is measured from the time the
+ * ping was due, so a server falling behind shows up in the latencies. Without a rate every ping
+ * is sent as soon as the reply to the one before has arrived (closed loop). Replies are taken
+ * off the queue by a thread of their own in both cases, so a full queue cannot stop them.
+ *
+ * @param msg_queue_id
+ * @param count
+ * @param rate pings per second, 0 for closed loop
+ * @return int 0 when every ping was answered
+ */
+int client_probe(int msg_queue_id, long count, double rate)
+{
+    struct probe probe;
+    struct msg_buffer msg_buf;
+    long interval = rate > 0 ? (long)(1e9 / rate) : 0;
+    long deepest_queue = 0;
+    long next_sample = 0;
+
+    memset(&probe, 0, sizeof(probe));
+    probe.msg_queue_id = msg_queue_id;
+    probe.count = count;
+    probe.first_request_id = last_request_id + 1;
+    probe.due = (long *)malloc(count * sizeof(long));
+    probe.rtts = (long *)malloc(count * sizeof(long));
+    if (probe.due == NULL || probe.rtts == NULL)
+    {
+        perror("[Client: Probe] Error while allocating the probe buffers");
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_init(&probe.lock, NULL);
+    pthread_condattr_t attributes;
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&probe.progress, &attributes);
+    pthread_condattr_destroy(&attributes);
+
+    if (rate > 0)
+        printf("[Client: Probe] Sending %ld pings at %.1f per second\n", count, rate);
     else
+        printf("[Client: Probe] Sending %ld pings, each after the reply to the one before\n", count);
+
+    pthread_t receiver;
+    if (pthread_create(&receiver, NULL, probe_receiver, &probe) != 0)
+    {
+        perror("[Client: Probe] Error while creating the receiver thread");
+        exit(EXIT_FAILURE);
+    }
+
+    // The default timer slack of 50 us would make every ping of an open loop late
+    prctl(PR_SET_TIMERSLACK, 1);
+
+    long start = now_ns();
+    probe.last_progress = start;
+    int timed_out = 0;
+    for (long i = 0; i < count; i++)
     {
-        while (1)
+        long due = start + i * interval;
+        if (rate > 0)
         {
-            if (msgrcv(msg_queue_id, &msg_buf, sizeof(msg_buf.data), client_id, 0) == -1) // receive message from server
+            struct timespec until = {due / 1000000000L, due % 1000000000L};
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR)
             {
-                perror("[Client: Word Count] Error while receiving message from the files word count server");
             }
-            else
+        }
+        else
+        {
+            if (probe_wait(&probe, i) == -1)
             {
-                // Logging for debugging
-                // printf("[Client] Some message recieved from the files search server %ld: %s using %c\n", msg_buf.msg_type, msg_buf.data.message, msg_buf.data.operation);
-
-                if (msg_buf.msg_type == client_id && msg_buf.data.operation == 'r') // check if message has reached right client, intended op type
-                {
-                    printf("[Client: Word Count] Correct message received from the files word count server: %s\n", msg_buf.data.message);
-                    return;
-                }
-                else
-                {
-                    // push the message back to the queue
-                    if (msgsnd(msg_queue_id, &msg_buf, MESSAGE_LENGTH, 0) == -1)
-                    {
-                        perror("[Client] Incorrect message couldn't be put back into queue");
-                    }
-                }
+                timed_out = 1;
+                break;
             }
+            due = now_ns();
+        }
+
+        // The ping is counted as sent before it is, its reply may come back before msgsnd returns
+        pthread_mutex_lock(&probe.lock);
+        probe.due[probe.sent++] = due;
+        pthread_mutex_unlock(&probe.lock);
+        strcpy(msg_buf.data.message, "Hi");
+        if (send_request(msg_queue_id, getpid(), '1', &msg_buf) == -1)
+        {
+            perror("[Client: Probe] Message could not be sent");
+            exit(EXIT_FAILURE);
+        }
+        // Sampled once per PROBE_QUEUE_SAMPLE_NS of the schedule, a msgctl per ping would slow the sender down
+        if (due >= next_sample)
+        {
+            long depth = queue_depth(msg_queue_id);
+            deepest_queue = depth > deepest_queue ? depth : deepest_queue;
+            next_sample = due + PROBE_QUEUE_SAMPLE_NS;
+        }
+    }
+    if (!timed_out)
+    {
+        probe_wait(&probe, count);
+    }
+    long elapsed = now_ns() - start;
+
+    pthread_mutex_lock(&probe.lock);
+    long received = probe.received;
+    pthread_mutex_unlock(&probe.lock);
+    if (received < count)
+    {
+        pthread_cancel(receiver);
+    }
+    pthread_join(receiver, NULL);
+
+    printf("[Client: Probe] %ld of %ld pings answered in %.3f s, %.1f pings per second\n", received, count, elapsed / 1e9, received * 1e9 / elapsed);
+    if (received > 0)
+    {
+        long *rtts = probe.rtts;
+        qsort(rtts, received, sizeof(long), compare_longs);
+        double total = 0;
+        for (long i = 0; i < received; i++)
+        {
+            total += rtts[i];
         }
+        printf("[Client: Probe] Round trip (us): min %.1f p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f max %.1f mean %.1f\n", rtts[0] / 1e3,
+               percentile_us(rtts, received, 0.50), percentile_us(rtts, received, 0.90), percentile_us(rtts, received, 0.99),
+               percentile_us(rtts, received, 0.999), rtts[received - 1] / 1e3, total / received / 1e3);
     }
+    printf("[Client: Probe] Most messages seen waiting in the queue (sampled every %.0f ms): %ld\n", PROBE_QUEUE_SAMPLE_NS / 1e6, deepest_queue);
+    if (received < count)
+    {
+        printf("[Client: Probe] %ld pings got no reply within %.0f s, %ld were not sent\n", probe.sent - received, PROBE_TIMEOUT_NS / 1e9,
+               count - probe.sent);
+    }
+    else if (rate > 0 && received * 1e9 / elapsed < 0.95 * rate)
+    {
+        printf("[Client: Probe] The server did not keep up with %.1f pings per second\n", rate);
+    }
+
+    free(probe.due);
+    free(probe.rtts);
+    return received == count ? 0 : -1;
+}
+
+/**
+ * @brief Prints the command line options
+ *
+ * @param program
+ */
+void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [--probe count [--rate pings_per_second]]\n", program);
+    fprintf(stderr, "  Without options the client shows its menu.\n");
+    fprintf(stderr, "  --probe sends count pings and reports round trip times, --rate sends them on a fixed schedule\n");
 }
 
 /**
@@ -218,8 +530,33 @@ void client_exit()
  *
  * @return int 0
  */
-int main()
+int main(int argc, char *argv[])
 {
+    long probe_count = 0;
+    double probe_rate = 0;
+    static struct option options[] = {{"probe", required_argument, NULL, 'p'}, {"rate", required_argument, NULL, 'r'}, {"help", no_argument, NULL, 'h'}, {NULL, 0, NULL, 0}};
+    int option;
+    while ((option = getopt_long(argc, argv, "p:r:h", options, NULL)) != -1)
+    {
+        switch (option)
+        {
+        case 'p':
+            probe_count = atol(optarg);
+            break;
+        case 'r':
+            probe_rate = atof(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            exit(option == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    if (probe_count < 0 || probe_rate < 0 || (probe_rate > 0 && probe_count == 0))
+    {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
     // Initialize the client
     printf("Initializing Client...\n");
 
@@ -243,6 +580,12 @@ int main()
 
     printf("Successfully connected to the Message Queue %d %d\n", key, msg_queue_id);
 
+    // The probe needs no menu
+    if (probe_count > 0)
+    {
+        exit(client_probe(msg_queue_id, probe_count, probe_rate) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
     // When a client process is run, it will ask the user to enter a positive integer as its client-id
     int client_id;
     printf("Enter Client-ID: ");
@@ -265,7 +608,8 @@ int main()
         printf("1. Enter 1 to contact the Ping Server\n");
         printf("2. Enter 2 to contact the File Search Server\n");
         printf("3. Enter 3 to contact the File Word Count Server\n");
-        printf("4. Enter 4 if this Client wishes to exit\nInput: ");
+        printf("4. Enter 4 if this Client wishes to exit\n");
+        printf("5. Enter 5 to contact the Content Search Server\nInput: ");
 
         int input;
         scanf("%d", &input);
@@ -287,6 +631,10 @@ int main()
         {
             exit(EXIT_SUCCESS);
         }
+        else if (input == 5)
+        {
+            client_content_search(msg_queue_id, client_id, message);
+        }
         else
         {
             printf("Invalid Input. Please try again.\n");
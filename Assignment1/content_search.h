@@ -0,0 +1,444 @@
+/**
+ * @file content_search.h
+ * @author Divyateja Pasupuleti
+ * @brief
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2023
+ * POSIX-compliant C header content_search.h
+ *
+ * In-process content search for the Content Search server: counts the lines that contain a
+ * pattern in a file, or in every file below a directory, and remembers where the matching lines
+ * are, up to CONTENT_SEARCH_MAX_MATCHES of them per file.
+ *
+ * Every file is mapped whole. Candidates are found 32 bytes at a time by comparing the bytes
+ * with the first and with the last byte of the pattern using AVX2, and only a position where
+ * both match is compared in full. Without AVX2 memchr finds the first byte instead. After a
+ * match the rest of its line is skipped, so a line is counted once. The files of a directory are
+ * searched on up to CONTENT_SEARCH_THREADS threads.
+ *
+ * A message holds less than 100 bytes, so the result is paged: every call to contentSearchNextPage
+ * gives the next matches that fit in a message, as path: line@offset line@offset ..., in path
+ * order, up to CONTENT_SEARCH_MAX_PAGES pages. contentSearchSummary then gives the counts.
+ *
+ */
+
+#ifndef CONTENT_SEARCH_H
+#define CONTENT_SEARCH_H
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CONTENT_SEARCH_X86 1
+#endif
+
+#define CONTENT_SEARCH_THREADS 4
+#define CONTENT_SEARCH_MAX_MATCHES 1024
+#define CONTENT_SEARCH_MAX_PAGES 1024
+#define CONTENT_SEARCH_MATCH_TEXT 42
+#define CONTENT_SEARCH_ELLIPSIS "..."
+
+/**
+ * A matching line: its number, counting from 1, and the byte offset of the match in the file.
+ */
+struct content_match
+{
+    long line;
+    long offset;
+};
+
+/**
+ * What a file gave. matches holds its first matching lines, kept of them, at most
+ * CONTENT_SEARCH_MAX_MATCHES. lines is -1 when the file could not be read.
+ */
+struct file_matches
+{
+    char *path;
+    long lines;
+    long kept;
+    struct content_match *matches;
+};
+
+/**
+ * A search and its result. The page cursor is the file and the match the next page starts at,
+ * listed counts the matches paged so far.
+ */
+struct content_search
+{
+    const char *pattern;
+    long pattern_length;
+    struct file_matches *files;
+    long file_count;
+    long file_capacity;
+    long next_file;
+    long lines;
+    long matching_files;
+    long page_file;
+    long page_match;
+    long pages;
+    long listed;
+};
+
+// Finds the next occurrence of the pattern from position on, -1 when there is none
+static long contentFindScalar(const char *text, long length, long position, const char *pattern, long pattern_length)
+{
+    while (position + pattern_length <= length)
+    {
+        const char *first = (const char *)memchr(text + position, pattern[0], length - pattern_length + 1 - position);
+        if (first == NULL)
+        {
+            return -1;
+        }
+        position = first - text;
+        if (memcmp(first + 1, pattern + 1, pattern_length - 1) == 0)
+        {
+            return position;
+        }
+        position++;
+    }
+    return -1;
+}
+
+#ifdef CONTENT_SEARCH_X86
+__attribute__((target("avx2"))) static long contentFindAvx2(const char *text, long length, long position, const char *pattern, long pattern_length)
+{
+    const __m256i first = _mm256_set1_epi8(pattern[0]);
+    const __m256i last = _mm256_set1_epi8(pattern[pattern_length - 1]);
+    // Block i holds the candidate starts i to i + 31, their last bytes are pattern_length - 1 further
+    for (; position + pattern_length - 1 + 32 <= length; position += 32)
+    {
+        __m256i starts = _mm256_loadu_si256((const __m256i *)(text + position));
+        __m256i ends = _mm256_loadu_si256((const __m256i *)(text + position + pattern_length - 1));
+        unsigned int candidates = (unsigned int)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(starts, first), _mm256_cmpeq_epi8(ends, last)));
+        while (candidates != 0)
+        {
+            int bit = __builtin_ctz(candidates);
+            if (memcmp(text + position + bit + 1, pattern + 1, pattern_length - 2 > 0 ? pattern_length - 2 : 0) == 0)
+            {
+                return position + bit;
+            }
+            candidates &= candidates - 1;
+        }
+    }
+    return contentFindScalar(text, length, position, pattern, pattern_length);
+}
+#endif
+
+// The next occurrence with the widest instructions the CPU has
+static long contentFind(const char *text, long length, long position, const char *pattern, long pattern_length)
+{
+#ifdef CONTENT_SEARCH_X86
+    static int avx2 = -1;
+    if (avx2 == -1)
+    {
+        __builtin_cpu_init();
+        avx2 = __builtin_cpu_supports("avx2") != 0;
+    }
+    if (avx2)
+    {
+        return contentFindAvx2(text, length, position, pattern, pattern_length);
+    }
+#endif
+    return contentFindScalar(text, length, position, pattern, pattern_length);
+}
+
+// Counts the new lines from start up to end
+static long contentCountLines(const char *text, long start, long end)
+{
+    long lines = 0;
+    const char *position = text + start;
+    while ((position = (const char *)memchr(position, '\n', text + end - position)) != NULL)
+    {
+        lines++;
+        position++;
+    }
+    return lines;
+}
+
+/**
+ * @brief Searches one file
+ *
+ * @param file
+ * @param pattern
+ * @param pattern_length
+ */
+static void contentSearchFile(struct file_matches *file, const char *pattern, long pattern_length)
+{
+    file->lines = -1;
+    int fd = open(file->path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode))
+    {
+        close(fd);
+        return;
+    }
+    file->lines = 0;
+    if (st.st_size < pattern_length)
+    {
+        close(fd);
+        return;
+    }
+
+    const char *text = (const char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (text == MAP_FAILED)
+    {
+        file->lines = -1;
+        return;
+    }
+    madvise((void *)text, st.st_size, MADV_SEQUENTIAL);
+
+    long length = st.st_size;
+    long position = 0;
+    long match;
+    // Lines are only counted up to the last match that is kept
+    long line = 1;
+    long counted = 0;
+    while ((match = contentFind(text, length, position, pattern, pattern_length)) != -1)
+    {
+        if (file->kept < CONTENT_SEARCH_MAX_MATCHES)
+        {
+            if (file->kept == 0 || (file->kept & (file->kept - 1)) == 0)
+            {
+                long capacity = file->kept == 0 ? 8 : file->kept * 2;
+                struct content_match *matches = (struct content_match *)realloc(file->matches, capacity * sizeof(struct content_match));
+                if (matches == NULL)
+                {
+                    break;
+                }
+                file->matches = matches;
+            }
+            line += contentCountLines(text, counted, match);
+            counted = match;
+            file->matches[file->kept].line = line;
+            file->matches[file->kept++].offset = match;
+        }
+        file->lines++;
+
+        // The rest of the line cannot add another matching line
+        const char *end_of_line = (const char *)memchr(text + match, '\n', length - match);
+        if (end_of_line == NULL)
+        {
+            break;
+        }
+        position = end_of_line - text + 1;
+    }
+    munmap((void *)text, length);
+}
+
+// Adds every regular file below path to the search, without following symbolic links like find
+static void contentCollectFiles(struct content_search *search, const char *path)
+{
+    struct stat st;
+    if (lstat(path, &st) == -1)
+    {
+        return;
+    }
+    if (S_ISREG(st.st_mode))
+    {
+        if (search->file_count == search->file_capacity)
+        {
+            search->file_capacity = search->file_capacity ? search->file_capacity * 2 : 64;
+            search->files = (struct file_matches *)realloc(search->files, search->file_capacity * sizeof(struct file_matches));
+        }
+        memset(&search->files[search->file_count], 0, sizeof(struct file_matches));
+        search->files[search->file_count++].path = strdup(path);
+        return;
+    }
+    if (!S_ISDIR(st.st_mode))
+    {
+        return;
+    }
+
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+    {
+        return;
+    }
+    struct dirent *entry;
+    char child[PATH_MAX];
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0 &&
+            snprintf(child, sizeof(child), "%s/%s", path, entry->d_name) < (int)sizeof(child))
+        {
+            contentCollectFiles(search, child);
+        }
+    }
+    closedir(dir);
+}
+
+// Search thread: takes the next file until there are none left
+static void *contentSearchThread(void *arg)
+{
+    struct content_search *search = (struct content_search *)arg;
+    long next;
+    while ((next = __atomic_fetch_add(&search->next_file, 1, __ATOMIC_RELAXED)) < search->file_count)
+    {
+        contentSearchFile(&search->files[next], search->pattern, search->pattern_length);
+    }
+    return NULL;
+}
+
+static int compareFileMatches(const void *a, const void *b)
+{
+    return strcmp(((const struct file_matches *)a)->path, ((const struct file_matches *)b)->path);
+}
+
+/**
+ * @brief Searches a file, or every file below a directory, for a pattern. The result stays in
+ * the search until contentSearchFree.
+ *
+ * @param search
+ * @param path
+ * @param pattern
+ * @return long the number of matching lines, -1 when the path cannot be read
+ */
+__attribute__((unused)) static long searchContent(struct content_search *search, const char *path, const char *pattern)
+{
+    memset(search, 0, sizeof(*search));
+    search->pattern = pattern;
+    search->pattern_length = strlen(pattern);
+    contentCollectFiles(search, path);
+    if (search->file_count == 0)
+    {
+        return -1;
+    }
+    qsort(search->files, search->file_count, sizeof(struct file_matches), compareFileMatches);
+
+    long thread_count = search->file_count < CONTENT_SEARCH_THREADS ? search->file_count : CONTENT_SEARCH_THREADS;
+    pthread_t threads[CONTENT_SEARCH_THREADS];
+    int started = 0;
+    for (long i = 1; i < thread_count; i++)
+    {
+        if (pthread_create(&threads[started], NULL, contentSearchThread, search) == 0)
+        {
+            started++;
+        }
+    }
+    contentSearchThread(search);
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (long i = 0; i < search->file_count; i++)
+    {
+        if (search->files[i].lines > 0)
+        {
+            search->lines += search->files[i].lines;
+            search->matching_files++;
+        }
+    }
+    return search->lines;
+}
+
+/**
+ * @brief Describes the result in one line: the number of matching lines and files, and how many
+ * of the lines were paged when that is not all of them
+ *
+ * @param search
+ * @param result
+ * @param size
+ */
+__attribute__((unused)) static void contentSearchSummary(const struct content_search *search, char *result, int size)
+{
+    if (search->listed == search->lines)
+    {
+        snprintf(result, size, "%ld lines in %ld files\n", search->lines, search->matching_files);
+    }
+    else
+    {
+        snprintf(result, size, "%ld lines in %ld files, %ld listed\n", search->lines, search->matching_files, search->listed);
+    }
+}
+
+/**
+ * @brief Writes the next matches that fit in size bytes, all from one file: its path followed by
+ * line@offset of each match. A path that would leave no room for a match is cut to its end.
+ *
+ * @param search
+ * @param result
+ * @param size at least CONTENT_SEARCH_MATCH_TEXT plus room for a path
+ * @return int 1 when a page was written, 0 when every match kept, or CONTENT_SEARCH_MAX_PAGES
+ * pages, have been paged
+ */
+__attribute__((unused)) static int contentSearchNextPage(struct content_search *search, char *result, int size)
+{
+    if (search->pages == CONTENT_SEARCH_MAX_PAGES)
+    {
+        return 0;
+    }
+    while (search->page_file < search->file_count &&
+           (search->files[search->page_file].lines <= 0 || search->page_match >= search->files[search->page_file].kept))
+    {
+        search->page_file++;
+        search->page_match = 0;
+    }
+    if (search->page_file == search->file_count)
+    {
+        return 0;
+    }
+
+    const struct file_matches *file = &search->files[search->page_file];
+    int path_room = size - CONTENT_SEARCH_MATCH_TEXT - 1;
+    int path_length = strlen(file->path);
+    int used;
+    if (path_length <= path_room)
+    {
+        used = snprintf(result, size, "%s:", file->path);
+    }
+    else
+    {
+        int tail = path_room - (int)strlen(CONTENT_SEARCH_ELLIPSIS);
+        used = snprintf(result, size, "%s%s:", CONTENT_SEARCH_ELLIPSIS, file->path + path_length - tail);
+    }
+
+    char match[CONTENT_SEARCH_MATCH_TEXT + 1];
+    while (search->page_match < file->kept)
+    {
+        const struct content_match *next = &file->matches[search->page_match];
+        int length = snprintf(match, sizeof(match), " %ld@%ld", next->line, next->offset);
+        // Leave room for the new line
+        if (used + length + 2 > size)
+        {
+            break;
+        }
+        memcpy(result + used, match, length + 1);
+        used += length;
+        search->page_match++;
+        search->listed++;
+    }
+    snprintf(result + used, size - used, "\n");
+    search->pages++;
+    return 1;
+}
+
+__attribute__((unused)) static void contentSearchFree(struct content_search *search)
+{
+    for (long i = 0; i < search->file_count; i++)
+    {
+        free(search->files[i].path);
+        free(search->files[i].matches);
+    }
+    free(search->files);
+    search->files = NULL;
+    search->file_count = 0;
+}
+
+#endif
@@ -0,0 +1,1035 @@
+/**
+ * @file file_index.h
+ * @author Divyateja Pasupuleti
+ * @brief
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2023
+ * POSIX-compliant C header file_index.h
+ *
+ * In-memory index of the file names under the root of the server, used by the File Search
+ * server instead of running find for every request. Names are hashed into a chained hash table,
+ * so looking a name up costs one bucket walk, and every match keeps its full path.
+ *
+ * The table lives in an anonymous shared mapping created before the workers are forked, so the
+ * workers read the same table the main server keeps up to date. A process-shared read-write
+ * lock guards it. The index is built at startup by a few threads walking the tree together, and
+ * afterwards a watcher thread of the main server applies the inotify events of every directory.
+ *
+ * The index is only used while it is ready. It is not while it is being (re)built, when it has
+ * run out of room or when a directory could not be watched, and then the File Search server
+ * falls back to find.
+ *
+ * After every full build, and when the server stops, the index is written to a snapshot file
+ * outside the tree (see indexSnapshotPath): a header followed by the buckets, the entries and
+ * the paths exactly as the table holds them, without the room of removed entries. The next
+ * server started on the same root copies the snapshot into the table and is ready at once. The
+ * watcher thread then reconciles the index with the tree: every directory keeps the
+ * modification time it had when it was read, and only the directories whose time differs, or
+ * that changed while they were watched, are read again. Until that is done, answers reflect
+ * the tree as it was when the snapshot was written.
+ *
+ */
+
+#ifndef FILE_INDEX_H
+#define FILE_INDEX_H
+
+#include <dirent.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define INDEX_BUCKETS (1 << 18)
+#define INDEX_MAX_ENTRIES (1 << 18)
+#define INDEX_PATH_BYTES (32 << 20)
+#define INDEX_BUILD_THREADS 4
+#define INDEX_NO_ENTRY -1
+#define INDEX_WATCH_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+#define INDEX_EVENT_BUFFER 65536
+#define INDEX_SNAPSHOT_MAGIC "FIDXSNAP"
+#define INDEX_SNAPSHOT_VERSION 1
+#define INDEX_SNAPSHOT_DIRECTORY_ENV "XDG_RUNTIME_DIR"
+#define INDEX_SNAPSHOT_FALLBACK_DIRECTORY "/tmp"
+#define INDEX_CHANGED 0
+
+/**
+ * One indexed file or directory. The path is stored in the path arena and the name is the part
+ * of the path after the last '/'. Entries of a bucket are chained through next. A directory
+ * keeps the modification time it had when it was read, INDEX_CHANGED once it has changed since.
+ */
+struct index_entry
+{
+    unsigned long hash;
+    long next;
+    long path;
+    int name;
+    int directory;
+    long modified;
+};
+
+/**
+ * The shared part of the index. Removed entries are unlinked from their chain, their room is
+ * only given back when the index is rebuilt. Generation changes whenever the index does, so a
+ * search answered at one generation still holds while the generation is the same.
+ */
+struct file_index
+{
+    pthread_rwlock_t lock;
+    int ready;
+    int full;
+    long generation;
+    long root_modified;
+    long entries;
+    long live_entries;
+    long path_bytes;
+    long buckets[INDEX_BUCKETS];
+    struct index_entry table[INDEX_MAX_ENTRIES];
+    char paths[INDEX_PATH_BYTES];
+};
+
+/**
+ * Header of a snapshot file. The buckets, the entries and the paths follow it.
+ */
+struct index_snapshot
+{
+    char magic[8];
+    long version;
+    long entries;
+    long path_bytes;
+    long root_modified;
+    dev_t root_device;
+    ino_t root_inode;
+    char root[PATH_MAX];
+};
+
+/**
+ * Private to the main server: the inotify descriptor, the directory each watch descriptor stands
+ * for, and the queue of directories the build threads share.
+ */
+struct indexer
+{
+    struct file_index *index;
+    char root[PATH_MAX];
+    char snapshot[PATH_MAX];
+    int threads;
+    int loaded;
+    int inotify_fd;
+    int watch_failed;
+    pthread_mutex_t watch_lock;
+    char **watched;
+    int watched_capacity;
+
+    pthread_mutex_t walk_lock;
+    pthread_cond_t walk_cond;
+    char **pending;
+    long pending_count;
+    long pending_capacity;
+    int busy;
+};
+
+static struct indexer indexer = {.inotify_fd = -1, .watch_lock = PTHREAD_MUTEX_INITIALIZER, .walk_lock = PTHREAD_MUTEX_INITIALIZER, .walk_cond = PTHREAD_COND_INITIALIZER};
+
+// FNV-1a
+static unsigned long indexHash(const char *name)
+{
+    unsigned long hash = 14695981039346656037UL;
+    for (; *name; name++)
+    {
+        hash = (hash ^ (unsigned char)*name) * 1099511628211UL;
+    }
+    return hash;
+}
+
+/**
+ * @brief Names the snapshot file of a root. It is kept in $XDG_RUNTIME_DIR, or in /tmp when that
+ * is not set, rather than in the tree itself, where writing it would raise inotify events and
+ * searches would find it. The name holds the user and a hash of the resolved root, so servers
+ * run on different directories or by different users keep separate snapshots.
+ *
+ * @param path
+ * @param size
+ * @param root
+ * @return const char* path, NULL when the root cannot be resolved
+ */
+__attribute__((unused)) static const char *indexSnapshotPath(char *path, size_t size, const char *root)
+{
+    char resolved[PATH_MAX];
+    if (realpath(root, resolved) == NULL)
+    {
+        perror("[File Index] Error while resolving the root for the snapshot");
+        return NULL;
+    }
+    const char *directory = getenv(INDEX_SNAPSHOT_DIRECTORY_ENV);
+    if (directory == NULL || directory[0] != '/')
+    {
+        directory = INDEX_SNAPSHOT_FALLBACK_DIRECTORY;
+    }
+    snprintf(path, size, "%s/file_index-%u-%016lx.snapshot", directory, (unsigned)getuid(), indexHash(resolved));
+    return path;
+}
+
+static const char *indexBaseName(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+static long indexModifiedNs(const struct stat *st)
+{
+    return st->st_mtim.tv_sec * 1000000000L + st->st_mtim.tv_nsec;
+}
+
+// The entry of a path, INDEX_NO_ENTRY when it is not indexed. Needs the lock.
+static long indexFind(struct file_index *index, const char *path)
+{
+    unsigned long hash = indexHash(indexBaseName(path));
+    for (long i = index->buckets[hash % INDEX_BUCKETS]; i != INDEX_NO_ENTRY; i = index->table[i].next)
+    {
+        if (index->table[i].hash == hash && strcmp(index->paths + index->table[i].path, path) == 0)
+        {
+            return i;
+        }
+    }
+    return INDEX_NO_ENTRY;
+}
+
+// Where the modification time of a directory is kept, NULL when it is not indexed. Needs the write lock.
+static long *indexModified(struct file_index *index, const char *directory)
+{
+    if (strcmp(directory, indexer.root) == 0)
+    {
+        return &index->root_modified;
+    }
+    long entry = indexFind(index, directory);
+    return entry == INDEX_NO_ENTRY ? NULL : &index->table[entry].modified;
+}
+
+// Adds a path unless it is already there. Needs the write lock. Returns 1 when it was added.
+static int indexInsert(struct file_index *index, const char *path, int is_directory)
+{
+    const char *name = indexBaseName(path);
+    unsigned long hash = indexHash(name);
+    long *bucket = &index->buckets[hash % INDEX_BUCKETS];
+
+    if (indexFind(index, path) != INDEX_NO_ENTRY)
+    {
+        return 0;
+    }
+
+    long length = strlen(path) + 1;
+    if (index->entries == INDEX_MAX_ENTRIES || index->path_bytes + length > INDEX_PATH_BYTES)
+    {
+        index->full = 1;
+        __atomic_store_n(&index->ready, 0, __ATOMIC_RELEASE);
+        return 0;
+    }
+
+    // The generation moves before the index does
+    __atomic_add_fetch(&index->generation, 1, __ATOMIC_RELEASE);
+    struct index_entry *entry = &index->table[index->entries];
+    memcpy(index->paths + index->path_bytes, path, length);
+    entry->hash = hash;
+    entry->path = index->path_bytes;
+    entry->name = (int)(name - path);
+    entry->directory = is_directory;
+    entry->modified = INDEX_CHANGED;
+    entry->next = *bucket;
+    *bucket = index->entries;
+    index->entries++;
+    index->live_entries++;
+    index->path_bytes += length;
+    return 1;
+}
+
+// Removes a path, and everything below it when it is a directory. Needs the write lock.
+static void indexRemove(struct file_index *index, const char *path, int is_directory)
+{
+    long length = strlen(path);
+    for (long b = 0; b < INDEX_BUCKETS; b++)
+    {
+        // Only a directory needs every bucket, a file is in the bucket of its name
+        if (!is_directory)
+        {
+            b = indexHash(indexBaseName(path)) % INDEX_BUCKETS;
+        }
+        long *link = &index->buckets[b];
+        while (*link != INDEX_NO_ENTRY)
+        {
+            const char *entry_path = index->paths + index->table[*link].path;
+            if (strcmp(entry_path, path) == 0 || (is_directory && strncmp(entry_path, path, length) == 0 && entry_path[length] == '/'))
+            {
+                __atomic_add_fetch(&index->generation, 1, __ATOMIC_RELEASE);
+                *link = index->table[*link].next;
+                index->live_entries--;
+            }
+            else
+            {
+                link = &index->table[*link].next;
+            }
+        }
+        if (!is_directory)
+        {
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Looks a file name up. Shell wildcards are matched like find -name does, which needs a
+ * pass over the whole index instead of one bucket.
+ *
+ * @param index
+ * @param name
+ * @param result the matching paths, separated by spaces, as many as fit
+ * @param size
+ * @param listed set to the number of paths put in result
+ * @param generation set to the generation of the index the answer comes from
+ * @return long the number of matches, -1 when the index is not ready
+ */
+static long indexLookup(struct file_index *index, const char *name, char *result, int size, long *listed, long *generation)
+{
+    long matches = 0;
+    int used = 0;
+    int wildcard = strpbrk(name, "*?[") != NULL;
+    unsigned long hash = indexHash(name);
+
+    result[0] = '\0';
+    *listed = 0;
+    pthread_rwlock_rdlock(&index->lock);
+    if (!__atomic_load_n(&index->ready, __ATOMIC_ACQUIRE))
+    {
+        pthread_rwlock_unlock(&index->lock);
+        return -1;
+    }
+    *generation = index->generation;
+
+    long first = wildcard ? 0 : (long)(hash % INDEX_BUCKETS);
+    long last = wildcard ? INDEX_BUCKETS - 1 : first;
+    for (long b = first; b <= last; b++)
+    {
+        for (long i = index->buckets[b]; i != INDEX_NO_ENTRY; i = index->table[i].next)
+        {
+            const struct index_entry *entry = &index->table[i];
+            const char *path = index->paths + entry->path;
+            if (wildcard ? fnmatch(name, path + entry->name, 0) != 0 : (entry->hash != hash || strcmp(path + entry->name, name) != 0))
+            {
+                continue;
+            }
+            matches++;
+            int length = strlen(path);
+            if (*listed == matches - 1 && used + length + (used > 0) < size)
+            {
+                // The test above leaves room for the separator, the path and the terminator
+                if (used > 0)
+                {
+                    result[used++] = ' ';
+                }
+                memcpy(result + used, path, length + 1);
+                used += length;
+                (*listed)++;
+            }
+        }
+    }
+    pthread_rwlock_unlock(&index->lock);
+    return matches;
+}
+
+// Remembers which directory a watch descriptor stands for
+static void indexRecordWatch(int wd, const char *path)
+{
+    pthread_mutex_lock(&indexer.watch_lock);
+    if (wd >= indexer.watched_capacity)
+    {
+        int capacity = indexer.watched_capacity ? indexer.watched_capacity : 1024;
+        while (capacity <= wd)
+        {
+            capacity *= 2;
+        }
+        indexer.watched = (char **)realloc(indexer.watched, capacity * sizeof(char *));
+        memset(indexer.watched + indexer.watched_capacity, 0, (capacity - indexer.watched_capacity) * sizeof(char *));
+        indexer.watched_capacity = capacity;
+    }
+    free(indexer.watched[wd]);
+    indexer.watched[wd] = strdup(path);
+    pthread_mutex_unlock(&indexer.watch_lock);
+}
+
+// Queues a directory for the build threads
+static void indexPushDirectory(const char *path)
+{
+    pthread_mutex_lock(&indexer.walk_lock);
+    if (indexer.pending_count == indexer.pending_capacity)
+    {
+        indexer.pending_capacity = indexer.pending_capacity ? indexer.pending_capacity * 2 : 1024;
+        indexer.pending = (char **)realloc(indexer.pending, indexer.pending_capacity * sizeof(char *));
+    }
+    indexer.pending[indexer.pending_count++] = strdup(path);
+    pthread_cond_signal(&indexer.walk_cond);
+    pthread_mutex_unlock(&indexer.walk_lock);
+}
+
+// Watches a directory for changes
+static void indexWatchDirectory(const char *directory)
+{
+    if (indexer.inotify_fd == -1)
+    {
+        return;
+    }
+    int wd = inotify_add_watch(indexer.inotify_fd, directory, INDEX_WATCH_EVENTS);
+    if (wd == -1)
+    {
+        if (errno != ENOENT && errno != ENOTDIR && !__atomic_exchange_n(&indexer.watch_failed, 1, __ATOMIC_RELAXED))
+        {
+            perror("[File Index] Error while watching a directory, file search falls back to find");
+        }
+    }
+    else
+    {
+        indexRecordWatch(wd, directory);
+    }
+}
+
+/**
+ * @brief Indexes the entries of one directory and queues the subdirectories that were not
+ * indexed yet. The directory is watched before it is read, so nothing created meanwhile is
+ * missed, and its modification time is taken before it is read, so a change made meanwhile
+ * makes it differ.
+ *
+ * @param directory
+ */
+static void indexDirectory(const char *directory)
+{
+    indexWatchDirectory(directory);
+
+    DIR *dir = opendir(directory);
+    if (dir == NULL)
+    {
+        return;
+    }
+    struct stat st;
+    long modified = fstat(dirfd(dir), &st) == 0 ? indexModifiedNs(&st) : INDEX_CHANGED;
+
+    // Entries are collected first so the write lock is taken once per directory
+    char **children = NULL;
+    int *directories = NULL;
+    long count = 0;
+    long capacity = 0;
+    struct dirent *entry;
+    char path[PATH_MAX];
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        {
+            continue;
+        }
+        if (snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name) >= (int)sizeof(path))
+        {
+            continue;
+        }
+        if (count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            children = (char **)realloc(children, capacity * sizeof(char *));
+            directories = (int *)realloc(directories, capacity * sizeof(int));
+        }
+
+        // Like find, symbolic links to directories are not followed
+        directories[count] = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN && lstat(path, &st) == 0)
+        {
+            directories[count] = S_ISDIR(st.st_mode);
+        }
+        children[count++] = strdup(path);
+    }
+    closedir(dir);
+
+    // Subdirectories are queued once they are in the index, so their own times can be kept
+    pthread_rwlock_wrlock(&indexer.index->lock);
+    for (long i = 0; i < count; i++)
+    {
+        if (!indexInsert(indexer.index, children[i], directories[i]) || !directories[i])
+        {
+            free(children[i]);
+            children[i] = NULL;
+        }
+    }
+    long *directory_modified = indexModified(indexer.index, directory);
+    if (directory_modified != NULL)
+    {
+        *directory_modified = modified;
+    }
+    pthread_rwlock_unlock(&indexer.index->lock);
+
+    for (long i = 0; i < count; i++)
+    {
+        if (children[i] != NULL)
+        {
+            indexPushDirectory(children[i]);
+            free(children[i]);
+        }
+    }
+    free(children);
+    free(directories);
+}
+
+// Build thread: takes directories off the queue until it is empty and no thread can add more
+static void *indexBuildThread(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&indexer.walk_lock);
+    while (1)
+    {
+        while (indexer.pending_count == 0 && indexer.busy > 0)
+        {
+            pthread_cond_wait(&indexer.walk_cond, &indexer.walk_lock);
+        }
+        if (indexer.pending_count == 0)
+        {
+            break;
+        }
+        char *directory = indexer.pending[--indexer.pending_count];
+        indexer.busy++;
+        pthread_mutex_unlock(&indexer.walk_lock);
+
+        indexDirectory(directory);
+        free(directory);
+
+        pthread_mutex_lock(&indexer.walk_lock);
+        indexer.busy--;
+    }
+    pthread_cond_broadcast(&indexer.walk_cond);
+    pthread_mutex_unlock(&indexer.walk_lock);
+    return NULL;
+}
+
+/**
+ * @brief Empties the index and indexes everything below root again with the build threads.
+ * The index is not ready while this runs.
+ *
+ * @param threads
+ */
+static void indexBuild(int threads)
+{
+    struct file_index *index = indexer.index;
+    pthread_rwlock_wrlock(&index->lock);
+    __atomic_store_n(&index->ready, 0, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&index->generation, 1, __ATOMIC_RELEASE);
+    memset(index->buckets, 0xff, sizeof(index->buckets));
+    index->entries = 0;
+    index->live_entries = 0;
+    index->path_bytes = 0;
+    index->root_modified = INDEX_CHANGED;
+    index->full = 0;
+    indexer.watch_failed = 0;
+    pthread_rwlock_unlock(&index->lock);
+
+    indexPushDirectory(indexer.root);
+    pthread_t workers[threads];
+    int started = 0;
+    for (int i = 0; i < threads; i++)
+    {
+        if (pthread_create(&workers[started], NULL, indexBuildThread, NULL) == 0)
+        {
+            started++;
+        }
+    }
+    if (started == 0)
+    {
+        indexBuildThread(NULL);
+    }
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+
+    pthread_rwlock_wrlock(&index->lock);
+    if (index->full)
+    {
+        printf("[File Index] The index is full after %ld entries, file search falls back to find\n", index->entries);
+    }
+    else if (!indexer.watch_failed)
+    {
+        __atomic_store_n(&index->ready, 1, __ATOMIC_RELEASE);
+    }
+    printf("[File Index] Indexed %ld files and directories under %s\n", index->live_entries, indexer.root);
+    pthread_rwlock_unlock(&index->lock);
+}
+
+// Applies one inotify event, returns 1 when the index has to be rebuilt
+static int indexApplyEvent(const struct inotify_event *event)
+{
+    if (event->mask & IN_Q_OVERFLOW)
+    {
+        printf("[File Index] Missed file system events, rebuilding the index\n");
+        return 1;
+    }
+
+    pthread_mutex_lock(&indexer.watch_lock);
+    char *watched = event->wd < indexer.watched_capacity ? indexer.watched[event->wd] : NULL;
+    if (event->mask & IN_IGNORED)
+    {
+        // The watched directory is gone
+        if (watched != NULL)
+        {
+            free(watched);
+            indexer.watched[event->wd] = NULL;
+        }
+        pthread_mutex_unlock(&indexer.watch_lock);
+        return 0;
+    }
+    if (watched == NULL || event->len == 0)
+    {
+        pthread_mutex_unlock(&indexer.watch_lock);
+        return 0;
+    }
+    char directory[PATH_MAX];
+    char path[PATH_MAX];
+    snprintf(directory, sizeof(directory), "%s", watched);
+    int truncated = snprintf(path, sizeof(path), "%s/%s", watched, event->name) >= (int)sizeof(path);
+    pthread_mutex_unlock(&indexer.watch_lock);
+    if (truncated)
+    {
+        return 0;
+    }
+
+    int is_directory = (event->mask & IN_ISDIR) != 0;
+    int added = 0;
+    pthread_rwlock_wrlock(&indexer.index->lock);
+    // The directory no longer looks like it did when it was read, the next server reads it again
+    long *directory_modified = indexModified(indexer.index, directory);
+    if (directory_modified != NULL)
+    {
+        *directory_modified = INDEX_CHANGED;
+    }
+    if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+    {
+        indexRemove(indexer.index, path, is_directory);
+    }
+    else if (event->mask & (IN_CREATE | IN_MOVED_TO))
+    {
+        added = indexInsert(indexer.index, path, is_directory);
+    }
+    pthread_rwlock_unlock(&indexer.index->lock);
+
+    // The watches of a directory moved away would report under the old path
+    if (is_directory && (event->mask & IN_MOVED_FROM))
+    {
+        long length = strlen(path);
+        pthread_mutex_lock(&indexer.watch_lock);
+        for (int wd = 0; wd < indexer.watched_capacity; wd++)
+        {
+            char *other = indexer.watched[wd];
+            if (other != NULL && strncmp(other, path, length) == 0 && (other[length] == '\0' || other[length] == '/'))
+            {
+                inotify_rm_watch(indexer.inotify_fd, wd);
+            }
+        }
+        pthread_mutex_unlock(&indexer.watch_lock);
+    }
+
+    // A new or moved in directory may already hold files
+    if (is_directory && added)
+    {
+        indexPushDirectory(path);
+        indexBuildThread(NULL);
+    }
+    return indexer.index->full || indexer.watch_failed;
+}
+
+/**
+ * @brief Writes the index to the snapshot file. The entries are renumbered as they are copied
+ * so the room of removed entries is left out. The file is written next to the snapshot and
+ * renamed over it, so a reader never sees half a snapshot.
+ */
+__attribute__((unused)) static void indexSave()
+{
+    struct file_index *index = indexer.index;
+    if (index == NULL || indexer.snapshot[0] == '\0')
+    {
+        return;
+    }
+
+    struct index_snapshot header;
+    struct stat st;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = INDEX_SNAPSHOT_VERSION;
+    if (realpath(indexer.root, header.root) == NULL || stat(indexer.root, &st) == -1)
+    {
+        perror("[File Index] Error while resolving the root for the snapshot");
+        return;
+    }
+    header.root_device = st.st_dev;
+    header.root_inode = st.st_ino;
+
+    pthread_rwlock_rdlock(&index->lock);
+    if (!__atomic_load_n(&index->ready, __ATOMIC_ACQUIRE))
+    {
+        pthread_rwlock_unlock(&index->lock);
+        return;
+    }
+    long *buckets = (long *)malloc(sizeof(index->buckets));
+    struct index_entry *table = (struct index_entry *)malloc((index->live_entries + 1) * sizeof(struct index_entry));
+    char *paths = (char *)malloc(index->path_bytes + 1);
+    if (buckets == NULL || table == NULL || paths == NULL)
+    {
+        pthread_rwlock_unlock(&index->lock);
+        free(buckets);
+        free(table);
+        free(paths);
+        return;
+    }
+    for (long b = 0; b < INDEX_BUCKETS; b++)
+    {
+        long *link = &buckets[b];
+        for (long i = index->buckets[b]; i != INDEX_NO_ENTRY; i = index->table[i].next)
+        {
+            const char *path = index->paths + index->table[i].path;
+            long length = strlen(path) + 1;
+            table[header.entries] = index->table[i];
+            table[header.entries].path = header.path_bytes;
+            memcpy(paths + header.path_bytes, path, length);
+            header.path_bytes += length;
+            *link = header.entries;
+            link = &table[header.entries++].next;
+        }
+        *link = INDEX_NO_ENTRY;
+    }
+    header.root_modified = index->root_modified;
+    pthread_rwlock_unlock(&index->lock);
+
+    char temporary[PATH_MAX + 8];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", indexer.snapshot);
+    FILE *file = fopen(temporary, "w");
+    int written = file != NULL && fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(buckets, sizeof(index->buckets), 1, file) == 1 &&
+                  (long)fwrite(table, sizeof(struct index_entry), header.entries, file) == header.entries &&
+                  (long)fwrite(paths, 1, header.path_bytes, file) == header.path_bytes;
+    if (file == NULL || fclose(file) != 0 || !written || rename(temporary, indexer.snapshot) == -1)
+    {
+        perror("[File Index] Error while writing the snapshot");
+        unlink(temporary);
+    }
+    else
+    {
+        printf("[File Index] Wrote %ld entries to %s\n", header.entries, indexer.snapshot);
+    }
+    free(buckets);
+    free(table);
+    free(paths);
+}
+
+/**
+ * @brief Copies the snapshot into the index when it was written for the same root and is
+ * consistent, and makes the index ready
+ *
+ * @return int 1 when the snapshot was loaded
+ */
+static int indexLoad()
+{
+    struct file_index *index = indexer.index;
+    long started = 0;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    started = ts.tv_sec * 1000000000L + ts.tv_nsec;
+
+    int fd = open(indexer.snapshot, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return 0;
+    }
+    struct stat st;
+    struct stat root;
+    char root_path[PATH_MAX];
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(struct index_snapshot) || stat(indexer.root, &root) == -1 ||
+        realpath(indexer.root, root_path) == NULL)
+    {
+        close(fd);
+        return 0;
+    }
+    const char *snapshot = (const char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (snapshot == MAP_FAILED)
+    {
+        return 0;
+    }
+
+    const struct index_snapshot *header = (const struct index_snapshot *)snapshot;
+    const long *buckets = (const long *)(snapshot + sizeof(struct index_snapshot));
+    const struct index_entry *table = (const struct index_entry *)(buckets + INDEX_BUCKETS);
+    const char *paths = (const char *)(table + (header->entries > 0 ? header->entries : 0));
+    int valid = memcmp(header->magic, INDEX_SNAPSHOT_MAGIC, sizeof(header->magic)) == 0 && header->version == INDEX_SNAPSHOT_VERSION &&
+                header->entries >= 0 && header->entries <= INDEX_MAX_ENTRIES && header->path_bytes >= 0 && header->path_bytes <= INDEX_PATH_BYTES &&
+                st.st_size == (off_t)(sizeof(struct index_snapshot) + sizeof(index->buckets) + header->entries * sizeof(struct index_entry) + header->path_bytes) &&
+                header->root_device == root.st_dev && header->root_inode == root.st_ino && strncmp(header->root, root_path, PATH_MAX) == 0;
+
+    // Every link and path has to stay inside the snapshot
+    for (long b = 0; valid && b < INDEX_BUCKETS; b++)
+    {
+        valid = buckets[b] >= INDEX_NO_ENTRY && buckets[b] < header->entries;
+    }
+    for (long i = 0; valid && i < header->entries; i++)
+    {
+        valid = table[i].next >= INDEX_NO_ENTRY && table[i].next < header->entries && table[i].path >= 0 && table[i].path < header->path_bytes &&
+                memchr(paths + table[i].path, '\0', header->path_bytes - table[i].path) != NULL && table[i].name >= 0 &&
+                table[i].name < (long)strlen(paths + table[i].path) + 1;
+    }
+    // and the chains hold each entry at most once, or a lookup would never end
+    long linked = 0;
+    for (long b = 0; valid && b < INDEX_BUCKETS; b++)
+    {
+        for (long i = buckets[b]; valid && i != INDEX_NO_ENTRY; i = table[i].next)
+        {
+            valid = ++linked <= header->entries;
+        }
+    }
+    if (!valid)
+    {
+        printf("[File Index] Ignoring %s, it does not fit this tree or this server\n", indexer.snapshot);
+        munmap((void *)snapshot, st.st_size);
+        return 0;
+    }
+
+    pthread_rwlock_wrlock(&index->lock);
+    __atomic_add_fetch(&index->generation, 1, __ATOMIC_RELEASE);
+    memcpy(index->buckets, buckets, sizeof(index->buckets));
+    memcpy(index->table, table, header->entries * sizeof(struct index_entry));
+    memcpy(index->paths, paths, header->path_bytes);
+    index->entries = header->entries;
+    index->live_entries = header->entries;
+    index->path_bytes = header->path_bytes;
+    index->root_modified = header->root_modified;
+    index->full = 0;
+    __atomic_store_n(&index->ready, 1, __ATOMIC_RELEASE);
+    pthread_rwlock_unlock(&index->lock);
+    munmap((void *)snapshot, st.st_size);
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    printf("[File Index] Loaded %ld entries from %s in %.1f ms\n", index->entries, indexer.snapshot, (ts.tv_sec * 1000000000L + ts.tv_nsec - started) / 1e6);
+    return 1;
+}
+
+static int compareStrings(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * @brief Brings an index loaded from a snapshot up to date with the tree. Every directory is
+ * watched and the ones whose modification time is not the one they were read with are read
+ * again: their entries that are gone are removed, and new ones are added, new subdirectories
+ * with everything below them.
+ */
+static void indexReconcile()
+{
+    struct file_index *index = indexer.index;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    long started = ts.tv_sec * 1000000000L + ts.tv_nsec;
+
+    // The directories and their times are copied out, the index changes under them
+    pthread_rwlock_rdlock(&index->lock);
+    long directory_count = 1;
+    char **directories = (char **)malloc((index->live_entries + 1) * sizeof(char *));
+    long *modified = (long *)malloc((index->live_entries + 1) * sizeof(long));
+    directories[0] = strdup(indexer.root);
+    modified[0] = index->root_modified;
+    for (long b = 0; b < INDEX_BUCKETS; b++)
+    {
+        for (long i = index->buckets[b]; i != INDEX_NO_ENTRY; i = index->table[i].next)
+        {
+            if (index->table[i].directory)
+            {
+                directories[directory_count] = strdup(index->paths + index->table[i].path);
+                modified[directory_count++] = index->table[i].modified;
+            }
+        }
+    }
+    pthread_rwlock_unlock(&index->lock);
+
+    long changed_count = 0;
+    char **changed = (char **)malloc(directory_count * sizeof(char *));
+    for (long i = 0; i < directory_count; i++)
+    {
+        struct stat st;
+        indexWatchDirectory(directories[i]);
+        if (lstat(directories[i], &st) == 0 && S_ISDIR(st.st_mode) && (modified[i] == INDEX_CHANGED || indexModifiedNs(&st) != modified[i]))
+        {
+            changed[changed_count++] = directories[i];
+        }
+        else
+        {
+            free(directories[i]);
+        }
+    }
+    free(directories);
+    free(modified);
+    qsort(changed, changed_count, sizeof(char *), compareStrings);
+
+    // Entries of a changed directory may be gone. Those that are are collected and removed.
+    long gone_count = 0;
+    long gone_capacity = 0;
+    char **gone = NULL;
+    int *gone_directories = NULL;
+    if (changed_count > 0)
+    {
+        pthread_rwlock_rdlock(&index->lock);
+        for (long b = 0; b < INDEX_BUCKETS; b++)
+        {
+            for (long i = index->buckets[b]; i != INDEX_NO_ENTRY; i = index->table[i].next)
+            {
+                char parent[PATH_MAX];
+                const char *path = index->paths + index->table[i].path;
+                snprintf(parent, sizeof(parent), "%.*s", index->table[i].name > 0 ? index->table[i].name - 1 : 0, path);
+                char *key = parent;
+                struct stat st;
+                if (bsearch(&key, changed, changed_count, sizeof(char *), compareStrings) == NULL || lstat(path, &st) == 0)
+                {
+                    continue;
+                }
+                if (gone_count == gone_capacity)
+                {
+                    gone_capacity = gone_capacity ? gone_capacity * 2 : 64;
+                    gone = (char **)realloc(gone, gone_capacity * sizeof(char *));
+                    gone_directories = (int *)realloc(gone_directories, gone_capacity * sizeof(int));
+                }
+                gone_directories[gone_count] = index->table[i].directory;
+                gone[gone_count++] = strdup(path);
+            }
+        }
+        pthread_rwlock_unlock(&index->lock);
+    }
+    pthread_rwlock_wrlock(&index->lock);
+    for (long i = 0; i < gone_count; i++)
+    {
+        indexRemove(index, gone[i], gone_directories[i]);
+        free(gone[i]);
+    }
+    pthread_rwlock_unlock(&index->lock);
+    free(gone);
+    free(gone_directories);
+
+    // Reading a changed directory again adds what is new and walks the new subdirectories
+    for (long i = 0; i < changed_count; i++)
+    {
+        indexPushDirectory(changed[i]);
+        indexBuildThread(NULL);
+        free(changed[i]);
+    }
+    free(changed);
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    printf("[File Index] Reconciled %ld directories with the tree, %ld had changed and %ld entries were gone, in %.1f ms\n", directory_count,
+           changed_count, gone_count, (ts.tv_sec * 1000000000L + ts.tv_nsec - started) / 1e6);
+}
+
+// Watcher thread of the main server
+static void *indexWatch(void *arg)
+{
+    (void)arg;
+    char buffer[INDEX_EVENT_BUFFER] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    // Events that happen meanwhile wait in the inotify queue
+    if (indexer.loaded)
+    {
+        indexReconcile();
+        if (indexer.index->full || indexer.watch_failed)
+        {
+            indexBuild(indexer.threads);
+        }
+        indexSave();
+    }
+
+    while (1)
+    {
+        ssize_t length = read(indexer.inotify_fd, buffer, sizeof(buffer));
+        if (length <= 0)
+        {
+            if (length == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            perror("[File Index] Error while reading file system events, file search falls back to find");
+            __atomic_store_n(&indexer.index->ready, 0, __ATOMIC_RELEASE);
+            return NULL;
+        }
+
+        int rebuild = 0;
+        for (char *position = buffer; position < buffer + length;)
+        {
+            const struct inotify_event *event = (const struct inotify_event *)position;
+            rebuild |= indexApplyEvent(event);
+            position += sizeof(struct inotify_event) + event->len;
+        }
+        if (rebuild)
+        {
+            indexBuild(indexer.threads);
+            indexSave();
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Creates the shared index, loads it from the snapshot or else builds it, and starts the
+ * watcher thread. Must be called before the workers are forked so that they share the index.
+ *
+ * @param root
+ * @param threads number of build threads
+ * @param snapshot path of the snapshot file, NULL for none
+ * @return struct file_index* NULL when the index could not be set up
+ */
+__attribute__((unused)) static struct file_index *indexStart(const char *root, int threads, const char *snapshot)
+{
+    struct file_index *index = (struct file_index *)mmap(NULL, sizeof(struct file_index), PROT_READ | PROT_WRITE,
+                                                         MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (index == MAP_FAILED)
+    {
+        perror("[File Index] Error while mapping the index");
+        return NULL;
+    }
+
+    pthread_rwlockattr_t attributes;
+    pthread_rwlockattr_init(&attributes);
+    pthread_rwlockattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+    pthread_rwlock_init(&index->lock, &attributes);
+    pthread_rwlockattr_destroy(&attributes);
+
+    indexer.index = index;
+    snprintf(indexer.root, sizeof(indexer.root), "%s", root);
+    if ((indexer.inotify_fd = inotify_init1(IN_CLOEXEC)) == -1)
+    {
+        perror("[File Index] Error while setting up inotify, file search falls back to find");
+        return index;
+    }
+
+    indexer.threads = threads;
+    snprintf(indexer.snapshot, sizeof(indexer.snapshot), "%s", snapshot != NULL ? snapshot : "");
+    indexer.loaded = snapshot != NULL && indexLoad();
+    if (!indexer.loaded)
+    {
+        indexBuild(threads);
+        indexSave();
+    }
+
+    pthread_t watcher;
+    if (pthread_create(&watcher, NULL, indexWatch, NULL) != 0)
+    {
+        perror("[File Index] Error while creating the watcher thread, file search falls back to find");
+        __atomic_store_n(&index->ready, 0, __ATOMIC_RELEASE);
+        return index;
+    }
+    pthread_detach(watcher);
+    return index;
+}
+
+#endif
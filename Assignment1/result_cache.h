@@ -0,0 +1,223 @@
+/**
+ * @file result_cache.h
+ * @author Divyateja Pasupuleti
+ * @brief
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2023
+ * POSIX-compliant C header result_cache.h
+ *
+ * Cache of the replies of the File Search and the File Word Count servers, shared by the main
+ * server and its workers. The workers fill it in, and the main server answers a request it finds
+ * in the cache itself instead of passing it on to the pool.
+ *
+ * A word count is keyed on the file name together with the device, inode, modification time and
+ * size of the file, so a file that has been replaced or changed misses. A file modified less than
+ * RESULT_CACHE_RACY_NS ago is not cached at all: a rewrite of the same size within one tick of
+ * the file system's timestamps would keep the same key, the way git treats racy index entries.
+ * A file search is keyed
+ * on the name and the generation of the file index, so any change to the tree misses.
+ *
+ * The cache holds RESULT_CACHE_SETS * RESULT_CACHE_WAYS replies. A key can only live in the
+ * RESULT_CACHE_WAYS slots of the set its name hashes to, and the least recently used of those
+ * makes room for a new reply.
+ *
+ */
+
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define RESULT_CACHE_SETS 256
+#define RESULT_CACHE_WAYS 4
+#define RESULT_CACHE_TEXT 100
+#define RESULT_CACHE_RACY_NS 2000000000L
+
+/**
+ * What a reply depends on. Fields that do not apply to the operation are 0.
+ */
+struct result_key
+{
+    char operation;
+    char name[RESULT_CACHE_TEXT];
+    dev_t device;
+    ino_t inode;
+    struct timespec modified;
+    off_t size;
+    long generation;
+};
+
+struct result_entry
+{
+    int used;
+    long last_used;
+    struct result_key key;
+    char reply[RESULT_CACHE_TEXT];
+};
+
+struct result_cache
+{
+    pthread_mutex_t lock;
+    long clock;
+    long hits;
+    long misses;
+    struct result_entry sets[RESULT_CACHE_SETS][RESULT_CACHE_WAYS];
+};
+
+/**
+ * @brief Maps the cache where the processes forked afterwards share it
+ *
+ * @return struct result_cache* NULL when it could not be mapped
+ */
+__attribute__((unused)) static struct result_cache *resultCacheCreate()
+{
+    struct result_cache *cache = (struct result_cache *)mmap(NULL, sizeof(struct result_cache), PROT_READ | PROT_WRITE,
+                                                             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (cache == MAP_FAILED)
+    {
+        perror("[Result Cache] Error while mapping the cache");
+        return NULL;
+    }
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&cache->lock, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+    return cache;
+}
+
+/**
+ * @brief Fills in the key of a request. A word count needs the file to exist, its key is taken
+ * from stat before the file is read. A file whose modification time is not at least
+ * RESULT_CACHE_RACY_NS in the past, which covers coarse and 2 s timestamps, is not cached.
+ *
+ * @param key
+ * @param operation
+ * @param name
+ * @param generation generation of the file index for a file search
+ * @return int 1 when the request can be cached
+ */
+__attribute__((unused)) static int resultKey(struct result_key *key, char operation, const char *name, long generation)
+{
+    memset(key, 0, sizeof(*key));
+    key->operation = operation;
+    if (strlen(name) >= RESULT_CACHE_TEXT)
+    {
+        return 0;
+    }
+    strcpy(key->name, name);
+    if (operation == '3')
+    {
+        struct stat st;
+        if (stat(name, &st) == -1 || !S_ISREG(st.st_mode))
+        {
+            return 0;
+        }
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        long age_ns = (now.tv_sec - st.st_mtim.tv_sec) * 1000000000L + (now.tv_nsec - st.st_mtim.tv_nsec);
+        if (age_ns < RESULT_CACHE_RACY_NS)
+        {
+            return 0;
+        }
+        key->device = st.st_dev;
+        key->inode = st.st_ino;
+        key->modified = st.st_mtim;
+        key->size = st.st_size;
+    }
+    else
+    {
+        key->generation = generation;
+    }
+    return 1;
+}
+
+static int resultKeyEqual(const struct result_key *a, const struct result_key *b)
+{
+    return a->operation == b->operation && a->device == b->device && a->inode == b->inode && a->modified.tv_sec == b->modified.tv_sec &&
+           a->modified.tv_nsec == b->modified.tv_nsec && a->size == b->size && a->generation == b->generation && strcmp(a->name, b->name) == 0;
+}
+
+// The set a key lives in, by its operation and name only so that a newer key replaces an older one
+static struct result_entry *resultSet(struct result_cache *cache, const struct result_key *key)
+{
+    unsigned long hash = 14695981039346656037UL ^ (unsigned char)key->operation;
+    for (const char *c = key->name; *c; c++)
+    {
+        hash = (hash ^ (unsigned char)*c) * 1099511628211UL;
+    }
+    return cache->sets[hash % RESULT_CACHE_SETS];
+}
+
+/**
+ * @brief Looks a reply up
+ *
+ * @param cache
+ * @param key
+ * @param reply receives the reply on a hit
+ * @return int 1 on a hit
+ */
+__attribute__((unused)) static int resultCacheGet(struct result_cache *cache, const struct result_key *key, char *reply)
+{
+    struct result_entry *set = resultSet(cache, key);
+    int hit = 0;
+    pthread_mutex_lock(&cache->lock);
+    for (int way = 0; way < RESULT_CACHE_WAYS; way++)
+    {
+        if (set[way].used && resultKeyEqual(&set[way].key, key))
+        {
+            set[way].last_used = ++cache->clock;
+            memcpy(reply, set[way].reply, RESULT_CACHE_TEXT);
+            hit = 1;
+            break;
+        }
+    }
+    if (hit)
+        cache->hits++;
+    else
+        cache->misses++;
+    pthread_mutex_unlock(&cache->lock);
+    return hit;
+}
+
+/**
+ * @brief Stores a reply. It takes the place of a stale reply to the same request, or else of
+ * the least recently used one of its set.
+ *
+ * @param cache
+ * @param key
+ * @param reply
+ */
+__attribute__((unused)) static void resultCachePut(struct result_cache *cache, const struct result_key *key, const char *reply)
+{
+    struct result_entry *set = resultSet(cache, key);
+    pthread_mutex_lock(&cache->lock);
+    struct result_entry *victim = &set[0];
+    for (int way = 0; way < RESULT_CACHE_WAYS; way++)
+    {
+        struct result_entry *entry = &set[way];
+        if (entry->used && entry->key.operation == key->operation && strcmp(entry->key.name, key->name) == 0)
+        {
+            victim = entry;
+            break;
+        }
+        if (!entry->used || (victim->used && entry->last_used < victim->last_used))
+        {
+            victim = entry;
+        }
+    }
+    victim->used = 1;
+    victim->last_used = ++cache->clock;
+    victim->key = *key;
+    snprintf(victim->reply, RESULT_CACHE_TEXT, "%s", reply);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+#endif
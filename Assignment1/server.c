@@ -10,7 +10,9 @@
  *
  */
 
+#include <errno.h>
 #include <fcntl.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -21,16 +23,28 @@
 #include <unistd.h>
 #include <limits.h>
 
+#include "content_search.h"
+#include "file_index.h"
+#include "result_cache.h"
+#include "word_count.h"
+
 #define MESSAGE_LENGTH 100
 #define SERVER_RECEIVES_ON_CHANNEL 1
 #define WRITE_END_OF_PIPE 1
 #define READ_END_OF_PIPE 0
+#define DEFAULT_WORKERS 4
+#define MAX_WORKERS 64
+#define FILE_FOUND_PREFIX "File found: "
+#define MORE_PATHS " ..."
+#define PARTIAL_REPLY 'p'
 
 struct data
 {
     char message[MESSAGE_LENGTH];
     char operation;
     long client_id;
+    long request_id;
+    long reply_channel;
 };
 
 struct msg_buffer
@@ -39,12 +53,20 @@ struct msg_buffer
     struct data data;
 };
 
+// Shared with the workers, NULL when file search has to run find
+static struct file_index *file_index = NULL;
+// Shared with the workers, NULL when replies are not cached
+static struct result_cache *result_cache = NULL;
+
 /**
 Here we use data struct which keeps track of which operation is being performed. 1 stands for ping,
-2 stands for file search, 3 stands for within file search and 4 starts of cleanup. Here the important
+2 stands for file search, 3 stands for within file search, 4 starts of cleanup and 5 stands for
+content search. Here the important
 part is r. r stands for reply. When the server is replying to a client it uses r to ensure it doesn't
 get mixed up by anything else. We also faced major issues while trying to use wait() since forgetting
 wait leads to race conditions and it calling itself for an infinite number of times.
+Replies go to the reply channel of the client that sent the request, with its request id,
+and the server only reads its own channel, so replies never pass through the server.
 */
 
 /**
@@ -65,24 +87,23 @@ void ping(int msg_queue_id, int client_id, struct msg_buffer msg)
     msg.data.message[5] = '\0';
 
     // We set message type as the client id so that only client receives the code
-    msg.msg_type = client_id;
+    msg.msg_type = msg.data.reply_channel;
     msg.data.client_id = client_id;
     msg.data.operation = 'r';
 
     if (msgsnd(msg_queue_id, &msg, sizeof(msg.data), 0) == -1)
     {
         perror("[Child Process: Ping] Message could not be sent, please try again");
-        exit(EXIT_FAILURE);
     }
     else
     {
         printf("[Child Process: Ping] Message sent back to client %d successfully\n", client_id);
-        exit(EXIT_SUCCESS);
     }
 }
 
 /**
- * @brief File Search Server: Uses 'find' function to get output.
+ * @brief File Search Server: Looks the file name up in the file index and sends back the
+ * paths that match, as many as fit in a message. Uses 'find' while the index is not ready.
  *
  */
 void file_search(const char *filename, int msg_queue_id, int client_id, struct msg_buffer msg)
@@ -90,6 +111,43 @@ void file_search(const char *filename, int msg_queue_id, int client_id, struct m
     int link[2];
     pid_t pid;
 
+    char paths[MESSAGE_LENGTH - sizeof(FILE_FOUND_PREFIX) - sizeof(MORE_PATHS)];
+    long listed;
+    long generation;
+    long matches = file_index != NULL ? indexLookup(file_index, filename, paths, sizeof(paths), &listed, &generation) : -1;
+    if (matches >= 0)
+    {
+        fprintf(stderr, "[Child Process: File Search] %ld paths match %s in the file index\n", matches, filename);
+        if (matches == 0)
+        {
+            strcpy(msg.data.message, "File not found\n");
+        }
+        else
+        {
+            snprintf(msg.data.message, MESSAGE_LENGTH, "%s%s%s\n", FILE_FOUND_PREFIX, paths, listed < matches ? MORE_PATHS : "");
+        }
+
+        struct result_key key;
+        if (result_cache != NULL && resultKey(&key, '2', filename, generation))
+        {
+            resultCachePut(result_cache, &key, msg.data.message);
+        }
+
+        msg.msg_type = msg.data.reply_channel;
+        msg.data.client_id = client_id;
+        msg.data.operation = 'r';
+
+        if (msgsnd(msg_queue_id, &msg, sizeof(msg.data), 0) == -1)
+        {
+            perror("[Child Process: File Search] Message could not be sent, please try again");
+        }
+        else
+        {
+            fprintf(stderr, "[Child Process: File Search] Message '%s' sent back to client %d successfully\n", msg.data.message, client_id);
+        }
+        return;
+    }
+
     // Read the filename from user input
     char output[4096];
 
@@ -153,102 +211,276 @@ void file_search(const char *filename, int msg_queue_id, int client_id, struct m
             strcpy(msg.data.message, "File found\n");
         }
 
-        msg.msg_type = client_id;
+        msg.msg_type = msg.data.reply_channel;
         msg.data.client_id = client_id;
         msg.data.operation = 'r';
 
         if (msgsnd(msg_queue_id, &msg, sizeof(msg.data), 0) == -1)
         {
             perror("[Child Process: File Search] Message could not be sent, please try again");
-            exit(EXIT_FAILURE);
         }
         else
         {
             fprintf(stderr, "[Child Process: File Word] Message '%s' sent back to client %d successfully\n", msg.data.message, client_id);
         }
         close(link[READ_END_OF_PIPE]);
-        exit(EXIT_SUCCESS);
     }
 }
 
 /**
- * @brief File Word Count Server: Uses 'wc' function to get output.
- * This function counts words in a file and sends the result to the client.
+ * @brief File Word Count Server: Counts the words of the file in process, the way 'wc -w' does,
+ * and sends the result to the client.
  *
  */
 void word_count(const char *filename, int msg_queue_id, int client_id, struct msg_buffer msg)
 {
-    int link[2];       // array for file descriptors
-    pid_t pid;         // process id
-    char output[4096]; // buffer to store output of 'wc'
+    fprintf(stderr, "[Child Process: Word Count] Entered filename: %s\n", filename);
 
-    if (pipe(link) == -1) // pipe creation
+    // The key is taken before the file is read, a change while it is read makes the next request miss
+    struct result_key key;
+    int cacheable = result_cache != NULL && resultKey(&key, '3', filename, 0);
+
+    long wordCount = countWords(filename);
+    if (wordCount < 0)
     {
-        fprintf(stderr, "%s\n", "[Child Process: File Search] Error in pipe creation");
-        exit(EXIT_FAILURE);
+        perror("[Child Process: Word Count] Error while reading the file");
+        wordCount = 0;
+        cacheable = 0;
     }
 
-    if ((pid = fork()) == -1) // fork a new process
+    // Message to be sent to client
+    snprintf(msg.data.message, sizeof(msg.data.message), "Word count: %ld\n", wordCount);
+    if (cacheable)
     {
-        fprintf(stderr, "%s\n", "[Child Process: File Search] Error in fork creation");
-        exit(EXIT_FAILURE);
+        resultCachePut(result_cache, &key, msg.data.message);
     }
 
-    if (pid == 0)
+    // We use message type as client so that only client receives that message
+    msg.msg_type = msg.data.reply_channel;
+    msg.data.client_id = client_id;
+    msg.data.operation = 'r';
+
+    if (msgsnd(msg_queue_id, &msg, sizeof(msg.data), 0) == -1) // send message
     {
-        // Child process
-        dup2(link[WRITE_END_OF_PIPE], STDOUT_FILENO); // redirect stdout to write end of pipe
-        close(link[READ_END_OF_PIPE]);                // close read end not needed
-        close(link[WRITE_END_OF_PIPE]);               // close write end redirected
-        fprintf(stderr, "[Child Process: File Search] Entered filename: %s\n", filename);
+        perror("[Child Process: Word Count] Message could not be sent, please try again");
+    }
+    else
+    {
+        fprintf(stderr, "[Child Process: Word Count] Message '%s' sent back to client %d successfully\n", msg.data.message, client_id);
+    }
+}
 
-        // Use'wc' command to count words in the file
-        execlp("wc", "wc", "-w", filename, NULL);
+/**
+ * @brief Content Search Server: Counts the lines of a file, or of every file below a
+ * directory, that contain a pattern. Where the matching lines are is sent back first, page by
+ * page as PARTIAL_REPLY messages, then the counts as the reply that ends the request.
+ * The message holds the path, a '\0' and then the pattern.
+ *
+ */
+void content_search(int msg_queue_id, int client_id, struct msg_buffer msg)
+{
+    char path[MESSAGE_LENGTH];
+    char pattern[MESSAGE_LENGTH];
+    msg.data.message[MESSAGE_LENGTH - 1] = '\0';
+    strcpy(path, msg.data.message);
+    long path_length = strlen(path);
+    strcpy(pattern, path_length + 1 < MESSAGE_LENGTH ? msg.data.message + path_length + 1 : "");
+    fprintf(stderr, "[Child Process: Content Search] Searching %s for '%s'\n", path, pattern);
+
+    msg.msg_type = msg.data.reply_channel;
+    msg.data.client_id = client_id;
 
-        fprintf(stderr, "%s\n", "Error in execl");
-        exit(EXIT_FAILURE);
+    struct content_search search;
+    if (pattern[0] == '\0')
+    {
+        strcpy(msg.data.message, "The pattern is empty\n");
+    }
+    else if (searchContent(&search, path, pattern) < 0)
+    {
+        perror("[Child Process: Content Search] Error while reading the path");
+        // The path is cut so that the whole reply fits in the message
+        snprintf(msg.data.message, sizeof(msg.data.message), "Nothing to search at %.*s\n",
+                 (int)(sizeof(msg.data.message) - sizeof("Nothing to search at \n")), path);
+        contentSearchFree(&search);
     }
     else
     {
-        // Parent process
-        // Wait for child process to terminate
-        waitpid(pid, NULL, 0);
-        close(link[WRITE_END_OF_PIPE]); // close write end not needed
+        msg.data.operation = PARTIAL_REPLY;
+        while (contentSearchNextPage(&search, msg.data.message, MESSAGE_LENGTH))
+        {
+            if (msgsnd(msg_queue_id, &msg, sizeof(msg.data), 0) == -1)
+            {
+                perror("[Child Process: Content Search] Matches could not be sent");
+                break;
+            }
+        }
+        fprintf(stderr, "[Child Process: Content Search] Sent %ld pages with %ld matches to client %d\n", search.pages, search.listed, client_id);
+        contentSearchSummary(&search, msg.data.message, MESSAGE_LENGTH);
+        contentSearchFree(&search);
+    }
 
-        int numberOfBytes = read(link[READ_END_OF_PIPE], output, sizeof(output)); // read wc output from read end
-        // fprintf(stderr, "Output of wc: (%.*s)\n", numberOfBytes, output);
+    msg.data.operation = 'r';
+    if (msgsnd(msg_queue_id, &msg, sizeof(msg.data), 0) == -1)
+    {
+        perror("[Child Process: Content Search] Message could not be sent, please try again");
+    }
+    else
+    {
+        fprintf(stderr, "[Child Process: Content Search] Message '%s' sent back to client %d successfully\n", msg.data.message, client_id);
+    }
+}
 
-        if (numberOfBytes < 0)
+/**
+ * @brief Worker process of the pool. Takes one request at a time from the request pipe and
+ * serves it, until the main server closes the pipe.
+ * Every request is written to the pipe as a whole struct msg_buffer, which is less than
+ * PIPE_BUF, so writes are atomic and every read returns exactly one request even with all
+ * the workers reading from the same pipe.
+ *
+ * @param msg_queue_id
+ * @param request_pipe read end of the request pipe
+ */
+void worker(int msg_queue_id, int request_pipe)
+{
+    struct msg_buffer msg;
+    ssize_t bytes;
+
+    while ((bytes = read(request_pipe, &msg, sizeof(msg))) == sizeof(msg) || (bytes == -1 && errno == EINTR))
+    {
+        if (bytes == -1)
         {
-            perror("[Child Process: File Search] Error in reading from pipe");
+            continue;
         }
-
-        int wordCount = 0;
-        if (numberOfBytes > 0)
+        switch (msg.data.operation)
         {
-            sscanf(output, "%d", &wordCount);
+        case '1':
+            ping(msg_queue_id, msg.data.client_id, msg);
+            break;
+        case '2':
+            file_search(msg.data.message, msg_queue_id, msg.data.client_id, msg);
+            break;
+        case '3':
+            word_count(msg.data.message, msg_queue_id, msg.data.client_id, msg);
+            break;
+        case '5':
+            content_search(msg_queue_id, msg.data.client_id, msg);
+            break;
+        default:
+            fprintf(stderr, "[Worker %d] Incorrect operation %c\n", getpid(), msg.data.operation);
+            break;
         }
+        // A worker lives on, so its output is not left to be flushed at exit
+        fflush(stdout);
+    }
 
-        // Message to be sent to client
-        snprintf(msg.data.message, sizeof(msg.data.message), "Word count: %d\n", wordCount);
+    if (bytes == -1)
+    {
+        perror("[Worker] Error while reading from the request pipe");
+        exit(EXIT_FAILURE);
+    }
+    exit(EXIT_SUCCESS);
+}
 
-        // We use message type as client so that only client receives that message
-        msg.msg_type = client_id;
-        msg.data.client_id = client_id;
-        msg.data.operation = 'r';
+/**
+ * @brief Forks one worker. The worker keeps only the read end of the request pipe, so that
+ * it sees the end of the pipe once the main server closes the write end.
+ *
+ * @param msg_queue_id
+ * @param request_pipe
+ * @return pid_t pid of the worker, -1 on error
+ */
+pid_t spawnWorker(int msg_queue_id, int request_pipe[2])
+{
+    // Otherwise the worker would print what the server has buffered once more
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(request_pipe[WRITE_END_OF_PIPE]);
+        signal(SIGCHLD, SIG_DFL);
+        worker(msg_queue_id, request_pipe[READ_END_OF_PIPE]);
+    }
+    else if (pid < 0)
+    {
+        perror("[Server] Error while creating a worker process");
+    }
+    return pid;
+}
 
-        if (msgsnd(msg_queue_id, &msg, sizeof(msg.data), 0) == -1) // send message
+/**
+ * @brief Reaps workers that have died and starts new ones in their place
+ *
+ * @param msg_queue_id
+ * @param request_pipe
+ * @param workers
+ * @param number_of_workers
+ */
+void replaceDeadWorkers(int msg_queue_id, int request_pipe[2], pid_t *workers, int number_of_workers)
+{
+    pid_t pid;
+    int wstatus;
+    while ((pid = waitpid(-1, &wstatus, WNOHANG)) > 0)
+    {
+        for (int i = 0; i < number_of_workers; i++)
         {
-            perror("[Child Process: File Search] Message could not be sent, please try again");
-            exit(EXIT_FAILURE);
+            if (workers[i] == pid)
+            {
+                printf("[Server] Worker %d exited with status %d, starting a new one\n", pid, WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : -1);
+                workers[i] = spawnWorker(msg_queue_id, request_pipe);
+            }
         }
-        else
+    }
+}
+
+/**
+ * @brief Answers a file search or a word count from the result cache, without passing it on to
+ * the workers. A file search is only answered while the file index is ready.
+ *
+ * @param msg_queue_id
+ * @param msg
+ * @return int 1 when the request has been answered
+ */
+int answerFromCache(int msg_queue_id, struct msg_buffer msg)
+{
+    struct result_key key;
+    long generation = 0;
+    int client_id = msg.data.client_id;
+
+    if (result_cache == NULL || (msg.data.operation != '2' && msg.data.operation != '3'))
+    {
+        return 0;
+    }
+    if (msg.data.operation == '2')
+    {
+        if (file_index == NULL || !__atomic_load_n(&file_index->ready, __ATOMIC_ACQUIRE))
         {
-            fprintf(stderr, "[Child Process: File Search] Message '%s' sent back to client %d successfully\n", msg.data.message, client_id);
+            return 0;
         }
-        close(link[READ_END_OF_PIPE]);
-        exit(EXIT_SUCCESS);
+        generation = __atomic_load_n(&file_index->generation, __ATOMIC_ACQUIRE);
+    }
+    msg.data.message[MESSAGE_LENGTH - 1] = '\0';
+    if (!resultKey(&key, msg.data.operation, msg.data.message, generation) || !resultCacheGet(result_cache, &key, msg.data.message))
+    {
+        return 0;
+    }
+
+    msg.msg_type = msg.data.reply_channel;
+    msg.data.operation = 'r';
+    if (msgsnd(msg_queue_id, &msg, sizeof(msg.data), 0) == -1)
+    {
+        perror("[Server] Message could not be sent, please try again");
     }
+    else
+    {
+        printf("[Server] Answered client %d from the result cache\n", client_id);
+    }
+    return 1;
+}
+
+// Only interrupts msgrcv, the main loop reaps the worker
+void handleChildExit(int signal_number)
+{
+    (void)signal_number;
 }
 
 /**
@@ -317,11 +549,19 @@ void cleanup(int msg_queue_id)
  *
  * @return int
  */
-int main()
+int main(int argc, char *argv[])
 {
     // Iniitalize the server
     printf("[Server] Initializing Server...\n");
 
+    // The size of the worker pool is the optional first argument
+    int number_of_workers = argc > 1 ? atoi(argv[1]) : DEFAULT_WORKERS;
+    if (number_of_workers < 1 || number_of_workers > MAX_WORKERS)
+    {
+        fprintf(stderr, "[Server] The number of workers must be between 1 and %d\n", MAX_WORKERS);
+        exit(EXIT_FAILURE);
+    }
+
     // Create the message queue
     key_t key;
     int msg_queue_id;
@@ -343,11 +583,45 @@ int main()
 
     printf("[Server] Successfully connected to the Message Queue %d %d\n", key, msg_queue_id);
 
+    // The index is loaded or built before the workers are forked so that they share it
+    char snapshot[PATH_MAX];
+    file_index = indexStart(".", INDEX_BUILD_THREADS, indexSnapshotPath(snapshot, sizeof(snapshot), "."));
+    result_cache = resultCacheCreate();
+
+    // Requests are handed to a pool of long-lived workers through a pipe instead of forking
+    // a child per request. The pipe is close-on-exec so find and wc do not keep it open.
+    int request_pipe[2];
+    if (pipe(request_pipe) == -1 || fcntl(request_pipe[READ_END_OF_PIPE], F_SETFD, FD_CLOEXEC) == -1 ||
+        fcntl(request_pipe[WRITE_END_OF_PIPE], F_SETFD, FD_CLOEXEC) == -1)
+    {
+        perror("[Server] Error in pipe creation");
+        exit(EXIT_FAILURE);
+    }
+
+    // SIGCHLD interrupts msgrcv so that a dead worker is replaced right away
+    struct sigaction child_exit;
+    memset(&child_exit, 0, sizeof(child_exit));
+    child_exit.sa_handler = handleChildExit;
+    sigemptyset(&child_exit.sa_mask);
+    sigaction(SIGCHLD, &child_exit, NULL);
+
+    pid_t workers[MAX_WORKERS];
+    for (int i = 0; i < number_of_workers; i++)
+    {
+        workers[i] = spawnWorker(msg_queue_id, request_pipe);
+    }
+    printf("[Server] Started %d workers\n", number_of_workers);
+
     // Listen to the message queue for new requests from the clients
     while (1)
     {
+        replaceDeadWorkers(msg_queue_id, request_pipe, workers, number_of_workers);
         if (msgrcv(msg_queue_id, &msg, sizeof(msg.data), SERVER_RECEIVES_ON_CHANNEL, 0) == -1)
         {
+            if (errno == EINTR)
+            {
+                continue;
+            }
             perror("[Server] Error while receiving message from the client");
             exit(EXIT_FAILURE);
         }
@@ -356,47 +630,30 @@ int main()
             // Debugging logs
             // printf("[Logs] Message received from Client %ld-Operation %c -> %s\n", msg.data.client_id, msg.data.operation, msg.data.message);
 
-            pid_t temporary_pid;
-
             if (msg.data.operation == '4')
             {
+                // The workers finish the requests left in the pipe and exit when it is closed
+                signal(SIGCHLD, SIG_DFL);
+                close(request_pipe[WRITE_END_OF_PIPE]);
+                // The next start loads the index instead of walking the tree
+                indexSave();
                 cleanup(msg_queue_id);
                 exit(EXIT_SUCCESS);
             }
-            else if (msg.data.operation == 'r')
+            else if (msg.data.reply_channel <= SERVER_RECEIVES_ON_CHANNEL)
             {
-                msg.data.operation = 'r';
-                if (msgsnd(msg_queue_id, &msg, MESSAGE_LENGTH, 0) == -1)
-                {
-                    printf("[Server] Message could not be added back to the queue\n");
-                }
+                printf("[Server] Dropped a request from client %ld without a reply channel\n", msg.data.client_id);
             }
-            else
-            { // Executing the respective fuctions if a message has been received
-                printf("[Server] Creating new child process for the new request received\n");
-                temporary_pid = fork();
-                if (temporary_pid < 0)
+            else if (!answerFromCache(msg_queue_id, msg))
+            { // Handing the request to the next free worker, unless the result cache had the reply
+                printf("[Server] Passing the new request to the worker pool\n");
+                while (write(request_pipe[WRITE_END_OF_PIPE], &msg, sizeof(msg)) == -1)
                 {
-                    perror("[Server] Error while creating child process");
-                }
-                else if (temporary_pid == 0)
-                {
-                    switch (msg.data.operation)
+                    if (errno != EINTR)
                     {
-                    case '1':
-                        ping(msg_queue_id, msg.data.client_id, msg);
-                        break;
-                    case '2':
-                        file_search(msg.data.message, msg_queue_id, msg.data.client_id, msg);
-                        break;
-                    case '3':
-                        word_count(msg.data.message, msg_queue_id, msg.data.client_id, msg);
-                        break;
-                    default:
-                        perror("Incorrect operation");
+                        perror("[Server] Error while passing the request to the workers");
                         break;
                     }
-                    exit(EXIT_SUCCESS);
                 }
             }
         }
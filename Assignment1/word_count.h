@@ -0,0 +1,313 @@
+/**
+ * @file word_count.h
+ * @author Divyateja Pasupuleti
+ * @brief
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2023
+ * POSIX-compliant C header word_count.h
+ *
+ * In-process word counter for the File Word Count server, counting like wc -w: a word starts at
+ * every byte that is not white space (space, \t, \n, \v, \f, \r) and follows white space or the
+ * start of the file.
+ *
+ * The file is mapped WORD_COUNT_WINDOW bytes at a time, so a file larger than memory or than the
+ * address space is streamed through one window after another. Inside a window 32 or 16 bytes are
+ * classified at once with AVX2 or SSE2, turned into a bit mask of white space bytes, and the word
+ * starts are counted with a popcount. AVX2 is used when the CPU has it, other architectures use
+ * the scalar loop.
+ *
+ * A file of at least two WORD_COUNT_CHUNK bytes is split into page aligned byte ranges that are
+ * counted on up to WORD_COUNT_THREADS threads, each as if its range started after white space.
+ * When a range starts inside a word that the range before it ends in, that word was counted
+ * twice and one is taken off.
+ *
+ */
+
+#ifndef WORD_COUNT_H
+#define WORD_COUNT_H
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WORD_COUNT_X86 1
+#endif
+
+#ifndef WORD_COUNT_WINDOW
+#define WORD_COUNT_WINDOW (64L << 20)
+#endif
+#ifndef WORD_COUNT_CHUNK
+#define WORD_COUNT_CHUNK (64L << 20)
+#endif
+#define WORD_COUNT_THREADS 8
+
+/**
+ * One byte range of a file counted by a thread. starts_in_word and ends_in_word say whether
+ * its first and its last byte are part of a word.
+ */
+struct word_count_chunk
+{
+    int fd;
+    long start;
+    long end;
+    long words;
+    int starts_in_word;
+    int ends_in_word;
+};
+
+static inline int wordCountIsSpace(unsigned char c)
+{
+    return c == ' ' || (unsigned char)(c - '\t') <= '\r' - '\t';
+}
+
+/**
+ * Counts the word starts of a block. previous_space says whether the byte before the block is
+ * white space and is updated to the last byte of the block.
+ */
+static long wordCountScalar(const unsigned char *bytes, long length, int *previous_space)
+{
+    long words = 0;
+    int space = *previous_space;
+    for (long i = 0; i < length; i++)
+    {
+        int current = wordCountIsSpace(bytes[i]);
+        words += space & !current;
+        space = current;
+    }
+    *previous_space = space;
+    return words;
+}
+
+#ifdef WORD_COUNT_X86
+// Word starts in a block given the white space mask of its bytes, bit i standing for byte i
+#define WORD_STARTS(space_mask, previous_space, bits) \
+    __builtin_popcountll(~(space_mask) & (((space_mask) << 1) | (previous_space)) & ((bits) == 64 ? ~0UL : (1UL << (bits)) - 1))
+
+static long wordCountSse2(const unsigned char *bytes, long length, int *previous_space)
+{
+    // Bytes 9 to 13 become -128 to -124 once 119 is added, nothing else does
+    const __m128i blank = _mm_set1_epi8(' ');
+    const __m128i shift = _mm_set1_epi8(119);
+    const __m128i bound = _mm_set1_epi8(-123);
+    unsigned long previous = (unsigned long)*previous_space;
+    long words = 0;
+    long i = 0;
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i *)(bytes + i));
+        __m128i space = _mm_or_si128(_mm_cmpeq_epi8(block, blank), _mm_cmplt_epi8(_mm_add_epi8(block, shift), bound));
+        unsigned long mask = (unsigned int)_mm_movemask_epi8(space);
+        words += WORD_STARTS(mask, previous, 16);
+        previous = mask >> 15;
+    }
+    *previous_space = (int)previous;
+    return words + wordCountScalar(bytes + i, length - i, previous_space);
+}
+
+__attribute__((target("avx2"))) static long wordCountAvx2(const unsigned char *bytes, long length, int *previous_space)
+{
+    const __m256i blank = _mm256_set1_epi8(' ');
+    const __m256i shift = _mm256_set1_epi8(119);
+    const __m256i bound = _mm256_set1_epi8(-123);
+    unsigned long previous = (unsigned long)*previous_space;
+    long words = 0;
+    long i = 0;
+    // Two blocks per step so one popcount covers 64 bytes
+    for (; i + 64 <= length; i += 64)
+    {
+        __m256i low = _mm256_loadu_si256((const __m256i *)(bytes + i));
+        __m256i high = _mm256_loadu_si256((const __m256i *)(bytes + i + 32));
+        __m256i low_space = _mm256_or_si256(_mm256_cmpeq_epi8(low, blank), _mm256_cmpgt_epi8(bound, _mm256_add_epi8(low, shift)));
+        __m256i high_space = _mm256_or_si256(_mm256_cmpeq_epi8(high, blank), _mm256_cmpgt_epi8(bound, _mm256_add_epi8(high, shift)));
+        unsigned long mask = (unsigned int)_mm256_movemask_epi8(low_space) | (unsigned long)(unsigned int)_mm256_movemask_epi8(high_space) << 32;
+        words += WORD_STARTS(mask, previous, 64);
+        previous = mask >> 63;
+    }
+    *previous_space = (int)previous;
+    return words + wordCountSse2(bytes + i, length - i, previous_space);
+}
+#endif
+
+/**
+ * @brief Counts the word starts of a block with the widest instructions the CPU has
+ *
+ * @param bytes
+ * @param length
+ * @param previous_space whether the byte before the block is white space, updated to the last byte
+ * @return long
+ */
+static long wordCountBlock(const unsigned char *bytes, long length, int *previous_space)
+{
+#ifdef WORD_COUNT_X86
+    static int avx2 = -1;
+    if (avx2 == -1)
+    {
+        __builtin_cpu_init();
+        avx2 = __builtin_cpu_supports("avx2") != 0;
+    }
+    return avx2 ? wordCountAvx2(bytes, length, previous_space) : wordCountSse2(bytes, length, previous_space);
+#else
+    return wordCountScalar(bytes, length, previous_space);
+#endif
+}
+
+/**
+ * @brief Counts the words of the bytes from start to end of an open file, mapping one window
+ * at a time
+ *
+ * @param fd
+ * @param start must be a multiple of the page size
+ * @param end
+ * @param previous_space whether the byte before start is white space, updated to the byte before end
+ * @return long the number of words starting in the range, -1 on error
+ */
+static long wordCountRange(int fd, long start, long end, int *previous_space)
+{
+    long words = 0;
+    for (long offset = start; offset < end; offset += WORD_COUNT_WINDOW)
+    {
+        long length = end - offset < WORD_COUNT_WINDOW ? end - offset : WORD_COUNT_WINDOW;
+        unsigned char *window = (unsigned char *)mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, offset);
+        if (window == MAP_FAILED)
+        {
+            return -1;
+        }
+        madvise(window, length, MADV_SEQUENTIAL);
+        words += wordCountBlock(window, length, previous_space);
+        munmap(window, length);
+    }
+    return words;
+}
+
+// Thread counting one chunk
+static void *wordCountChunk(void *arg)
+{
+    struct word_count_chunk *chunk = (struct word_count_chunk *)arg;
+    unsigned char first;
+    if (pread(chunk->fd, &first, 1, chunk->start) != 1)
+    {
+        chunk->words = -1;
+        return NULL;
+    }
+    chunk->starts_in_word = !wordCountIsSpace(first);
+
+    int previous_space = 1;
+    chunk->words = wordCountRange(chunk->fd, chunk->start, chunk->end, &previous_space);
+    chunk->ends_in_word = !previous_space;
+    return NULL;
+}
+
+/**
+ * @brief Counts the words of an open file on several threads and stitches the counts of the
+ * chunks together
+ *
+ * @param fd
+ * @param size
+ * @param threads
+ * @return long the number of words, -1 on error
+ */
+static long wordCountParallel(int fd, long size, int threads)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    long chunk_size = (size / threads + page - 1) / page * page;
+    struct word_count_chunk chunks[WORD_COUNT_THREADS];
+    pthread_t tids[WORD_COUNT_THREADS];
+    int started[WORD_COUNT_THREADS];
+
+    for (int i = 0; i < threads; i++)
+    {
+        chunks[i].fd = fd;
+        chunks[i].start = i * chunk_size < size ? i * chunk_size : size;
+        chunks[i].end = (i + 1) * chunk_size < size && i + 1 < threads ? (i + 1) * chunk_size : size;
+        chunks[i].words = 0;
+        chunks[i].starts_in_word = 0;
+        chunks[i].ends_in_word = 0;
+        if (chunks[i].start == chunks[i].end)
+        {
+            started[i] = 0;
+            continue;
+        }
+        // A thread that cannot be created leaves its chunk to this one
+        started[i] = pthread_create(&tids[i], NULL, wordCountChunk, &chunks[i]) == 0;
+        if (!started[i])
+        {
+            wordCountChunk(&chunks[i]);
+        }
+    }
+
+    long words = 0;
+    int error = 0;
+    for (int i = 0; i < threads; i++)
+    {
+        if (started[i])
+        {
+            pthread_join(tids[i], NULL);
+        }
+    }
+    for (int i = 0; i < threads; i++)
+    {
+        if (chunks[i].start == chunks[i].end)
+        {
+            continue;
+        }
+        if (chunks[i].words < 0)
+        {
+            error = 1;
+            continue;
+        }
+        words += chunks[i].words;
+        // A word across the boundary was counted by both chunks
+        if (i > 0 && chunks[i].starts_in_word && chunks[i - 1].ends_in_word)
+        {
+            words--;
+        }
+    }
+    return error ? -1 : words;
+}
+
+/**
+ * @brief Counts the words of a file like wc -w, on several threads when the file is large
+ *
+ * @param filename
+ * @return long the number of words, -1 when the file cannot be read
+ */
+__attribute__((unused)) static long countWords(const char *filename)
+{
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode))
+    {
+        close(fd);
+        return -1;
+    }
+
+    long words;
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    long threads = st.st_size / WORD_COUNT_CHUNK;
+    threads = threads < processors ? threads : processors;
+    threads = threads < WORD_COUNT_THREADS ? threads : WORD_COUNT_THREADS;
+    if (threads >= 2)
+    {
+        words = wordCountParallel(fd, st.st_size, (int)threads);
+    }
+    else
+    {
+        int previous_space = 1;
+        words = wordCountRange(fd, 0, st.st_size, &previous_space);
+    }
+    close(fd);
+    return words;
+}
+
+#endif
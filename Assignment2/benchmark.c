@@ -0,0 +1,813 @@
+/**
+ * @file benchmark.c
+ * @author Divyateja Pasupuleti
+ * @brief
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2023
+ * POSIX-compliant C program benchmark.c
+ *
+ * Load generator for the client / load balancer / server pipeline. It forks a number of
+ * clients which replay a mixed workload of operations 1, 2, 3 and 4 over a set of graphs
+ * through the real load balancer, primary and secondary servers, and reports throughput
+ * and p50/p90/p99/p999 latency per operation as text or JSON.
+ *
+ * The load balancer, primary server and both secondary servers must already be running
+ * (see 'make bench'), and no other client should be using the system at the same time.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/mman.h>
+#include <sys/msg.h>
+#include <sys/shm.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MESSAGE_LENGTH 100
+#define LOAD_BALANCER_CHANNEL 4000
+#define PRIMARY_SERVER_CHANNEL 4001
+#define SECONDARY_SERVER_CHANNEL_1 4002
+#define SECONDARY_SERVER_CHANNEL_2 4003
+#define NUMBER_OF_STAGES 8
+#define STAGE_CLIENT_SEND 0
+#define STAGE_LB_RECEIVE 1
+#define STAGE_LB_FORWARD 2
+#define STAGE_SERVER_DEQUEUE 3
+#define STAGE_LOCK_ACQUIRED 4
+#define STAGE_GRAPH_LOADED 5
+#define STAGE_TRAVERSAL_DONE 6
+#define STAGE_REPLY_SENT 7
+#define REPLY_DONE 0
+#define REPLY_BFS_LEVEL 6
+#define REPLY_ERROR 7
+#define PAYLOAD_DENSE 1
+#define PAYLOAD_EDGE_LIST 2
+#define CSR_MAGIC "GCSR"
+#define NUMBER_OF_OPERATIONS 4
+#define MAX_CLIENTS 255
+#define MAX_GRAPHS 64
+#define BENCH_PREFIX "bench_"
+#define SETUP_SEQ_NUM 255
+#define STAGE_REPLY_RECEIVED NUMBER_OF_STAGES
+
+struct data
+{
+    long seq_num;
+    long operation;
+    long level;
+    long count;
+    int result_shm_id;
+    char graph_name[MESSAGE_LENGTH];
+    long stage_ns[NUMBER_OF_STAGES];
+};
+
+struct msg_buffer
+{
+    long msg_type;
+    struct data data;
+};
+
+/*
+ * Header of a binary .csr graph file, followed by offsets[n + 1] as longs and
+ * neighbours[m] as ints
+ */
+struct csr_header
+{
+    char magic[4];
+    int version;
+    long number_of_nodes;
+    long number_of_edges;
+    long reserved;
+};
+
+/**
+ * A graph ready to be written through operation 1 or 2: the shared memory payload
+ * (format, n, then the cells or the edge list) and the name the benchmark writes it to.
+ */
+struct payload
+{
+    int *cells;
+    size_t length;
+    int number_of_nodes;
+    char graph_name[MESSAGE_LENGTH];
+};
+
+/**
+ * One completed request, written by the client processes into a shared array.
+ * Stage_ns holds the stage timestamps of the final reply, followed by the time it was received.
+ */
+struct sample
+{
+    int operation;
+    int ok;
+    long latency_ns;
+    long stage_ns[NUMBER_OF_STAGES + 1];
+};
+
+/**
+ * @brief Returns the current CLOCK_MONOTONIC time in nanoseconds
+ *
+ * @return long
+ */
+long nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/**
+ * @brief Reads a graph file in any of the formats the servers understand (dense matrix,
+ * 'E n m' edge list or binary .csr) and turns it into a write payload. Dense files are
+ * sent back as a matrix, the other two as an edge list.
+ *
+ * @param filename
+ * @param payload
+ * @return int 0 on success, -1 on error
+ */
+int loadPayload(const char *filename, struct payload *payload)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL)
+    {
+        return -1;
+    }
+
+    char magic[4] = {0};
+    if (fread(magic, 1, sizeof(magic), fp) == sizeof(magic) && memcmp(magic, CSR_MAGIC, sizeof(magic)) == 0)
+    {
+        struct csr_header header;
+        rewind(fp);
+        if (fread(&header, sizeof(header), 1, fp) != 1)
+        {
+            fclose(fp);
+            return -1;
+        }
+        long n = header.number_of_nodes;
+        long m = header.number_of_edges;
+        long *offsets = (long *)malloc((n + 1) * sizeof(long));
+        int *neighbours = (int *)malloc((m > 0 ? m : 1) * sizeof(int));
+        payload->length = 3 + 2 * (size_t)m;
+        payload->cells = (int *)malloc(payload->length * sizeof(int));
+        if (offsets == NULL || neighbours == NULL || payload->cells == NULL ||
+            fread(offsets, sizeof(long), n + 1, fp) != (size_t)(n + 1) ||
+            fread(neighbours, sizeof(int), m, fp) != (size_t)m)
+        {
+            free(offsets);
+            free(neighbours);
+            free(payload->cells);
+            fclose(fp);
+            return -1;
+        }
+        size_t index = 0;
+        payload->cells[index++] = PAYLOAD_EDGE_LIST;
+        payload->cells[index++] = (int)n;
+        payload->cells[index++] = (int)m;
+        for (long u = 0; u < n; u++)
+        {
+            for (long e = offsets[u]; e < offsets[u + 1]; e++)
+            {
+                payload->cells[index++] = (int)u + 1;
+                payload->cells[index++] = neighbours[e] + 1;
+            }
+        }
+        payload->number_of_nodes = (int)n;
+        free(offsets);
+        free(neighbours);
+        fclose(fp);
+        return 0;
+    }
+
+    rewind(fp);
+    char token[32];
+    if (fscanf(fp, "%31s", token) != 1)
+    {
+        fclose(fp);
+        return -1;
+    }
+
+    int n, m;
+    size_t index = 0;
+    if (strcmp(token, "E") == 0)
+    {
+        if (fscanf(fp, "%d %d", &n, &m) != 2)
+        {
+            fclose(fp);
+            return -1;
+        }
+        payload->length = 3 + 2 * (size_t)m;
+        payload->cells = (int *)malloc(payload->length * sizeof(int));
+        if (payload->cells == NULL)
+        {
+            fclose(fp);
+            return -1;
+        }
+        payload->cells[index++] = PAYLOAD_EDGE_LIST;
+        payload->cells[index++] = n;
+        payload->cells[index++] = m;
+    }
+    else
+    {
+        n = atoi(token);
+        payload->length = 2 + (size_t)n * n;
+        payload->cells = (int *)malloc(payload->length * sizeof(int));
+        if (payload->cells == NULL)
+        {
+            fclose(fp);
+            return -1;
+        }
+        payload->cells[index++] = PAYLOAD_DENSE;
+        payload->cells[index++] = n;
+    }
+
+    while (index < payload->length)
+    {
+        if (fscanf(fp, "%d", &payload->cells[index++]) != 1)
+        {
+            free(payload->cells);
+            fclose(fp);
+            return -1;
+        }
+    }
+    payload->number_of_nodes = n;
+    fclose(fp);
+    return 0;
+}
+
+/**
+ * @brief Creates the shared memory segment for a request the same way the client does,
+ * keyed by the sequence number, and copies the given ints into it.
+ *
+ * @param seq_num
+ * @param cells
+ * @param length
+ * @return int shm id
+ */
+int createRequestShm(int seq_num, const int *cells, size_t length)
+{
+    key_t shm_key;
+    int shm_id;
+    if ((shm_key = ftok(".", seq_num)) == -1)
+    {
+        perror("[Benchmark] Error while generating key for shared memory");
+        exit(EXIT_FAILURE);
+    }
+    if ((shm_id = shmget(shm_key, length * sizeof(int), 0666 | IPC_CREAT)) == -1)
+    {
+        perror("[Benchmark] Error occurred while connecting to shm");
+        exit(EXIT_FAILURE);
+    }
+    int *shmptr = (int *)shmat(shm_id, NULL, 0);
+    if (shmptr == (void *)-1)
+    {
+        perror("[Benchmark] Error while attaching to shared memory");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(shmptr, cells, length * sizeof(int));
+    if (shmdt(shmptr) == -1)
+    {
+        perror("[Benchmark] Could not detach from shared memory");
+    }
+    return shm_id;
+}
+
+/**
+ * @brief Waits for the next reply addressed to seq_num
+ *
+ * @param msg_queue_id
+ * @param seq_num
+ * @param message
+ * @return int 0 on success, -1 if the queue is gone
+ */
+int receiveReply(int msg_queue_id, int seq_num, struct msg_buffer *message)
+{
+    while (msgrcv(msg_queue_id, message, sizeof(message->data), seq_num, 0) == -1)
+    {
+        if (errno == EIDRM || errno == EINVAL)
+        {
+            return -1;
+        }
+        if (errno != EINTR)
+        {
+            perror("[Benchmark] Error while receiving a reply");
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Removes the result segment of a reply from the secondary server if it has one
+ *
+ * @param message
+ */
+void releaseResult(struct msg_buffer *message)
+{
+    if (message->data.result_shm_id != -1 && shmctl(message->data.result_shm_id, IPC_RMID, 0) == -1)
+    {
+        perror("[Benchmark] Error while deleting the result shared memory");
+    }
+}
+
+/**
+ * @brief Sends one request through the load balancer and waits for its last reply.
+ * Writes resend the graph's payload, traversals start from start_vertex (1-based).
+ *
+ * @param msg_queue_id
+ * @param seq_num
+ * @param operation
+ * @param payload
+ * @param start_vertex
+ * @param stage_ns if not NULL, receives the stage timestamps of the final reply and the time it arrived
+ * @return int 0 on success, -1 on error
+ */
+int runRequest(int msg_queue_id, int seq_num, int operation, const struct payload *payload, int start_vertex, long *stage_ns)
+{
+    int shm_id;
+    if (operation == 1 || operation == 2)
+    {
+        shm_id = createRequestShm(seq_num, payload->cells, payload->length);
+    }
+    else
+    {
+        int vertex = start_vertex - 1;
+        shm_id = createRequestShm(seq_num, &vertex, 1);
+    }
+
+    struct msg_buffer message;
+    memset(&message, 0, sizeof(message));
+    message.msg_type = LOAD_BALANCER_CHANNEL;
+    message.data.seq_num = seq_num;
+    message.data.operation = operation;
+    snprintf(message.data.graph_name, sizeof(message.data.graph_name), "%s", payload->graph_name);
+
+    int status = 0;
+    message.data.stage_ns[STAGE_CLIENT_SEND] = nowNs();
+    if (msgsnd(msg_queue_id, &message, sizeof(message.data), 0) == -1)
+    {
+        perror("[Benchmark] Message could not be sent");
+        status = -1;
+    }
+    else if (operation == 4)
+    {
+        // BFS streams one reply per level and finishes with REPLY_DONE
+        do
+        {
+            if (receiveReply(msg_queue_id, seq_num, &message) == -1)
+            {
+                status = -1;
+                break;
+            }
+            releaseResult(&message);
+        } while (message.data.operation != REPLY_DONE && message.data.operation != REPLY_ERROR);
+    }
+    else if (receiveReply(msg_queue_id, seq_num, &message) == -1)
+    {
+        status = -1;
+    }
+    else if (operation == 3)
+    {
+        releaseResult(&message);
+    }
+    // The secondary could not read the graph
+    if (status == 0 && message.data.operation == REPLY_ERROR)
+    {
+        fprintf(stderr, "[Benchmark] The graph %s could not be read\n", payload->graph_name);
+        status = -1;
+    }
+
+    if (status == 0 && stage_ns != NULL)
+    {
+        memcpy(stage_ns, message.data.stage_ns, sizeof(message.data.stage_ns));
+        stage_ns[STAGE_REPLY_RECEIVED] = nowNs();
+    }
+
+    if (shmctl(shm_id, IPC_RMID, 0) == -1)
+    {
+        perror("[Benchmark] Error while deleting the shared memory");
+    }
+    return status;
+}
+
+/**
+ * @brief Picks an operation from 1 to 4 with probability proportional to its weight
+ *
+ * @param weights
+ * @param total_weight
+ * @param seed
+ * @return int
+ */
+int pickOperation(const int *weights, int total_weight, unsigned int *seed)
+{
+    int r = rand_r(seed) % total_weight;
+    for (int i = 0; i < NUMBER_OF_OPERATIONS; i++)
+    {
+        if (r < weights[i])
+        {
+            return i + 1;
+        }
+        r -= weights[i];
+    }
+    return NUMBER_OF_OPERATIONS;
+}
+
+/**
+ * @brief Body of one client process. Client i uses sequence numbers congruent to i + 1
+ * modulo 256, which keeps the shared memory keys (ftok only uses the low 8 bits) of
+ * concurrent requests apart and keeps the reply channels below the server channels.
+ *
+ * @param client
+ * @param msg_queue_id
+ * @param payloads
+ * @param number_of_graphs
+ * @param weights
+ * @param requests
+ * @param seed
+ * @param samples
+ */
+void runClient(int client, int msg_queue_id, const struct payload *payloads, int number_of_graphs, const int *weights,
+               int requests, unsigned int seed, struct sample *samples)
+{
+    int total_weight = 0;
+    for (int i = 0; i < NUMBER_OF_OPERATIONS; i++)
+    {
+        total_weight += weights[i];
+    }
+    unsigned int state = seed + client * 7919;
+
+    for (int r = 0; r < requests; r++)
+    {
+        int seq_num = (client + 1) + 256 * (r % (LOAD_BALANCER_CHANNEL / 256));
+        int operation = pickOperation(weights, total_weight, &state);
+        const struct payload *payload = &payloads[rand_r(&state) % number_of_graphs];
+        int start_vertex = 1 + rand_r(&state) % (payload->number_of_nodes > 0 ? payload->number_of_nodes : 1);
+
+        long start = nowNs();
+        int status = runRequest(msg_queue_id, seq_num, operation, payload, start_vertex, samples[r].stage_ns);
+        samples[r].latency_ns = nowNs() - start;
+        samples[r].operation = operation;
+        samples[r].ok = (status == 0);
+        if (status == -1)
+        {
+            exit(EXIT_FAILURE);
+        }
+    }
+    exit(EXIT_SUCCESS);
+}
+
+/**
+ * @brief qsort comparator for latencies
+ */
+int compareLong(const void *a, const void *b)
+{
+    long x = *(const long *)a;
+    long y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Nearest-rank percentile of a sorted array, in microseconds
+ *
+ * @param sorted
+ * @param count
+ * @param p between 0 and 1
+ * @return double
+ */
+double percentileUs(const long *sorted, long count, double p)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+    long rank = (long)(p * count + 0.999999);
+    if (rank < 1)
+    {
+        rank = 1;
+    }
+    if (rank > count)
+    {
+        rank = count;
+    }
+    return sorted[rank - 1] / 1000.0;
+}
+
+/**
+ * @brief Prints throughput and latency percentiles for every operation and for all of them
+ *
+ * @param samples
+ * @param number_of_samples
+ * @param elapsed_ns
+ * @param json
+ * @param clients
+ * @param failed_clients
+ */
+void report(const struct sample *samples, long number_of_samples, long elapsed_ns, int json, int clients, int failed_clients)
+{
+    static const char *names[] = {"all", "add", "modify", "dfs", "bfs"};
+    long *latencies = (long *)malloc((number_of_samples > 0 ? number_of_samples : 1) * sizeof(long));
+    if (latencies == NULL)
+    {
+        perror("[Benchmark] Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    double seconds = elapsed_ns / 1e9;
+
+    if (json)
+    {
+        printf("{\"clients\": %d, \"failed_clients\": %d, \"elapsed_s\": %.6f, \"operations\": {", clients, failed_clients, seconds);
+    }
+    else
+    {
+        printf("[Benchmark] %d clients, %d failed, %.3f s\n", clients, failed_clients, seconds);
+        printf("%-8s %8s %10s %10s %10s %10s %10s %10s %10s\n", "op", "count", "ops/s", "mean_us", "p50_us", "p90_us", "p99_us", "p999_us", "max_us");
+    }
+
+    int first = 1;
+    for (int operation = 0; operation <= NUMBER_OF_OPERATIONS; operation++)
+    {
+        long count = 0;
+        double total = 0;
+        for (long i = 0; i < number_of_samples; i++)
+        {
+            if (samples[i].ok && (operation == 0 || samples[i].operation == operation))
+            {
+                latencies[count++] = samples[i].latency_ns;
+                total += samples[i].latency_ns;
+            }
+        }
+        if (count == 0 && operation != 0)
+        {
+            continue;
+        }
+        qsort(latencies, count, sizeof(long), compareLong);
+        double throughput = seconds > 0 ? count / seconds : 0;
+        double mean = count > 0 ? total / count / 1000.0 : 0;
+        double max = count > 0 ? latencies[count - 1] / 1000.0 : 0;
+
+        if (json)
+        {
+            printf("%s\"%s\": {\"count\": %ld, \"ops_per_s\": %.3f, \"mean_us\": %.1f, \"p50_us\": %.1f, \"p90_us\": %.1f, \"p99_us\": %.1f, \"p999_us\": %.1f, \"max_us\": %.1f}",
+                   first ? "" : ", ", names[operation], count, throughput, mean, percentileUs(latencies, count, 0.5), percentileUs(latencies, count, 0.9),
+                   percentileUs(latencies, count, 0.99), percentileUs(latencies, count, 0.999), max);
+        }
+        else
+        {
+            printf("%-8s %8ld %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", names[operation], count, throughput, mean,
+                   percentileUs(latencies, count, 0.5), percentileUs(latencies, count, 0.9), percentileUs(latencies, count, 0.99),
+                   percentileUs(latencies, count, 0.999), max);
+        }
+        first = 0;
+    }
+
+    // Time spent reaching every stage from the latest earlier stage the request went through
+    static const char *stage_names[] = {"client send", "lb receive", "lb forward", "server dequeue", "lock acquired",
+                                        "graph loaded", "traversal done", "reply sent", "reply received"};
+    if (json)
+    {
+        printf("}, \"stages\": {");
+    }
+    else
+    {
+        printf("%-15s %8s %10s %10s %10s %10s\n", "stage", "count", "mean_us", "p50_us", "p99_us", "max_us");
+    }
+    first = 1;
+    for (int stage = 1; stage <= STAGE_REPLY_RECEIVED; stage++)
+    {
+        long count = 0;
+        double total = 0;
+        for (long i = 0; i < number_of_samples; i++)
+        {
+            const long *stage_ns = samples[i].stage_ns;
+            if (!samples[i].ok || stage_ns[stage] == 0)
+            {
+                continue;
+            }
+            int previous = stage - 1;
+            while (previous >= 0 && stage_ns[previous] == 0)
+            {
+                previous--;
+            }
+            if (previous >= 0 && stage_ns[stage] >= stage_ns[previous])
+            {
+                latencies[count] = stage_ns[stage] - stage_ns[previous];
+                total += latencies[count++];
+            }
+        }
+        if (count == 0)
+        {
+            continue;
+        }
+        qsort(latencies, count, sizeof(long), compareLong);
+        double mean = total / count / 1000.0;
+        double max = latencies[count - 1] / 1000.0;
+
+        if (json)
+        {
+            printf("%s\"%s\": {\"count\": %ld, \"mean_us\": %.1f, \"p50_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f}", first ? "" : ", ",
+                   stage_names[stage], count, mean, percentileUs(latencies, count, 0.5), percentileUs(latencies, count, 0.99), max);
+        }
+        else
+        {
+            printf("%-15s %8ld %10.1f %10.1f %10.1f %10.1f\n", stage_names[stage], count, mean, percentileUs(latencies, count, 0.5),
+                   percentileUs(latencies, count, 0.99), max);
+        }
+        first = 0;
+    }
+
+    if (json)
+    {
+        printf("}}\n");
+    }
+    free(latencies);
+}
+
+/**
+ * @brief Prints the command line options
+ *
+ * @param program
+ */
+void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-c clients] [-n requests per client] [-g graph,graph,...] [-m add,modify,dfs,bfs weights] [-s seed] [-j]\n", program);
+    fprintf(stderr, "  defaults: -c 4 -n 100 -g G1.txt,G2.txt,G3.txt -m 1,1,4,4 -s 1\n");
+    fprintf(stderr, "  -j prints the report as JSON\n");
+}
+
+/**
+ * @brief Loads the graphs, copies each of them to a bench_ file through the servers,
+ * forks the clients, waits for them and prints the report. The bench_ files are
+ * removed at the end so the original graphs are never rewritten.
+ *
+ * @return int
+ */
+int main(int argc, char *argv[])
+{
+    int clients = 4;
+    int requests = 100;
+    int weights[NUMBER_OF_OPERATIONS] = {1, 1, 4, 4};
+    unsigned int seed = 1;
+    int json = 0;
+    char graph_list[1024] = "G1.txt,G2.txt,G3.txt";
+
+    int option;
+    while ((option = getopt(argc, argv, "c:n:g:m:s:jh")) != -1)
+    {
+        switch (option)
+        {
+        case 'c':
+            clients = atoi(optarg);
+            break;
+        case 'n':
+            requests = atoi(optarg);
+            break;
+        case 'g':
+            snprintf(graph_list, sizeof(graph_list), "%s", optarg);
+            break;
+        case 'm':
+            if (sscanf(optarg, "%d,%d,%d,%d", &weights[0], &weights[1], &weights[2], &weights[3]) != NUMBER_OF_OPERATIONS)
+            {
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 's':
+            seed = (unsigned int)strtoul(optarg, NULL, 10);
+            break;
+        case 'j':
+            json = 1;
+            break;
+        default:
+            usage(argv[0]);
+            exit(option == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+
+    int total_weight = 0;
+    for (int i = 0; i < NUMBER_OF_OPERATIONS; i++)
+    {
+        if (weights[i] < 0)
+        {
+            total_weight = 0;
+            break;
+        }
+        total_weight += weights[i];
+    }
+    // The setup request uses sequence number 255, so at most 254 clients
+    if (clients < 1 || clients >= MAX_CLIENTS || requests < 1 || total_weight == 0)
+    {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    key_t key;
+    int msg_queue_id;
+    if ((key = ftok(".", 'B')) == -1)
+    {
+        perror("[Benchmark] Error while generating key of the file");
+        exit(EXIT_FAILURE);
+    }
+    if ((msg_queue_id = msgget(key, 0644)) == -1)
+    {
+        perror("[Benchmark] Error while connecting with Message Queue, is the load balancer running");
+        exit(EXIT_FAILURE);
+    }
+
+    // Load every graph and copy it to its bench_ file through the primary server
+    struct payload payloads[MAX_GRAPHS];
+    int number_of_graphs = 0;
+    for (char *name = strtok(graph_list, ","); name != NULL && number_of_graphs < MAX_GRAPHS; name = strtok(NULL, ","))
+    {
+        struct payload *payload = &payloads[number_of_graphs];
+        if (loadPayload(name, payload) == -1)
+        {
+            fprintf(stderr, "[Benchmark] Could not read the graph %s\n", name);
+            exit(EXIT_FAILURE);
+        }
+        snprintf(payload->graph_name, sizeof(payload->graph_name), "%s%s", BENCH_PREFIX, name);
+        if (runRequest(msg_queue_id, SETUP_SEQ_NUM, 1, payload, 1, NULL) == -1)
+        {
+            fprintf(stderr, "[Benchmark] Could not write the graph %s\n", payload->graph_name);
+            exit(EXIT_FAILURE);
+        }
+        number_of_graphs++;
+    }
+    if (number_of_graphs == 0)
+    {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    // Samples live in a shared mapping so that every client can fill in its own slice
+    long number_of_samples = (long)clients * requests;
+    struct sample *samples = (struct sample *)mmap(NULL, number_of_samples * sizeof(struct sample), PROT_READ | PROT_WRITE,
+                                                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (samples == MAP_FAILED)
+    {
+        perror("[Benchmark] Error while mapping the samples");
+        exit(EXIT_FAILURE);
+    }
+
+    // Clients block on the start pipe until every one of them has been forked
+    int start_pipe[2];
+    if (pipe(start_pipe) == -1)
+    {
+        perror("[Benchmark] Error in pipe creation");
+        exit(EXIT_FAILURE);
+    }
+
+    fflush(stdout);
+    for (int i = 0; i < clients; i++)
+    {
+        pid_t pid = fork();
+        if (pid == -1)
+        {
+            perror("[Benchmark] Error while creating client process");
+            exit(EXIT_FAILURE);
+        }
+        if (pid == 0)
+        {
+            char go;
+            close(start_pipe[1]);
+            if (read(start_pipe[0], &go, 1) == -1)
+            {
+                perror("[Benchmark] Error while waiting for the start");
+            }
+            close(start_pipe[0]);
+            runClient(i, msg_queue_id, payloads, number_of_graphs, weights, requests, seed, samples + (long)i * requests);
+        }
+    }
+
+    close(start_pipe[0]);
+    long start = nowNs();
+    close(start_pipe[1]);
+
+    int failed_clients = 0;
+    int wstatus;
+    while (wait(&wstatus) > 0)
+    {
+        if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != EXIT_SUCCESS)
+        {
+            failed_clients++;
+        }
+    }
+    long elapsed = nowNs() - start;
+
+    report(samples, number_of_samples, elapsed, json, clients, failed_clients);
+
+    for (int i = 0; i < number_of_graphs; i++)
+    {
+        unlink(payloads[i].graph_name);
+        free(payloads[i].cells);
+    }
+    munmap(samples, number_of_samples * sizeof(struct sample));
+    return failed_clients == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -28,13 +28,26 @@
 #define PRIMARY_SERVER_CHANNEL 4001
 #define SECONDARY_SERVER_CHANNEL_1 4002
 #define SECONDARY_SERVER_CHANNEL_2 4003
+#define NUMBER_OF_STAGES 8
+#define STAGE_CLIENT_SEND 0
+#define STAGE_LB_RECEIVE 1
+#define STAGE_LB_FORWARD 2
+#define STAGE_SERVER_DEQUEUE 3
+#define STAGE_LOCK_ACQUIRED 4
+#define STAGE_GRAPH_LOADED 5
+#define STAGE_TRAVERSAL_DONE 6
+#define STAGE_REPLY_SENT 7
 #define MAX_THREADS 200
 
 struct data
 {
     long seq_num;
     long operation;
+    long level;
+    long count;
+    int result_shm_id;
     char graph_name[MESSAGE_LENGTH];
+    long stage_ns[NUMBER_OF_STAGES];
 };
 
 struct msg_buffer
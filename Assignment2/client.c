@@ -23,19 +23,38 @@
 #include <fcntl.h>
 #include <semaphore.h>
 #include <errno.h>
+#include <time.h>
 
 #define MESSAGE_LENGTH 100
 #define LOAD_BALANCER_CHANNEL 4000
 #define PRIMARY_SERVER_CHANNEL 4001
 #define SECONDARY_SERVER_CHANNEL_1 4002
 #define SECONDARY_SERVER_CHANNEL_2 4003
+#define NUMBER_OF_STAGES 8
+#define STAGE_CLIENT_SEND 0
+#define STAGE_LB_RECEIVE 1
+#define STAGE_LB_FORWARD 2
+#define STAGE_SERVER_DEQUEUE 3
+#define STAGE_LOCK_ACQUIRED 4
+#define STAGE_GRAPH_LOADED 5
+#define STAGE_TRAVERSAL_DONE 6
+#define STAGE_REPLY_SENT 7
 #define MAX_THREADS 200
+#define REPLY_DONE 0
+#define REPLY_BFS_LEVEL 6
+#define REPLY_ERROR 7
+#define PAYLOAD_DENSE 1
+#define PAYLOAD_EDGE_LIST 2
 
 struct data
 {
     long seq_num;
     long operation;
+    long level;
+    long count;
+    int result_shm_id;
     char graph_name[MESSAGE_LENGTH];
+    long stage_ns[NUMBER_OF_STAGES];
 };
 
 struct msg_buffer
@@ -44,6 +63,62 @@ struct msg_buffer
     struct data data;
 };
 
+/**
+ * @brief Clears the stage timestamps left in the message by an earlier reply and stamps the
+ * time the request is sent, the load balancer and the servers stamp the following stages.
+ *
+ * @param data
+ */
+void stampClientSend(struct data *data)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    memset(data->stage_ns, 0, sizeof(data->stage_ns));
+    data->stage_ns[STAGE_CLIENT_SEND] = ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/**
+ * @brief Returns the vertices carried by a reply from the secondary server in a new array.
+ * Short lists are stored in the message itself, longer ones in the shared memory segment
+ * named by the reply, which is removed once it has been read.
+ *
+ * @param message
+ * @return int* to be freed by the caller
+ */
+int *receiveVertices(struct msg_buffer *message)
+{
+    long count = message->data.count;
+    int *vertices = (int *)malloc((count > 0 ? count : 1) * sizeof(int));
+    if (vertices == NULL)
+    {
+        perror("[Client] Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+
+    if (message->data.result_shm_id == -1)
+    {
+        memcpy(vertices, message->data.graph_name, count * sizeof(int));
+        return vertices;
+    }
+
+    int *shmptr = (int *)shmat(message->data.result_shm_id, NULL, SHM_RDONLY);
+    if (shmptr == (void *)-1)
+    {
+        perror("[Client] Error while attaching to the result shared memory");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(vertices, shmptr, count * sizeof(int));
+    if (shmdt(shmptr) == -1)
+    {
+        perror("[Client] Could not detach from the result shared memory");
+    }
+    if (shmctl(message->data.result_shm_id, IPC_RMID, 0) == -1)
+    {
+        perror("[Client] Error while deleting the result shared memory");
+    }
+    return vertices;
+}
+
 /**
  * @brief
  *
@@ -58,15 +133,22 @@ void operation_one(int msg_queue_id, int seq_num, struct msg_buffer message)
     printf("Enter Number of Nodes: ");
     scanf("%d", &number_of_nodes);
 
-    // Input adjacency matrix
-    int adjacency_matrix[number_of_nodes][number_of_nodes];
-    printf("Enter adjacency matrix, each row on a separate line and elements of a single row separated by whitespace characters: \n");
-    for (int i = 0; i < number_of_nodes; i++)
+    // Sparse graphs can be sent as an edge list instead of all n*n cells
+    int payload_format;
+    printf("Enter %d to type the adjacency matrix or %d to type an edge list: ", PAYLOAD_DENSE, PAYLOAD_EDGE_LIST);
+    scanf("%d", &payload_format);
+    int number_of_edges = 0;
+    size_t payload_size;
+    if (payload_format == PAYLOAD_EDGE_LIST)
     {
-        for (int j = 0; j < number_of_nodes; j++)
-        {
-            scanf("%d", &adjacency_matrix[i][j]);
-        }
+        printf("Enter Number of Edges: ");
+        scanf("%d", &number_of_edges);
+        payload_size = (3 + 2 * (size_t)number_of_edges) * sizeof(int);
+    }
+    else
+    {
+        payload_format = PAYLOAD_DENSE;
+        payload_size = (2 + (size_t)number_of_nodes * number_of_nodes) * sizeof(int);
     }
 
     // Connect to shared memory
@@ -82,7 +164,7 @@ void operation_one(int msg_queue_id, int seq_num, struct msg_buffer message)
     }
     printf("[Client] Generated shared memory key %d\n", shm_key);
     // Connect to the shared memory using the key
-    if ((shm_id = shmget(shm_key, sizeof(adjacency_matrix) + sizeof(number_of_nodes), 0666 | IPC_CREAT)) == -1)
+    if ((shm_id = shmget(shm_key, payload_size, 0666 | IPC_CREAT)) == -1)
     {
         perror("[Client] Error occurred while connecting to shm\n");
         exit(EXIT_FAILURE);
@@ -95,14 +177,38 @@ void operation_one(int msg_queue_id, int seq_num, struct msg_buffer message)
         exit(EXIT_FAILURE);
     }
 
+    // Store data in shared memory
+    // Layout: format, number of nodes, then either the n*n cells or the number of edges and the (u, v) pairs
     int shmptr_index = 0;
-    // Store data in shared memory using array traversals
+    shmptr[shmptr_index++] = payload_format;
     shmptr[shmptr_index++] = number_of_nodes;
-    for (int i = 0; i < number_of_nodes; i++)
+    if (payload_format == PAYLOAD_EDGE_LIST)
     {
-        for (int j = 0; j < number_of_nodes; j++)
+        shmptr[shmptr_index++] = number_of_edges;
+        printf("Enter the edges, one per line as two vertex numbers u v (enter both directions for an undirected edge): \n");
+        for (int i = 0; i < number_of_edges; i++)
         {
-            shmptr[shmptr_index++] = adjacency_matrix[i][j];
+            int u, v;
+            scanf("%d %d", &u, &v);
+            if (u < 1 || u > number_of_nodes || v < 1 || v > number_of_nodes)
+            {
+                printf("Invalid edge, vertices must be between 1 and %d. Please enter it again: \n", number_of_nodes);
+                i--;
+                continue;
+            }
+            shmptr[shmptr_index++] = u;
+            shmptr[shmptr_index++] = v;
+        }
+    }
+    else
+    {
+        printf("Enter adjacency matrix, each row on a separate line and elements of a single row separated by whitespace characters: \n");
+        for (int i = 0; i < number_of_nodes; i++)
+        {
+            for (int j = 0; j < number_of_nodes; j++)
+            {
+                scanf("%d", &shmptr[shmptr_index++]);
+            }
         }
     }
 
@@ -112,6 +218,7 @@ void operation_one(int msg_queue_id, int seq_num, struct msg_buffer message)
     message.data.seq_num = seq_num;
 
     // Send the message to the load balancer
+    stampClientSend(&message.data);
     if (msgsnd(msg_queue_id, &message, sizeof(message.data), 0) == -1)
     {
         perror("[Client] Message could not be sent, please try again");
@@ -190,6 +297,7 @@ void operation_three(int msg_queue_id, int seq_num, struct msg_buffer message)
     message.data.seq_num = seq_num;
 
     // Send the message to the load balancer
+    stampClientSend(&message.data);
     if (msgsnd(msg_queue_id, &message, sizeof(message.data), 0) == -1)
     {
         perror("[Client] Message could not be sent, please try again");
@@ -206,15 +314,22 @@ void operation_three(int msg_queue_id, int seq_num, struct msg_buffer message)
             }
             perror("[Client] Error while receiving message from secondary server");
         }
-        printf("[Client] Message received from the secondary Server: %ld\nThe list of Leaf Nodes while travelling from %d is: \n", message.msg_type, starting_vertex);
-        int i = 0;
-
-        while (message.data.graph_name[i] != '*')
+        if (message.data.operation == REPLY_ERROR)
+        {
+            printf("[Client] Operation failed: the graph could not be read\n");
+        }
+        else
         {
-            printf("%d ", message.data.graph_name[i]);
-            i++;
+            printf("[Client] Message received from the secondary Server: %ld\nThe list of Leaf Nodes while travelling from %d is: \n", message.msg_type,
+                   starting_vertex);
+            int *leaves = receiveVertices(&message);
+            for (long i = 0; i < message.data.count; i++)
+            {
+                printf("%d ", leaves[i]);
+            }
+            free(leaves);
+            printf("\n[Client] Operation done successfully\n");
         }
-        printf("\n[Client] Operation done successfully\n");
     }
 
     // Detach shared memory and delete it
@@ -280,6 +395,7 @@ void operation_four(int msg_queue_id, int seq_num, struct msg_buffer message)
     message.data.seq_num = seq_num;
 
     // Send the message to the load balancer
+    stampClientSend(&message.data);
     if (msgsnd(msg_queue_id, &message, sizeof(message.data), 0) == -1)
     {
         perror("[Client] Message could not be sent, please try again");
@@ -287,24 +403,45 @@ void operation_four(int msg_queue_id, int seq_num, struct msg_buffer message)
     }
     else
     {
-        while (msgrcv(msg_queue_id, &message, sizeof(message.data), seq_num, 0) == -1)
+        printf("[Client] BFS levels while travelling from %d:\n", starting_vertex);
+
+        // The secondary server streams one chunk per completed level and
+        // finishes with a REPLY_DONE message, so print levels as they arrive
+        while (1)
         {
-            if (errno == EIDRM)
+            while (msgrcv(msg_queue_id, &message, sizeof(message.data), seq_num, 0) == -1)
             {
-                printf("[Client] Message queue removed. Exiting...");
-                exit(EXIT_FAILURE);
+                if (errno == EIDRM)
+                {
+                    printf("[Client] Message queue removed. Exiting...");
+                    exit(EXIT_FAILURE);
+                }
+                perror("[Client] Error while receiving message from secondary server");
+            }
+
+            if (message.data.operation == REPLY_DONE || message.data.operation == REPLY_ERROR)
+            {
+                break;
             }
-            perror("[Client] Error while receiving message from secondary server");
-        }
-        printf("[Client] Message received from the secondary Server: %ld -> %s using %ld\n", message.msg_type, message.data.graph_name, message.data.operation);
-        int i = 0;
 
-        while (message.data.graph_name[i] != '*')
+            printf("Level %ld --> ", message.data.level);
+            int *vertices = receiveVertices(&message);
+            for (long i = 0; i < message.data.count; i++)
+            {
+                printf("%d ", vertices[i]);
+            }
+            free(vertices);
+            printf("\n");
+            fflush(stdout);
+        }
+        if (message.data.operation == REPLY_ERROR)
         {
-            printf("%d ", message.data.graph_name[i]);
-            i++;
+            printf("[Client] Operation failed: the graph could not be read\n");
+        }
+        else
+        {
+            printf("[Client] Operation done successfully\n");
         }
-        printf("\n[Client] Operation done successfully");
     }
 
     // Detach shared memory and delete it
@@ -330,6 +467,9 @@ void operation_four(int msg_queue_id, int seq_num, struct msg_buffer message)
  */
 int main()
 {
+    // Line buffered even when stdout is a pipe, so a script driving the client sees every reply as it is printed
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
     // Initialize the client
     printf("[Client] Initializing Client...\n");
 
@@ -0,0 +1,577 @@
+/**
+ * @file graph_generator.c
+ * @author Divyateja Pasupuleti
+ * @brief
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2023
+ * POSIX-compliant C program graph_generator.c
+ *
+ * Generates synthetic graphs for the benchmarks: R-MAT (power-law degrees), grids, long
+ * chains, stars and uniform random graphs of any size, density and seed. The graph is
+ * written in any of the formats the servers read: the dense adjacency matrix of the
+ * G*.txt files, the 'E n m' edge list or the binary .csr file that is traversed in place.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CSR_MAGIC "GCSR"
+#define CSR_SUFFIX ".csr"
+#define MAX_DENSE_NODES 30000
+#define RMAT_A 0.57
+#define RMAT_B 0.19
+#define RMAT_C 0.19
+#define MAX_RMAT_ATTEMPTS 64
+
+/*
+ * Header of a binary graph file, followed by the n + 1 offsets and the m neighbours
+ * in compressed sparse row form
+ */
+struct csr_header
+{
+    char magic[4];
+    int version;
+    long number_of_nodes;
+    long number_of_edges;
+    long reserved;
+};
+
+/**
+ * Edges are collected as (source, target) arcs, 0-based, before being turned into
+ * compressed sparse row form. Undirected edges are stored as two arcs.
+ */
+struct arc_list
+{
+    int *sources;
+    int *targets;
+    long count;
+    long capacity;
+    int directed;
+};
+
+/*
+ * Graph in compressed sparse row form: the neighbours of vertex v are
+ * neighbours[offsets[v]] to neighbours[offsets[v + 1] - 1]
+ */
+struct graph
+{
+    int number_of_nodes;
+    long number_of_edges;
+    long *offsets;
+    int *neighbours;
+};
+
+/**
+ * @brief xorshift64* generator, so that a seed gives the same graph on every platform
+ *
+ * @param state
+ * @return unsigned long
+ */
+unsigned long nextRandom(unsigned long *state)
+{
+    unsigned long x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DUL;
+}
+
+/**
+ * @brief Uniform double in [0, 1)
+ *
+ * @param state
+ * @return double
+ */
+double nextUniform(unsigned long *state)
+{
+    return (nextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/**
+ * @brief Adds the edge u -> v, and v -> u for undirected graphs. Self loops are dropped.
+ *
+ * @param arcs
+ * @param u
+ * @param v
+ */
+void addEdge(struct arc_list *arcs, int u, int v)
+{
+    if (u == v)
+    {
+        return;
+    }
+    if (arcs->count + 2 > arcs->capacity)
+    {
+        long capacity = arcs->capacity > 0 ? arcs->capacity * 2 : 1024;
+        int *sources = (int *)realloc(arcs->sources, capacity * sizeof(int));
+        if (sources == NULL)
+        {
+            perror("[Graph Generator] Memory allocation failed");
+            exit(EXIT_FAILURE);
+        }
+        arcs->sources = sources;
+        int *targets = (int *)realloc(arcs->targets, capacity * sizeof(int));
+        if (targets == NULL)
+        {
+            perror("[Graph Generator] Memory allocation failed");
+            exit(EXIT_FAILURE);
+        }
+        arcs->targets = targets;
+        arcs->capacity = capacity;
+    }
+    arcs->sources[arcs->count] = u;
+    arcs->targets[arcs->count++] = v;
+    if (!arcs->directed)
+    {
+        arcs->sources[arcs->count] = v;
+        arcs->targets[arcs->count++] = u;
+    }
+}
+
+/**
+ * @brief R-MAT graph: each edge picks a quadrant of the adjacency matrix recursively
+ * with probabilities a, b, c and 1 - a - b - c, which gives a power-law degree
+ * distribution. Vertices are relabelled with a random permutation so that the high
+ * degree vertices are not all at the start.
+ *
+ * @param arcs
+ * @param n
+ * @param edges
+ * @param state
+ */
+void generateRmat(struct arc_list *arcs, int n, long edges, unsigned long *state)
+{
+    int scale = 0;
+    while ((1L << scale) < n)
+    {
+        scale++;
+    }
+
+    int *permutation = (int *)malloc((long)n * sizeof(int));
+    if (permutation == NULL)
+    {
+        perror("[Graph Generator] Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < n; i++)
+    {
+        permutation[i] = i;
+    }
+    for (int i = n - 1; i > 0; i--)
+    {
+        int j = (int)(nextRandom(state) % (unsigned long)(i + 1));
+        int t = permutation[i];
+        permutation[i] = permutation[j];
+        permutation[j] = t;
+    }
+
+    for (long e = 0; e < edges; e++)
+    {
+        // Edges that fall outside the n x n corner of the 2^scale matrix are drawn again
+        for (int attempt = 0; attempt < MAX_RMAT_ATTEMPTS; attempt++)
+        {
+            long u = 0, v = 0;
+            for (int level = 0; level < scale; level++)
+            {
+                double r = nextUniform(state);
+                // Top left quadrant with probability a, top right b, bottom left c, bottom right d
+                int right = 0, down = 0;
+                if (r >= RMAT_A + RMAT_B + RMAT_C)
+                {
+                    right = 1;
+                    down = 1;
+                }
+                else if (r >= RMAT_A + RMAT_B)
+                {
+                    down = 1;
+                }
+                else if (r >= RMAT_A)
+                {
+                    right = 1;
+                }
+                u = (u << 1) | down;
+                v = (v << 1) | right;
+            }
+            if (u < n && v < n)
+            {
+                addEdge(arcs, permutation[u], permutation[v]);
+                break;
+            }
+        }
+    }
+    free(permutation);
+}
+
+/**
+ * @brief Uniform random graph with the given number of edges, G(n, m)
+ *
+ * @param arcs
+ * @param n
+ * @param edges
+ * @param state
+ */
+void generateRandom(struct arc_list *arcs, int n, long edges, unsigned long *state)
+{
+    for (long e = 0; e < edges; e++)
+    {
+        int u = (int)(nextRandom(state) % (unsigned long)n);
+        int v = (int)(nextRandom(state) % (unsigned long)n);
+        addEdge(arcs, u, v);
+    }
+}
+
+/**
+ * @brief Grid with ceil(sqrt(n)) columns, each vertex joined to its right and lower neighbour
+ *
+ * @param arcs
+ * @param n
+ */
+void generateGrid(struct arc_list *arcs, int n)
+{
+    int columns = 1;
+    while ((long)columns * columns < n)
+    {
+        columns++;
+    }
+    for (int v = 0; v < n; v++)
+    {
+        if ((v + 1) % columns != 0 && v + 1 < n)
+        {
+            addEdge(arcs, v, v + 1);
+        }
+        if ((long)v + columns < n)
+        {
+            addEdge(arcs, v, v + columns);
+        }
+    }
+}
+
+/**
+ * @brief Chain 1 - 2 - ... - n, the deepest possible DFS and the most BFS levels
+ *
+ * @param arcs
+ * @param n
+ */
+void generateChain(struct arc_list *arcs, int n)
+{
+    for (int v = 0; v + 1 < n; v++)
+    {
+        addEdge(arcs, v, v + 1);
+    }
+}
+
+/**
+ * @brief Star with vertex 1 at the centre, the widest possible BFS level
+ *
+ * @param arcs
+ * @param n
+ */
+void generateStar(struct arc_list *arcs, int n)
+{
+    for (int v = 1; v < n; v++)
+    {
+        addEdge(arcs, 0, v);
+    }
+}
+
+/**
+ * @brief qsort comparator for neighbours
+ */
+int compareInt(const void *a, const void *b)
+{
+    int x = *(const int *)a;
+    int y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Turns the arcs into compressed sparse row form with every row sorted and
+ * without repeated edges. The arc list is freed.
+ *
+ * @param arcs
+ * @param n
+ * @return struct graph
+ */
+struct graph buildGraph(struct arc_list *arcs, int n)
+{
+    struct graph graph;
+    graph.number_of_nodes = n;
+    graph.offsets = (long *)calloc((long)n + 1, sizeof(long));
+    graph.neighbours = (int *)malloc((arcs->count > 0 ? arcs->count : 1) * sizeof(int));
+    long *next = (long *)malloc(((long)n + 1) * sizeof(long));
+    if (graph.offsets == NULL || graph.neighbours == NULL || next == NULL)
+    {
+        perror("[Graph Generator] Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+
+    for (long i = 0; i < arcs->count; i++)
+    {
+        graph.offsets[arcs->sources[i] + 1]++;
+    }
+    for (int v = 0; v < n; v++)
+    {
+        graph.offsets[v + 1] += graph.offsets[v];
+    }
+    memcpy(next, graph.offsets, ((long)n + 1) * sizeof(long));
+    for (long i = 0; i < arcs->count; i++)
+    {
+        graph.neighbours[next[arcs->sources[i]]++] = arcs->targets[i];
+    }
+    free(arcs->sources);
+    free(arcs->targets);
+    arcs->sources = NULL;
+    arcs->targets = NULL;
+    arcs->count = 0;
+
+    // Sort every row and drop repeated edges, compacting the rows towards the front
+    long write = 0;
+    for (int v = 0; v < n; v++)
+    {
+        long begin = graph.offsets[v];
+        long end = next[v];
+        qsort(graph.neighbours + begin, end - begin, sizeof(int), compareInt);
+        graph.offsets[v] = write;
+        for (long i = begin; i < end; i++)
+        {
+            if (i == begin || graph.neighbours[i] != graph.neighbours[i - 1])
+            {
+                graph.neighbours[write++] = graph.neighbours[i];
+            }
+        }
+    }
+    graph.offsets[n] = write;
+    graph.number_of_edges = write;
+    free(next);
+    return graph;
+}
+
+/**
+ * @brief Writes the graph as the dense adjacency matrix used by the G*.txt files
+ *
+ * @param fp
+ * @param graph
+ * @return int -1 on error
+ */
+int writeDense(FILE *fp, const struct graph *graph)
+{
+    int n = graph->number_of_nodes;
+    char *row = (char *)malloc(2 * (size_t)n + 1);
+    if (row == NULL)
+    {
+        return -1;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        row[2 * i] = '0';
+        row[2 * i + 1] = ' ';
+    }
+    row[2 * n] = '\n';
+
+    fprintf(fp, "%d\n", n);
+    for (int v = 0; v < n; v++)
+    {
+        for (long e = graph->offsets[v]; e < graph->offsets[v + 1]; e++)
+        {
+            row[2 * graph->neighbours[e]] = '1';
+        }
+        fwrite(row, 1, 2 * (size_t)n + 1, fp);
+        for (long e = graph->offsets[v]; e < graph->offsets[v + 1]; e++)
+        {
+            row[2 * graph->neighbours[e]] = '0';
+        }
+    }
+    free(row);
+    return ferror(fp) ? -1 : 0;
+}
+
+/**
+ * @brief Writes the graph as an 'E n m' edge list, one 1-based 'u v' arc per line
+ *
+ * @param fp
+ * @param graph
+ * @return int -1 on error
+ */
+int writeEdgeList(FILE *fp, const struct graph *graph)
+{
+    fprintf(fp, "E %d %ld\n", graph->number_of_nodes, graph->number_of_edges);
+    for (int v = 0; v < graph->number_of_nodes; v++)
+    {
+        for (long e = graph->offsets[v]; e < graph->offsets[v + 1]; e++)
+        {
+            fprintf(fp, "%d %d\n", v + 1, graph->neighbours[e] + 1);
+        }
+    }
+    return ferror(fp) ? -1 : 0;
+}
+
+/**
+ * @brief Writes the graph as a binary .csr file, the same layout the primary server writes
+ *
+ * @param fp
+ * @param graph
+ * @return int -1 on error
+ */
+int writeCsr(FILE *fp, const struct graph *graph)
+{
+    struct csr_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CSR_MAGIC, 4);
+    header.version = 1;
+    header.number_of_nodes = graph->number_of_nodes;
+    header.number_of_edges = graph->number_of_edges;
+
+    if (fwrite(&header, sizeof(header), 1, fp) != 1 ||
+        fwrite(graph->offsets, sizeof(long), (size_t)graph->number_of_nodes + 1, fp) != (size_t)graph->number_of_nodes + 1 ||
+        (graph->number_of_edges > 0 && fwrite(graph->neighbours, sizeof(int), graph->number_of_edges, fp) != (size_t)graph->number_of_edges))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Prints the command line options
+ *
+ * @param program
+ */
+void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s -t rmat|random|grid|chain|star -n nodes [-d average degree] [-s seed] [-f dense|edges|csr] [-o file] [-D]\n", program);
+    fprintf(stderr, "  -d is used by rmat and random (default 8), the other shapes have a fixed degree\n");
+    fprintf(stderr, "  -f defaults to csr for files ending in .csr and to dense otherwise\n");
+    fprintf(stderr, "  -D generates a directed graph, otherwise every edge is written in both directions\n");
+    fprintf(stderr, "  the graph goes to standard output when no file is given\n");
+}
+
+/**
+ * @brief Parses the options, generates the graph and writes it out
+ *
+ * @return int
+ */
+int main(int argc, char *argv[])
+{
+    const char *type = NULL;
+    const char *format = NULL;
+    const char *output = NULL;
+    long number_of_nodes = 0;
+    double degree = 8;
+    unsigned long seed = 1;
+    int directed = 0;
+
+    int option;
+    while ((option = getopt(argc, argv, "t:n:d:s:f:o:Dh")) != -1)
+    {
+        switch (option)
+        {
+        case 't':
+            type = optarg;
+            break;
+        case 'n':
+            number_of_nodes = atol(optarg);
+            break;
+        case 'd':
+            degree = atof(optarg);
+            break;
+        case 's':
+            seed = strtoul(optarg, NULL, 10);
+            break;
+        case 'f':
+            format = optarg;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'D':
+            directed = 1;
+            break;
+        default:
+            usage(argv[0]);
+            exit(option == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+
+    if (type == NULL || number_of_nodes < 1 || number_of_nodes > 2147483647L || degree < 0)
+    {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (format == NULL)
+    {
+        size_t length = output != NULL ? strlen(output) : 0;
+        size_t suffix_length = strlen(CSR_SUFFIX);
+        format = (length > suffix_length && strcmp(output + length - suffix_length, CSR_SUFFIX) == 0) ? "csr" : "dense";
+    }
+    if (strcmp(format, "dense") != 0 && strcmp(format, "edges") != 0 && strcmp(format, "csr") != 0)
+    {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (strcmp(format, "dense") == 0 && number_of_nodes > MAX_DENSE_NODES)
+    {
+        fprintf(stderr, "[Graph Generator] A dense matrix of %ld nodes is too large, use -f edges or -f csr\n", number_of_nodes);
+        exit(EXIT_FAILURE);
+    }
+
+    int n = (int)number_of_nodes;
+    // An undirected edge gives degree 1 to both of its ends
+    long edges = (long)(n * degree / (directed ? 1 : 2));
+    // A zero seed would keep xorshift at zero forever
+    unsigned long state = seed * 0x9E3779B97F4A7C15UL + 1;
+    struct arc_list arcs = {NULL, NULL, 0, 0, directed};
+
+    if (strcmp(type, "rmat") == 0)
+        generateRmat(&arcs, n, edges, &state);
+    else if (strcmp(type, "random") == 0)
+        generateRandom(&arcs, n, edges, &state);
+    else if (strcmp(type, "grid") == 0)
+        generateGrid(&arcs, n);
+    else if (strcmp(type, "chain") == 0)
+        generateChain(&arcs, n);
+    else if (strcmp(type, "star") == 0)
+        generateStar(&arcs, n);
+    else
+    {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    struct graph graph = buildGraph(&arcs, n);
+
+    FILE *fp = stdout;
+    if (output != NULL && (fp = fopen(output, "wb")) == NULL)
+    {
+        perror("[Graph Generator] Error while opening the output file");
+        exit(EXIT_FAILURE);
+    }
+    setvbuf(fp, NULL, _IOFBF, 1 << 20);
+
+    int result;
+    if (strcmp(format, "dense") == 0)
+        result = writeDense(fp, &graph);
+    else if (strcmp(format, "edges") == 0)
+        result = writeEdgeList(fp, &graph);
+    else
+        result = writeCsr(fp, &graph);
+
+    if (result == -1 || fflush(fp) == EOF || (fp != stdout && fclose(fp) == EOF))
+    {
+        perror("[Graph Generator] Error while writing the graph");
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(stderr, "[Graph Generator] Wrote a %s graph with %d nodes and %ld arcs as %s to %s\n", type, n, graph.number_of_edges, format,
+            output != NULL ? output : "standard output");
+    free(graph.offsets);
+    free(graph.neighbours);
+    return 0;
+}
@@ -0,0 +1,181 @@
+/**
+ * @file graphstat.c
+ * @author Divyateja Pasupuleti
+ * @brief
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2023
+ * POSIX-compliant C program graphstat.c
+ *
+ * Shows the counters and gauges that the load balancer, the primary server and the secondary
+ * servers publish in the stats region, refreshed every interval the way top does.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#include "stats.h"
+
+/**
+ * @brief Prints one refresh of the table. Completed requests per second are measured
+ * against the previous refresh.
+ *
+ * @param region
+ * @param previous_completed
+ * @param elapsed_ns time since the previous refresh, 0 for the first one
+ */
+void printStats(const struct stats_region *region, long *previous_completed, long elapsed_ns)
+{
+    static const char *names[STATS_SLOTS] = {"load balancer", "primary", "secondary 1", "secondary 2"};
+    long now = nowNs();
+
+    printf("%-14s %7s %8s %7s %7s %7s %7s %9s %8s %8s %8s %12s %9s %9s %13s\n", "PROCESS", "PID", "UP(s)", "ADD", "MODIFY", "DFS", "BFS",
+           "DONE", "DONE/s", "INFLIGHT", "THREADS", "LOCKWAIT(us)", "COALESCED", "QUEUE", "BYTES/LIMIT");
+
+    for (int slot = 0; slot < STATS_SLOTS; slot++)
+    {
+        const struct process_stats *stats = &region->slots[slot];
+        long pid = __atomic_load_n(&stats->pid, __ATOMIC_ACQUIRE);
+        if (pid == 0 || (kill((pid_t)pid, 0) == -1 && errno == ESRCH))
+        {
+            printf("%-14s %7s   not running\n", names[slot], "-");
+            previous_completed[slot] = 0;
+            continue;
+        }
+
+        long completed = __atomic_load_n(&stats->completed, __ATOMIC_RELAXED);
+        long lock_waits = __atomic_load_n(&stats->lock_waits, __ATOMIC_RELAXED);
+        long lock_wait_ns = __atomic_load_n(&stats->lock_wait_ns, __ATOMIC_RELAXED);
+        double rate = elapsed_ns > 0 ? (completed - previous_completed[slot]) * 1e9 / elapsed_ns : 0;
+        previous_completed[slot] = completed;
+
+        printf("%-14s %7ld %8.0f %7ld %7ld %7ld %7ld %9ld %8.1f %8ld %8ld", names[slot], pid, (now - stats->started_ns) / 1e9,
+               __atomic_load_n(&stats->requests[1], __ATOMIC_RELAXED), __atomic_load_n(&stats->requests[2], __ATOMIC_RELAXED),
+               __atomic_load_n(&stats->requests[3], __ATOMIC_RELAXED), __atomic_load_n(&stats->requests[4], __ATOMIC_RELAXED), completed, rate,
+               __atomic_load_n(&stats->in_flight, __ATOMIC_RELAXED), __atomic_load_n(&stats->active_threads, __ATOMIC_RELAXED));
+
+        if (lock_waits > 0)
+            printf(" %12.1f", lock_wait_ns / 1000.0 / lock_waits);
+        else
+            printf(" %12s", "-");
+
+        // Only the primary writes
+        if (slot == STATS_SLOT_PRIMARY)
+            printf(" %9ld", __atomic_load_n(&stats->coalesced_writes, __ATOMIC_RELAXED));
+        else
+            printf(" %9s", "-");
+
+        // Only the load balancer samples the message queue
+        if (slot == STATS_SLOT_LOAD_BALANCER)
+            printf(" %9ld %6ld/%-6ld\n", __atomic_load_n(&stats->queue_messages, __ATOMIC_RELAXED),
+                   __atomic_load_n(&stats->queue_bytes, __ATOMIC_RELAXED), __atomic_load_n(&stats->queue_capacity, __ATOMIC_RELAXED));
+        else
+            printf(" %9s %13s\n", "-", "-");
+    }
+}
+
+/**
+ * @brief Prints the command line options
+ *
+ * @param program
+ */
+void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-i seconds] [-n refreshes] [-b]\n", program);
+    fprintf(stderr, "  -i refresh interval (default 1), -n stops after that many refreshes (default 0, forever)\n");
+    fprintf(stderr, "  -b batch mode: print one table after another instead of redrawing the screen\n");
+}
+
+/**
+ * @brief Maps the stats region read-only and redraws the table every interval
+ *
+ * @return int
+ */
+int main(int argc, char *argv[])
+{
+    double interval = 1;
+    long refreshes = 0;
+    int batch = 0;
+
+    int option;
+    while ((option = getopt(argc, argv, "i:n:bh")) != -1)
+    {
+        switch (option)
+        {
+        case 'i':
+            interval = atof(optarg);
+            break;
+        case 'n':
+            refreshes = atol(optarg);
+            break;
+        case 'b':
+            batch = 1;
+            break;
+        default:
+            usage(argv[0]);
+            exit(option == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    if (interval <= 0 || refreshes < 0)
+    {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    int fd = shm_open(STATS_SHM_NAME, O_RDONLY, 0);
+    if (fd == -1)
+    {
+        perror("[Graphstat] Error while opening the stats region, is the load balancer running");
+        exit(EXIT_FAILURE);
+    }
+    struct stats_region *region = (struct stats_region *)mmap(NULL, sizeof(struct stats_region), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED)
+    {
+        perror("[Graphstat] Error while mapping the stats region");
+        exit(EXIT_FAILURE);
+    }
+
+    long previous_completed[STATS_SLOTS] = {0};
+    long previous_refresh = 0;
+    struct timespec pause;
+    pause.tv_sec = (time_t)interval;
+    pause.tv_nsec = (long)((interval - (double)pause.tv_sec) * 1e9);
+
+    for (long refresh = 0; refreshes == 0 || refresh < refreshes; refresh++)
+    {
+        long now = nowNs();
+        if (!batch)
+        {
+            // Move the cursor home and clear the screen, like top
+            printf("\033[H\033[2J");
+        }
+        time_t wall = time(NULL);
+        char timestamp[32];
+        strftime(timestamp, sizeof(timestamp), "%H:%M:%S", localtime(&wall));
+        printf("graphstat - %s, every %.1f s\n", timestamp, interval);
+        printStats(region, previous_completed, previous_refresh ? now - previous_refresh : 0);
+        printf("\n");
+        fflush(stdout);
+        previous_refresh = now;
+
+        if (refreshes == 0 || refresh + 1 < refreshes)
+        {
+            nanosleep(&pause, NULL);
+        }
+    }
+
+    munmap(region, sizeof(struct stats_region));
+    return 0;
+}
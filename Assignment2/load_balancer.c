@@ -20,8 +20,16 @@
 #include <sys/shm.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <semaphore.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include "logger.h"
+#include "trace.h"
+#include "stats.h"
 
 #define MESSAGE_LENGTH 100
 #define LOAD_BALANCER_CHANNEL 4000
@@ -34,7 +42,11 @@ struct data
 {
     long seq_num;
     long operation;
+    long level;
+    long count;
+    int result_shm_id;
     char graph_name[MESSAGE_LENGTH];
+    long stage_ns[NUMBER_OF_STAGES];
 };
 
 struct msg_buffer
@@ -43,13 +55,33 @@ struct msg_buffer
     struct data data;
 };
 
+// Removes the rw_, read_ and count_ semaphores of a graph and the record of its writer, which need not exist
+void unlinkGraphSemaphores(const char *filename)
+{
+    static const char *prefixes[] = {"rw_", "read_", "count_"};
+    char sema_name[256];
+    for (int i = 0; i < 3; i++)
+    {
+        snprintf(sema_name, sizeof(sema_name), "%s%s", prefixes[i], filename);
+        if (sem_unlink(sema_name) == -1 && errno != ENOENT)
+        {
+            perror("[Load Balancer] Error while removing a semaphore");
+        }
+    }
+    snprintf(sema_name, sizeof(sema_name), "/rw_owner_%s", filename);
+    if (shm_unlink(sema_name) == -1 && errno != ENOENT)
+    {
+        perror("[Load Balancer] Error while removing the writer record of a graph");
+    }
+}
+
 /**
  * @brief Cleanup
  *
  */
 void cleanup(int msg_queue_id)
 {
-    printf("[Load Balancer] Initiating cleanup process...\n");
+    LOG_INFO("[Load Balancer] Initiating cleanup process...\n");
 
     // Inform servers about termination
     struct msg_buffer terminationMessage;
@@ -74,7 +106,7 @@ void cleanup(int msg_queue_id)
         perror("[Load Balancer] Error while sending cleanup message to Secondary Server 2");
     }
 
-    printf("[Load Balancer] Cleanup message sent to all servers\n");
+    LOG_INFO("[Load Balancer] Cleanup message sent to all servers\n");
     // Sleep for a while to allow servers to perform cleanup
     sleep(5);
 
@@ -83,36 +115,36 @@ void cleanup(int msg_queue_id)
     {
         perror("[Load Balancer] Error while destroying the message queue");
     }
-    printf("[Load Balancer] Message queue destroyed\n");
+    LOG_INFO("[Load Balancer] Message queue destroyed\n");
 
-    // Destroy all mutexes
-    // Choose an appropriate size for your filename
-    char filename[250];
-    for (int i = 0; i <= 20; i++)
+    // Remove the semaphores of every graph the servers have touched since the start, found by
+    // their rw_ semaphore, which glibc keeps as /dev/shm/sem.rw_<graph>
+    int graphCount = 0;
+    DIR *shm_dir = opendir("/dev/shm");
+    if (shm_dir == NULL)
     {
-        // Make sure the filename is null-terminated, and copy it to the 'filename' array
-        snprintf(filename, sizeof(filename), "G%d.txt", i);
-
-        // SEMAPHORE PART
-        char sema_name_rw[256];
-        snprintf(sema_name_rw, sizeof(sema_name_rw), "rw_%s", filename);
-        char sema_name_read[256];
-        snprintf(sema_name_read, sizeof(sema_name_read), "read_%s", filename);
-
-        // If O_CREAT is specified, and a semaphore with the given name already exists,
-        // then mode and value are ignored.
-        sem_t *rw_sem = sem_open(sema_name_rw, O_CREAT, 0644, 1);
-        sem_t *read_sem = sem_open(sema_name_read, O_CREAT, 0644, 1);
-        sem_t *read_count = sem_open("Assignment_Read_Count", O_CREAT, 0644, 200);
-
-        // Destroy the semaphores
-        sem_close(rw_sem);
-        sem_close(read_sem);
-        sem_close(read_count);
+        perror("[Load Balancer] Error while listing the semaphores");
     }
-    printf("[Load Balancer] Semaphores destroyed\n");
+    else
+    {
+        struct dirent *entry;
+        while ((entry = readdir(shm_dir)) != NULL)
+        {
+            if (strncmp(entry->d_name, "sem.rw_", 7) == 0)
+            {
+                unlinkGraphSemaphores(entry->d_name + 7);
+                graphCount++;
+            }
+        }
+        closedir(shm_dir);
+    }
+    LOG_INFO("[Load Balancer] Semaphores of %d graphs destroyed\n", graphCount);
+
+    // The stats region goes away with the message queue
+    STATS_SET(pid, 0);
+    shm_unlink(STATS_SHM_NAME);
 
-    printf("[Load Balancer] Cleanup process completed. Exiting.\n");
+    LOG_INFO("[Load Balancer] Cleanup process completed. Exiting.\n");
     exit(EXIT_SUCCESS);
 }
 
@@ -127,7 +159,8 @@ void cleanup(int msg_queue_id)
 int main()
 {
     // Iniitalize the server
-    printf("[Load Balancer] Initializing Load Balancer...\n");
+    logInit();
+    LOG_INFO("[Load Balancer] Initializing Load Balancer...\n");
 
     // Create the message queue
     key_t key;
@@ -148,7 +181,10 @@ int main()
         exit(EXIT_FAILURE);
     }
 
-    printf("[Load Balancer] Successfully connected to the Message Queue with Key:%d ID:%d\n", key, msg_queue_id);
+    LOG_INFO("[Load Balancer] Successfully connected to the Message Queue with Key:%d ID:%d\n", key, msg_queue_id);
+
+    processStats = openStats(STATS_SLOT_LOAD_BALANCER, "[Load Balancer]");
+    traceInit("load balancer");
 
     // Listen to the message queue for new requests from the clients
     while (1)
@@ -160,8 +196,13 @@ int main()
         }
         else
         {
+            msg.data.stage_ns[STAGE_LB_RECEIVE] = nowNs();
+            if (msg.data.operation >= 1 && msg.data.operation <= MAX_OPERATION)
+            {
+                STATS_ADD(requests[msg.data.operation], 1);
+            }
             // Print the message received
-            printf("[Load Balancer] Message received from the client: %ld -> %s using Op %ld\n", msg.data.seq_num, msg.data.graph_name, msg.data.operation);
+            LOG_INFO("[Load Balancer] Message received from the client: %ld -> %s using Op %ld\n", msg.data.seq_num, msg.data.graph_name, msg.data.operation);
             // Check if it's cleanup
             if (msg.data.operation == 5)
             {
@@ -171,13 +212,15 @@ int main()
             {
                 // Primary server
                 msg.msg_type = PRIMARY_SERVER_CHANNEL;
+                // Stamped once the server is chosen, right before the message is handed to it
+                msg.data.stage_ns[STAGE_LB_FORWARD] = nowNs();
                 if (msgsnd(msg_queue_id, &msg, sizeof(msg.data), 0) == -1)
                 {
                     perror("[Load Balancer] Error while sending message to Primary Server");
                 }
                 else
                 {
-                    printf("[Load Balancer] Received a message from Client and Sent it to Primary Server\n");
+                    LOG_DEBUG("[Load Balancer] Received a message from Client and Sent it to Primary Server\n");
                 }
             }
             else if (msg.data.operation == 3 || msg.data.operation == 4)
@@ -187,17 +230,19 @@ int main()
                 {
                     // Secondary Server 2
                     msg.msg_type = SECONDARY_SERVER_CHANNEL_2;
+                    msg.data.stage_ns[STAGE_LB_FORWARD] = nowNs();
                     if (msgsnd(msg_queue_id, &msg, sizeof(msg.data), 0) == -1)
                     {
                         perror("[Load Balancer] Error while sending message to Secondary Server 2");
                     }
                     else
-                        printf("[Load Balancer] Received a message from Client and Sent it to Secondary Server\n");
+                        LOG_DEBUG("[Load Balancer] Received a message from Client and Sent it to Secondary Server\n");
                 }
                 else
                 {
                     // Secondary Server 1
                     msg.msg_type = SECONDARY_SERVER_CHANNEL_1;
+                    msg.data.stage_ns[STAGE_LB_FORWARD] = nowNs();
                     if (msgsnd(msg_queue_id, &msg, sizeof(msg.data), 0) == -1)
                     {
                         perror("[Load Balancer] Error while sending message to Secondary Server 1");
@@ -206,7 +251,24 @@ int main()
             }
             else
             {
-                printf("[Load Balancer] Invalid Operation\n");
+                LOG_WARN("[Load Balancer] Invalid Operation\n");
+            }
+
+            // The client's send time identifies the request, it starts the arrow to the server
+            if (TRACE_ON)
+            {
+                traceSpan("route", msg.data.stage_ns[STAGE_LB_RECEIVE], nowNs(), "seq", msg.data.seq_num, "operation", msg.data.operation);
+                traceFlow('s', msg.data.stage_ns[STAGE_CLIENT_SEND], msg.data.stage_ns[STAGE_LB_RECEIVE]);
+            }
+
+            // Publish the queue depth as it is after forwarding this message
+            STATS_ADD(completed, 1);
+            struct msqid_ds queue_stats;
+            if (msgctl(msg_queue_id, IPC_STAT, &queue_stats) == 0)
+            {
+                STATS_SET(queue_messages, (long)queue_stats.msg_qnum);
+                STATS_SET(queue_bytes, (long)queue_stats.msg_cbytes);
+                STATS_SET(queue_capacity, (long)queue_stats.msg_qbytes);
             }
         }
     }
@@ -0,0 +1,318 @@
+/**
+ * @file logger.h
+ * @author Divyateja Pasupuleti
+ * @brief
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2023
+ * POSIX-compliant C header logger.h
+ *
+ * Asynchronous logger for the load balancer, the primary server and the secondary servers.
+ * A thread that logs formats the message into a ring buffer of its own, taken from a fixed
+ * pool, and goes on. No lock is taken and no I/O is done on the calling thread. A flusher
+ * thread collects the rings every LOG_FLUSH_INTERVAL_NS, puts the messages back in the order
+ * they were logged and writes them to stdout in one go.
+ *
+ * The level is read from the GRAPH_LOG_LEVEL environment variable (error, warn, info or debug,
+ * info by default). A message below the level costs one comparison, its arguments are not
+ * evaluated. Levels above LOG_COMPILED_LEVEL are removed at compile time.
+ *
+ * When the ring of a thread is full the message is dropped and counted, the flusher reports
+ * how many were lost. Before logInit, after logShutdown, or when every ring is taken, messages
+ * are written synchronously like printf.
+ *
+ */
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_WARN 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_DEBUG 3
+#ifndef LOG_COMPILED_LEVEL
+#define LOG_COMPILED_LEVEL LOG_LEVEL_DEBUG
+#endif
+#define LOG_LEVEL_ENV "GRAPH_LOG_LEVEL"
+#define LOG_RINGS 128
+#define LOG_RING_RECORDS 512
+#define LOG_RECORD_LENGTH 240
+#define LOG_FLUSH_INTERVAL_NS 2000000
+#define LOG_RING_FREE 0
+#define LOG_RING_OWNED 1
+#define LOG_RING_RELEASED 2
+
+#define LOG_AT(level, ...)                                       \
+    do                                                           \
+    {                                                            \
+        if ((level) <= LOG_COMPILED_LEVEL && (level) <= logLevel) \
+            logWrite(__VA_ARGS__);                               \
+    } while (0)
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+/**
+ * One formatted message. Sequence orders the messages of all threads.
+ */
+struct log_record
+{
+    long sequence;
+    int length;
+    char text[LOG_RECORD_LENGTH];
+};
+
+/**
+ * Single producer, single consumer ring. Only the owning thread moves head and only the
+ * flusher moves tail. A ring is owned by one thread at a time, released when that thread
+ * exits and freed for another thread once the flusher has emptied it.
+ */
+struct log_ring
+{
+    unsigned long head;
+    unsigned long tail;
+    int state;
+    long dropped;
+    struct log_record *records;
+};
+
+struct log_entry
+{
+    long sequence;
+    struct log_record *record;
+};
+
+struct logger
+{
+    int running;
+    int stopping;
+    long sequence;
+    pthread_t flusher;
+    pthread_key_t ring_key;
+    pthread_mutex_t drain_lock;
+    struct log_ring rings[LOG_RINGS];
+    struct log_entry *entries;
+};
+
+static int logLevel = LOG_LEVEL_INFO;
+static struct logger logger;
+static __thread struct log_ring *threadRing = NULL;
+
+// Called when a thread that owns a ring exits
+static void logReleaseRing(void *arg)
+{
+    struct log_ring *ring = (struct log_ring *)arg;
+    __atomic_store_n(&ring->state, LOG_RING_RELEASED, __ATOMIC_RELEASE);
+}
+
+// Returns the ring of the calling thread, taking a free one from the pool the first time
+static struct log_ring *logRing()
+{
+    if (threadRing != NULL)
+    {
+        return threadRing;
+    }
+    for (int i = 0; i < LOG_RINGS; i++)
+    {
+        struct log_ring *ring = &logger.rings[i];
+        int expected = LOG_RING_FREE;
+        if (__atomic_load_n(&ring->state, __ATOMIC_RELAXED) == LOG_RING_FREE &&
+            __atomic_compare_exchange_n(&ring->state, &expected, LOG_RING_OWNED, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            if (ring->records == NULL && (ring->records = (struct log_record *)malloc(LOG_RING_RECORDS * sizeof(struct log_record))) == NULL)
+            {
+                __atomic_store_n(&ring->state, LOG_RING_FREE, __ATOMIC_RELEASE);
+                return NULL;
+            }
+            pthread_setspecific(logger.ring_key, ring);
+            threadRing = ring;
+            return ring;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Logs a printf style message. Use the LOG_* macros, which skip disabled levels
+ * without evaluating the arguments.
+ *
+ * @param format
+ * @param ...
+ */
+__attribute__((format(printf, 1, 2))) static void logWrite(const char *format, ...)
+{
+    va_list args;
+    struct log_ring *ring = __atomic_load_n(&logger.running, __ATOMIC_ACQUIRE) ? logRing() : NULL;
+    if (ring == NULL)
+    {
+        va_start(args, format);
+        vprintf(format, args);
+        va_end(args);
+        return;
+    }
+
+    unsigned long head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == LOG_RING_RECORDS)
+    {
+        __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    struct log_record *record = &ring->records[head % LOG_RING_RECORDS];
+    va_start(args, format);
+    int length = vsnprintf(record->text, LOG_RECORD_LENGTH, format, args);
+    va_end(args);
+    if (length < 0)
+    {
+        return;
+    }
+    if (length >= LOG_RECORD_LENGTH)
+    {
+        // Truncated messages still end the line
+        length = LOG_RECORD_LENGTH - 1;
+        record->text[length - 1] = '\n';
+    }
+    record->length = length;
+    record->sequence = __atomic_fetch_add(&logger.sequence, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static int compareLogEntries(const void *a, const void *b)
+{
+    long x = ((const struct log_entry *)a)->sequence;
+    long y = ((const struct log_entry *)b)->sequence;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Writes out everything the rings hold, oldest message first, and frees the rings of
+ * threads that have exited
+ */
+static void logFlush()
+{
+    pthread_mutex_lock(&logger.drain_lock);
+
+    unsigned long heads[LOG_RINGS];
+    int states[LOG_RINGS];
+    long count = 0;
+    long dropped = 0;
+    for (int i = 0; i < LOG_RINGS; i++)
+    {
+        struct log_ring *ring = &logger.rings[i];
+        // The state is read first, a released ring gets no more messages after it
+        states[i] = __atomic_load_n(&ring->state, __ATOMIC_ACQUIRE);
+        if (states[i] == LOG_RING_FREE)
+        {
+            continue;
+        }
+        heads[i] = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        for (unsigned long position = ring->tail; position != heads[i]; position++)
+        {
+            struct log_record *record = &ring->records[position % LOG_RING_RECORDS];
+            logger.entries[count].sequence = record->sequence;
+            logger.entries[count].record = record;
+            count++;
+        }
+        dropped += __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+    }
+
+    qsort(logger.entries, count, sizeof(struct log_entry), compareLogEntries);
+    for (long i = 0; i < count; i++)
+    {
+        fwrite(logger.entries[i].record->text, 1, logger.entries[i].record->length, stdout);
+    }
+    if (dropped > 0)
+    {
+        printf("[Logger] Dropped %ld messages, a log ring was full\n", dropped);
+    }
+    if (count > 0 || dropped > 0)
+    {
+        fflush(stdout);
+    }
+
+    for (int i = 0; i < LOG_RINGS; i++)
+    {
+        struct log_ring *ring = &logger.rings[i];
+        if (states[i] == LOG_RING_FREE)
+        {
+            continue;
+        }
+        __atomic_store_n(&ring->tail, heads[i], __ATOMIC_RELEASE);
+        if (states[i] == LOG_RING_RELEASED)
+        {
+            __atomic_store_n(&ring->state, LOG_RING_FREE, __ATOMIC_RELEASE);
+        }
+    }
+
+    pthread_mutex_unlock(&logger.drain_lock);
+}
+
+static void *logFlusher(void *arg)
+{
+    (void)arg;
+    struct timespec pause = {0, LOG_FLUSH_INTERVAL_NS};
+    while (!__atomic_load_n(&logger.stopping, __ATOMIC_ACQUIRE))
+    {
+        logFlush();
+        nanosleep(&pause, NULL);
+    }
+    logFlush();
+    return NULL;
+}
+
+/**
+ * @brief Stops the flusher after it has written out every ring. Registered with atexit by
+ * logInit, later messages are written synchronously.
+ */
+static void logShutdown()
+{
+    if (!__atomic_exchange_n(&logger.running, 0, __ATOMIC_ACQ_REL))
+    {
+        return;
+    }
+    __atomic_store_n(&logger.stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(logger.flusher, NULL);
+    fflush(stdout);
+}
+
+/**
+ * @brief Reads the level from GRAPH_LOG_LEVEL and starts the flusher thread
+ */
+__attribute__((unused)) static void logInit()
+{
+    static const char *names[] = {"error", "warn", "info", "debug"};
+    const char *level = getenv(LOG_LEVEL_ENV);
+    for (int i = 0; level != NULL && i <= LOG_LEVEL_DEBUG; i++)
+    {
+        if (strcasecmp(level, names[i]) == 0)
+        {
+            logLevel = i;
+        }
+    }
+
+    logger.entries = (struct log_entry *)malloc((long)LOG_RINGS * LOG_RING_RECORDS * sizeof(struct log_entry));
+    if (logger.entries == NULL || pthread_key_create(&logger.ring_key, logReleaseRing) != 0 || pthread_mutex_init(&logger.drain_lock, NULL) != 0)
+    {
+        perror("[Logger] Error while setting up the logger");
+        exit(EXIT_FAILURE);
+    }
+    if (pthread_create(&logger.flusher, NULL, logFlusher, NULL) != 0)
+    {
+        perror("[Logger] Error while creating the flusher thread");
+        exit(EXIT_FAILURE);
+    }
+    __atomic_store_n(&logger.running, 1, __ATOMIC_RELEASE);
+    atexit(logShutdown);
+}
+
+#endif
@@ -22,8 +22,18 @@
 #include <sys/shm.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <semaphore.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "logger.h"
+#include "trace.h"
+#include "stats.h"
 
 #define MESSAGE_LENGTH 100
 #define LOAD_BALANCER_CHANNEL 4000
@@ -31,12 +41,27 @@
 #define SECONDARY_SERVER_CHANNEL_1 4002
 #define SECONDARY_SERVER_CHANNEL_2 4003
 #define MAX_THREADS 200
+#define PAYLOAD_DENSE 1
+#define PAYLOAD_EDGE_LIST 2
+#define CSR_MAGIC "GCSR"
+#define CSR_SUFFIX ".csr"
+#define SERIALIZER_BUFFERS 4
+#define SERIALIZER_BUFFER_SIZE (256 * 1024)
+#define SERIALIZER_MAX_NUMBER 12
+#define WAL_SEGMENT_PREFIX "graph_database.wal."
+#define WAL_MAGIC "GWAL"
+#define WAL_SEGMENT_BYTES (64L << 20)
+#define RW_OWNER_PREFIX "/rw_owner_"
 
 struct data
 {
     long seq_num;
     long operation;
+    long level;
+    long count;
+    int result_shm_id;
     char graph_name[MESSAGE_LENGTH];
+    long stage_ns[NUMBER_OF_STAGES];
 };
 
 struct msg_buffer
@@ -49,10 +74,1203 @@ struct data_to_thread
 {
     int msg_queue_id;
     struct msg_buffer msg;
+    long ticket;
+    struct pending_graph *pending;
 };
 
+/*
+ * Writes to one graph that have been dequeued and not finished yet. Tickets number the writes
+ * in the order they were dequeued. Newest is the ticket of the last write dequeued for the
+ * graph and logged the ticket of the newest write that is in the write-ahead log, so a write
+ * whose ticket is below newest would be overwritten right away and is never stored. Stored is
+ * the ticket of the newest write that reached the graph file.
+ */
+struct pending_graph
+{
+    char graph_name[MESSAGE_LENGTH];
+    long newest;
+    long logged;
+    long stored;
+    int writers;
+    pthread_cond_t changed;
+    struct pending_graph *next;
+};
+
+/*
+ * Header of a write in the write-ahead log, followed by the payload_bytes bytes of the shared
+ * memory payload and padding up to a multiple of 8 bytes. The checksum covers the payload, so
+ * a record torn by a crash ends the log.
+ */
+struct wal_record
+{
+    char magic[4];
+    int version;
+    long ticket;
+    long payload_bytes;
+    unsigned long checksum;
+    char graph_name[MESSAGE_LENGTH];
+};
+
+/*
+ * One file of the write-ahead log, WAL_SEGMENT_PREFIX followed by its id. End is where the next
+ * record goes and pending counts the records whose graph file has not been written yet.
+ */
+struct wal_segment
+{
+    long id;
+    int fd;
+    long end;
+    long pending;
+    struct wal_segment *next;
+};
+
+/*
+ * The write-ahead log. Records are appended to the active segment, which is replaced by a new
+ * one once it holds WAL_SEGMENT_BYTES. Replaced segments are retired, oldest first, and deleted
+ * in that order once their records and those of every older segment are applied, so the log
+ * stays around two segments however long writes keep coming. Writes to a graph are appended in
+ * ticket order, so the newest record of a graph is always in the last segment that holds it.
+ * Position counts the bytes appended to all segments and synced how many of them are known to
+ * be on disk. One appender at a time syncs for everyone that appended before it started.
+ */
+struct write_ahead_log
+{
+    pthread_mutex_t lock;
+    pthread_mutex_t drop_lock;
+    pthread_cond_t synced_changed;
+    struct wal_segment *active;
+    struct wal_segment *retired;
+    long position;
+    long synced;
+    int syncing;
+    long appends;
+    long syncs;
+    long segments;
+};
+
+static struct write_ahead_log wal = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL, 0, 0, 0, 0, 0, 0};
+
+static pthread_mutex_t pendingLock = PTHREAD_MUTEX_INITIALIZER;
+static struct pending_graph *pendingGraphs = NULL;
+
+/*
+ * Header of a binary graph file, followed by the n + 1 offsets and the m neighbours
+ * in compressed sparse row form (neighbours of v are neighbours[offsets[v]] to neighbours[offsets[v + 1] - 1]).
+ * The secondary servers map these files and traverse them in place.
+ */
+struct csr_header
+{
+    char magic[4];
+    int version;
+    long number_of_nodes;
+    long number_of_edges;
+    long reserved;
+};
+
+// For writes the graph loaded stage is the moment the graph is in the write-ahead log
+static const char *stageNames[NUMBER_OF_STAGES] = {"client send", "lb receive", "lb forward", "server dequeue",
+                                                   "lock acquired", "graph logged", "traversal done", "reply sent"};
+
+// Graph names ending in .csr are stored as binary graph files
+int isCsrGraphName(const char *filename)
+{
+    size_t length = strlen(filename);
+    size_t suffix_length = strlen(CSR_SUFFIX);
+    return length > suffix_length && strcmp(filename + length - suffix_length, CSR_SUFFIX) == 0;
+}
+
+// Writes all of buffer to fd, returns -1 on error
+int writeAll(int fd, const void *buffer, size_t size)
+{
+    const char *p = (const char *)buffer;
+    while (size > 0)
+    {
+        ssize_t written = write(fd, p, size);
+        if (written == -1)
+        {
+            return -1;
+        }
+        p += written;
+        size -= written;
+    }
+    return 0;
+}
+
 /**
- * @brief This function is executed by the thread which is responsible for writing to the new graph file
+ * @brief Writes the graph in the shared memory payload (format, n, then the cells or m and the pairs)
+ * to path as a binary graph file. Returns -1 on error.
+ *
+ * @param path
+ * @param payload
+ * @return int
+ */
+int writeCsrGraphFile(const char *path, const int *payload)
+{
+    int payload_format = payload[0];
+    int number_of_nodes = payload[1];
+    long number_of_pairs = payload_format == PAYLOAD_EDGE_LIST ? payload[2] : 0;
+    const int *pairs = payload + 3;
+    const int *cells = payload + 2;
+
+    // Count the degrees, turn them into offsets and place every edge in its row
+    long *offsets = (long *)calloc((long)number_of_nodes + 1, sizeof(long));
+    if (offsets == NULL)
+    {
+        return -1;
+    }
+    if (payload_format == PAYLOAD_EDGE_LIST)
+    {
+        for (long i = 0; i < number_of_pairs; i++)
+        {
+            int u = pairs[2 * i];
+            if (u >= 1 && u <= number_of_nodes && pairs[2 * i + 1] >= 1 && pairs[2 * i + 1] <= number_of_nodes)
+                offsets[u]++;
+        }
+    }
+    else
+    {
+        for (long i = 0; i < (long)number_of_nodes * number_of_nodes; i++)
+        {
+            if (cells[i] == 1)
+                offsets[i / number_of_nodes + 1]++;
+        }
+    }
+    for (int v = 0; v < number_of_nodes; v++)
+    {
+        offsets[v + 1] += offsets[v];
+    }
+
+    long number_of_edges = offsets[number_of_nodes];
+    int *neighbours = (int *)malloc((number_of_edges > 0 ? number_of_edges : 1) * sizeof(int));
+    long *next = (long *)malloc(((long)number_of_nodes + 1) * sizeof(long));
+    if (neighbours == NULL || next == NULL)
+    {
+        free(offsets);
+        free(neighbours);
+        free(next);
+        return -1;
+    }
+    memcpy(next, offsets, ((long)number_of_nodes + 1) * sizeof(long));
+    if (payload_format == PAYLOAD_EDGE_LIST)
+    {
+        for (long i = 0; i < number_of_pairs; i++)
+        {
+            int u = pairs[2 * i];
+            int v = pairs[2 * i + 1];
+            if (u >= 1 && u <= number_of_nodes && v >= 1 && v <= number_of_nodes)
+                neighbours[next[u - 1]++] = v - 1;
+        }
+    }
+    else
+    {
+        for (long i = 0; i < (long)number_of_nodes * number_of_nodes; i++)
+        {
+            if (cells[i] == 1)
+                neighbours[next[i / number_of_nodes]++] = i % number_of_nodes;
+        }
+    }
+
+    struct csr_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CSR_MAGIC, 4);
+    header.version = 1;
+    header.number_of_nodes = number_of_nodes;
+    header.number_of_edges = number_of_edges;
+
+    int result = -1;
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd != -1)
+    {
+        if (writeAll(fd, &header, sizeof(header)) == 0 &&
+            writeAll(fd, offsets, ((long)number_of_nodes + 1) * sizeof(long)) == 0 &&
+            writeAll(fd, neighbours, number_of_edges * sizeof(int)) == 0)
+        {
+            result = 0;
+        }
+        if (close(fd) == -1)
+        {
+            result = -1;
+        }
+    }
+
+    free(offsets);
+    free(neighbours);
+    free(next);
+    return result;
+}
+
+/*
+ * Text graph files are formatted into SERIALIZER_BUFFERS buffers of SERIALIZER_BUFFER_SIZE bytes
+ * and the buffers are written out together with one writev once they are all full, so a graph
+ * costs a few system calls instead of a stdio call per cell.
+ */
+struct serializer
+{
+    int fd;
+    int failed;
+    int full_buffers;
+    char *buffers[SERIALIZER_BUFFERS];
+    struct iovec iov[SERIALIZER_BUFFERS];
+    char *cursor;
+    char *limit;
+};
+
+// The two digits of 0 to 99
+static const char digitPairs[201] = "00010203040506070809"
+                                    "10111213141516171819"
+                                    "20212223242526272829"
+                                    "30313233343536373839"
+                                    "40414243444546474849"
+                                    "50515253545556575859"
+                                    "60616263646566676869"
+                                    "70717273747576777879"
+                                    "80818283848586878889"
+                                    "90919293949596979899";
+
+static const unsigned int powersOfTen[10] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+
+// Number of decimal digits of value, from its bit length without a loop or a branch
+static inline int decimalDigits(unsigned int value)
+{
+    unsigned int x = value | 1;
+    int guess = ((32 - __builtin_clz(x)) * 1233) >> 12;
+    return guess + 1 - (x < powersOfTen[guess]);
+}
+
+// Formats value in decimal at out, two digits at a time from the end, and returns the end
+static inline char *formatInt(char *out, int value)
+{
+    unsigned int negative = value < 0;
+    unsigned int magnitude = negative ? 0U - (unsigned int)value : (unsigned int)value;
+    *out = '-';
+    out += negative;
+    char *end = out + decimalDigits(magnitude);
+    char *p = end;
+    while (magnitude >= 100)
+    {
+        unsigned int rest = magnitude / 100;
+        p -= 2;
+        memcpy(p, digitPairs + 2 * (magnitude - rest * 100), 2);
+        magnitude = rest;
+    }
+    if (magnitude >= 10)
+    {
+        memcpy(p - 2, digitPairs + 2 * magnitude, 2);
+    }
+    else
+    {
+        p[-1] = (char)('0' + magnitude);
+    }
+    return end;
+}
+
+// Writes all of the buffers to fd, returns -1 on error
+int writevAll(int fd, struct iovec *iov, int count)
+{
+    while (count > 0)
+    {
+        ssize_t written = writev(fd, iov, count);
+        if (written == -1)
+        {
+            return -1;
+        }
+        while (count > 0 && (size_t)written >= iov->iov_len)
+        {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+// Writes out the buffers filled so far, the current one included, and starts over at the first
+static void serializerFlush(struct serializer *serializer)
+{
+    int count = serializer->full_buffers;
+    if (serializer->cursor > serializer->buffers[count])
+    {
+        serializer->iov[count].iov_base = serializer->buffers[count];
+        serializer->iov[count].iov_len = serializer->cursor - serializer->buffers[count];
+        count++;
+    }
+    if (count > 0 && writevAll(serializer->fd, serializer->iov, count) == -1)
+    {
+        serializer->failed = 1;
+    }
+    serializer->full_buffers = 0;
+    serializer->cursor = serializer->buffers[0];
+    serializer->limit = serializer->buffers[0] + SERIALIZER_BUFFER_SIZE;
+}
+
+// Makes room for size bytes, moving on to the next buffer or flushing all of them
+static inline void serializerReserve(struct serializer *serializer, size_t size)
+{
+    if ((size_t)(serializer->limit - serializer->cursor) >= size)
+    {
+        return;
+    }
+    int current = serializer->full_buffers;
+    if (current + 1 == SERIALIZER_BUFFERS)
+    {
+        serializerFlush(serializer);
+        return;
+    }
+    serializer->iov[current].iov_base = serializer->buffers[current];
+    serializer->iov[current].iov_len = serializer->cursor - serializer->buffers[current];
+    serializer->full_buffers++;
+    serializer->cursor = serializer->buffers[current + 1];
+    serializer->limit = serializer->cursor + SERIALIZER_BUFFER_SIZE;
+}
+
+// Appends value followed by separator, there must be SERIALIZER_MAX_NUMBER bytes of room
+static inline void serializerPutInt(struct serializer *serializer, int value, char separator)
+{
+    serializer->cursor = formatInt(serializer->cursor, value);
+    *serializer->cursor++ = separator;
+}
+
+/**
+ * @brief Writes the graph in the shared memory payload to path as a text graph file, either the
+ * adjacency matrix or the edge list it was sent as. It is formatted straight from the payload.
+ * Returns -1 on error.
+ *
+ * @param path
+ * @param payload
+ * @return int
+ */
+int writeTextGraphFile(const char *path, const int *payload)
+{
+    int payload_format = payload[0];
+    int number_of_nodes = payload[1];
+    int payload_index = 2;
+    struct serializer serializer;
+    memset(&serializer, 0, sizeof(serializer));
+    for (int i = 0; i < SERIALIZER_BUFFERS; i++)
+    {
+        if ((serializer.buffers[i] = (char *)malloc(SERIALIZER_BUFFER_SIZE)) == NULL)
+        {
+            serializer.failed = 1;
+        }
+    }
+    if (serializer.failed || (serializer.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+    {
+        for (int i = 0; i < SERIALIZER_BUFFERS; i++)
+        {
+            free(serializer.buffers[i]);
+        }
+        return -1;
+    }
+    LOG_DEBUG("[Primary Server] Successfully opened the file %s\n", path);
+    serializer.cursor = serializer.buffers[0];
+    serializer.limit = serializer.buffers[0] + SERIALIZER_BUFFER_SIZE;
+
+    if (payload_format == PAYLOAD_EDGE_LIST)
+    {
+        // Edge lists are stored as they are, the dense matrix is never built
+        int number_of_edges = payload[payload_index++];
+        serializerReserve(&serializer, 2 + 2 * SERIALIZER_MAX_NUMBER);
+        *serializer.cursor++ = 'E';
+        *serializer.cursor++ = ' ';
+        serializerPutInt(&serializer, number_of_nodes, ' ');
+        serializerPutInt(&serializer, number_of_edges, '\n');
+        for (int i = 0; i < number_of_edges; i++)
+        {
+            serializerReserve(&serializer, 2 * SERIALIZER_MAX_NUMBER);
+            serializerPutInt(&serializer, payload[payload_index], ' ');
+            serializerPutInt(&serializer, payload[payload_index + 1], '\n');
+            payload_index += 2;
+        }
+    }
+    else
+    {
+        serializerReserve(&serializer, SERIALIZER_MAX_NUMBER);
+        serializerPutInt(&serializer, number_of_nodes, '\n');
+        for (int i = 0; i < number_of_nodes; i++)
+        {
+            for (int j = 0; j < number_of_nodes; j++)
+            {
+                serializerReserve(&serializer, SERIALIZER_MAX_NUMBER);
+                serializerPutInt(&serializer, payload[payload_index++], ' ');
+            }
+            serializerReserve(&serializer, 1);
+            *serializer.cursor++ = '\n';
+        }
+    }
+    serializerFlush(&serializer);
+
+    for (int i = 0; i < SERIALIZER_BUFFERS; i++)
+    {
+        free(serializer.buffers[i]);
+    }
+    if (close(serializer.fd) == -1)
+    {
+        return -1;
+    }
+    return serializer.failed ? -1 : 0;
+}
+
+// Called by the main thread for every write it dequeues, before the writing thread is created
+struct pending_graph *pendingWriteBegin(const char *graph_name, long ticket)
+{
+    pthread_mutex_lock(&pendingLock);
+    struct pending_graph *pending = pendingGraphs;
+    while (pending != NULL && strcmp(pending->graph_name, graph_name) != 0)
+    {
+        pending = pending->next;
+    }
+    if (pending == NULL)
+    {
+        pending = (struct pending_graph *)calloc(1, sizeof(struct pending_graph));
+        if (pending == NULL)
+        {
+            perror("[Primary Server] Memory allocation failed");
+            exit(EXIT_FAILURE);
+        }
+        snprintf(pending->graph_name, sizeof(pending->graph_name), "%s", graph_name);
+        pthread_cond_init(&pending->changed, NULL);
+        pending->next = pendingGraphs;
+        pendingGraphs = pending;
+    }
+    pending->newest = ticket;
+    pending->writers++;
+    pthread_mutex_unlock(&pendingLock);
+    return pending;
+}
+
+// 1 when a later write to the same graph has been dequeued, which makes this one pointless
+int pendingWriteSuperseded(struct pending_graph *pending, long ticket)
+{
+    pthread_mutex_lock(&pendingLock);
+    int superseded = pending->newest > ticket;
+    pthread_mutex_unlock(&pendingLock);
+    return superseded;
+}
+
+/*
+ * 1 when a later write to the same graph is in the write-ahead log. Only then may the graph file
+ * be left to it, a write that was only dequeued could still be lost with the primary.
+ */
+int pendingWriteOverwritten(struct pending_graph *pending, long ticket)
+{
+    pthread_mutex_lock(&pendingLock);
+    int overwritten = pending->logged > ticket;
+    pthread_mutex_unlock(&pendingLock);
+    return overwritten;
+}
+
+// Called once the write with this ticket is in the write-ahead log
+void pendingWriteLogged(struct pending_graph *pending, long ticket)
+{
+    pthread_mutex_lock(&pendingLock);
+    if (ticket > pending->logged)
+    {
+        pending->logged = ticket;
+    }
+    pthread_cond_broadcast(&pending->changed);
+    pthread_mutex_unlock(&pendingLock);
+}
+
+// Called once the write with this ticket has been written to the graph file
+void pendingWriteStored(struct pending_graph *pending, long ticket)
+{
+    pthread_mutex_lock(&pendingLock);
+    if (ticket > pending->stored)
+    {
+        pending->stored = ticket;
+    }
+    pthread_cond_broadcast(&pending->changed);
+    pthread_mutex_unlock(&pendingLock);
+}
+
+/*
+ * A superseded write is acknowledged only once a newer write is in the graph file. It is in the
+ * log then as well, so whatever happens to the primary afterwards the graph never goes back to a
+ * version older than the client's, and a read after the reply sees the client's write or a newer one.
+ */
+void pendingWriteAwait(struct pending_graph *pending, long ticket)
+{
+    pthread_mutex_lock(&pendingLock);
+    while (pending->stored < ticket)
+    {
+        pthread_cond_wait(&pending->changed, &pendingLock);
+    }
+    pthread_mutex_unlock(&pendingLock);
+}
+
+// Forgets the graph once its last pending write has been answered
+void pendingWriteEnd(struct pending_graph *pending)
+{
+    pthread_mutex_lock(&pendingLock);
+    if (--pending->writers == 0)
+    {
+        struct pending_graph **link = &pendingGraphs;
+        while (*link != pending)
+        {
+            link = &(*link)->next;
+        }
+        *link = pending->next;
+        pthread_cond_destroy(&pending->changed);
+        free(pending);
+    }
+    pthread_mutex_unlock(&pendingLock);
+}
+
+// Size of the shared memory payload: format and n, then the n*n cells or m and the m pairs
+long payloadBytes(const int *payload)
+{
+    long ints = payload[0] == PAYLOAD_EDGE_LIST ? 3 + 2L * payload[2] : 2 + (long)payload[1] * payload[1];
+    return ints * (long)sizeof(int);
+}
+
+// FNV-1a over the payload, eight bytes at a time
+unsigned long payloadChecksum(const void *payload, long bytes)
+{
+    const unsigned char *p = (const unsigned char *)payload;
+    unsigned long hash = 14695981039346656037UL;
+    long i = 0;
+    for (; i + 8 <= bytes; i += 8)
+    {
+        unsigned long word;
+        memcpy(&word, p + i, 8);
+        hash = (hash ^ word) * 1099511628211UL;
+    }
+    for (; i < bytes; i++)
+    {
+        hash = (hash ^ p[i]) * 1099511628211UL;
+    }
+    return hash;
+}
+
+// Makes the creation or removal of a segment durable
+static void walSyncDirectory()
+{
+    int fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1 || fsync(fd) == -1)
+    {
+        perror("[Primary Server] Error while syncing the directory of the write-ahead log");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+}
+
+// Creates the segment with the given id
+static struct wal_segment *walCreateSegment(long id)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "%s%ld", WAL_SEGMENT_PREFIX, id);
+    struct wal_segment *segment = (struct wal_segment *)calloc(1, sizeof(struct wal_segment));
+    if (segment == NULL)
+    {
+        perror("[Primary Server] Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    segment->id = id;
+    if ((segment->fd = open(name, O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644)) == -1)
+    {
+        perror("[Primary Server] Error while creating a segment of the write-ahead log");
+        exit(EXIT_FAILURE);
+    }
+    walSyncDirectory();
+    wal.segments++;
+    return segment;
+}
+
+// Deletes a segment once the graph files written from its records are on disk
+static void walDropSegment(struct wal_segment *segment)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "%s%ld", WAL_SEGMENT_PREFIX, segment->id);
+    if (syncfs(segment->fd) == -1 || unlink(name) == -1)
+    {
+        perror("[Primary Server] Error while removing a segment of the write-ahead log");
+        exit(EXIT_FAILURE);
+    }
+    walSyncDirectory();
+    LOG_DEBUG("[Primary Server] Removed the write-ahead log segment %ld of %ld bytes\n", segment->id, segment->end);
+    close(segment->fd);
+    free(segment);
+}
+
+/*
+ * Replaces a full active segment by a new one and retires it. Called with the lock held.
+ * Everything appended to the old segment is synced first, so syncs only ever need to look at
+ * the active segment.
+ */
+static void walRotateLocked()
+{
+    struct wal_segment *full = wal.active;
+    if (fdatasync(full->fd) == -1)
+    {
+        perror("[Primary Server] Error while syncing the write-ahead log");
+        exit(EXIT_FAILURE);
+    }
+    if (wal.position > wal.synced)
+    {
+        wal.synced = wal.position;
+    }
+    wal.active = walCreateSegment(full->id + 1);
+    struct wal_segment **link = &wal.retired;
+    while (*link != NULL)
+    {
+        link = &(*link)->next;
+    }
+    *link = full;
+}
+
+/*
+ * Deletes the oldest retired segments whose records are all applied. Segments go strictly in
+ * order, so a replay never sees a segment without the newer ones. The appenders go on meanwhile,
+ * they never touch a retired segment.
+ */
+static void walDropApplied()
+{
+    pthread_mutex_lock(&wal.drop_lock);
+    pthread_mutex_lock(&wal.lock);
+    struct wal_segment *applied = NULL;
+    struct wal_segment **tail = &applied;
+    while (wal.retired != NULL && wal.retired->pending == 0)
+    {
+        *tail = wal.retired;
+        wal.retired = wal.retired->next;
+        tail = &(*tail)->next;
+        *tail = NULL;
+    }
+    pthread_mutex_unlock(&wal.lock);
+    while (applied != NULL)
+    {
+        struct wal_segment *next = applied->next;
+        walDropSegment(applied);
+        applied = next;
+    }
+    pthread_mutex_unlock(&wal.drop_lock);
+}
+
+/**
+ * @brief Appends a write to the log and returns once it is on disk. Appends are serialized, but
+ * the fdatasync is not: the first appender to find no sync running syncs everything appended so
+ * far, and the ones that append meanwhile wait for it and share the next sync.
+ *
+ * @param graph_name
+ * @param ticket
+ * @param payload
+ * @param payload_bytes
+ * @param pending the write is not appended when a newer write to the graph has been dequeued
+ * @param segment receives the segment the record is in, which stays until walApplied
+ * @return long offset of the record in the segment, -1 when it was not appended
+ */
+long walAppend(const char *graph_name, long ticket, const int *payload, long payload_bytes, struct pending_graph *pending,
+               struct wal_segment **segment)
+{
+    static const char padding[8];
+    struct wal_record header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, WAL_MAGIC, 4);
+    header.version = 1;
+    header.ticket = ticket;
+    header.payload_bytes = payload_bytes;
+    header.checksum = payloadChecksum(payload, payload_bytes);
+    snprintf(header.graph_name, sizeof(header.graph_name), "%s", graph_name);
+    long padded_bytes = (payload_bytes + 7) & ~7L;
+    struct iovec iov[3] = {{&header, sizeof(header)}, {(void *)payload, payload_bytes}, {(void *)padding, padded_bytes - payload_bytes}};
+
+    pthread_mutex_lock(&wal.lock);
+    // Checked under the lock, a newer write to the graph that is already in the log was dequeued before
+    if (pendingWriteSuperseded(pending, ticket))
+    {
+        pthread_mutex_unlock(&wal.lock);
+        return -1;
+    }
+    int rotated = wal.active->end >= WAL_SEGMENT_BYTES;
+    if (rotated)
+    {
+        walRotateLocked();
+    }
+    *segment = wal.active;
+    long offset = wal.active->end;
+    // Segments are opened with O_APPEND and only appended to under the lock
+    if (writevAll(wal.active->fd, iov, 3) == -1)
+    {
+        perror("[Primary Server] Error while appending to the write-ahead log");
+        exit(EXIT_FAILURE);
+    }
+    wal.active->end += sizeof(header) + padded_bytes;
+    wal.active->pending++;
+    wal.position += sizeof(header) + padded_bytes;
+    wal.appends++;
+    long end = wal.position;
+    while (wal.synced < end)
+    {
+        if (wal.syncing)
+        {
+            pthread_cond_wait(&wal.synced_changed, &wal.lock);
+            continue;
+        }
+        wal.syncing = 1;
+        long target = wal.position;
+        int fd = wal.active->fd;
+        pthread_mutex_unlock(&wal.lock);
+        if (fdatasync(fd) == -1)
+        {
+            perror("[Primary Server] Error while syncing the write-ahead log");
+            exit(EXIT_FAILURE);
+        }
+        pthread_mutex_lock(&wal.lock);
+        // A rotation meanwhile may have synced further already
+        if (target > wal.synced)
+        {
+            wal.synced = target;
+        }
+        wal.syncing = 0;
+        wal.syncs++;
+        pthread_cond_broadcast(&wal.synced_changed);
+    }
+    pthread_mutex_unlock(&wal.lock);
+    // The retired segment may have been applied already
+    if (rotated)
+    {
+        walDropApplied();
+    }
+    return offset;
+}
+
+// Called once the graph file of a logged write has been written or left to a newer logged write
+void walApplied(struct wal_segment *segment)
+{
+    pthread_mutex_lock(&wal.lock);
+    segment->pending--;
+    int droppable = wal.retired != NULL && wal.retired->pending == 0;
+    pthread_mutex_unlock(&wal.lock);
+    if (droppable)
+    {
+        walDropApplied();
+    }
+}
+
+// Empties the active segment when every logged write has been applied, at shutdown
+void walCheckpoint()
+{
+    pthread_mutex_lock(&wal.lock);
+    struct wal_segment *active = wal.active;
+    if (wal.retired == NULL && active->pending == 0 && active->end > 0)
+    {
+        if (syncfs(active->fd) == -1 || ftruncate(active->fd, 0) == -1 || fdatasync(active->fd) == -1)
+        {
+            perror("[Primary Server] Error while checkpointing the write-ahead log");
+            exit(EXIT_FAILURE);
+        }
+        LOG_DEBUG("[Primary Server] Checkpointed %ld bytes of the write-ahead log\n", active->end);
+        active->end = 0;
+    }
+    pthread_mutex_unlock(&wal.lock);
+}
+
+/**
+ * @brief Maps the payload of the record at offset in a segment, which stays valid until the
+ * segment is dropped, and that needs the record to be applied first
+ *
+ * @param segment
+ * @param offset
+ * @param payload_bytes
+ * @param mapping receives the start of the mapping for munmap
+ * @param mapping_size receives its size
+ * @return const int* the payload
+ */
+const int *walMapPayload(const struct wal_segment *segment, long offset, long payload_bytes, void **mapping, size_t *mapping_size)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    long start = offset + (long)sizeof(struct wal_record);
+    long aligned = start & ~(page - 1);
+    *mapping_size = start - aligned + payload_bytes;
+    *mapping = mmap(NULL, *mapping_size, PROT_READ, MAP_SHARED, segment->fd, aligned);
+    if (*mapping == MAP_FAILED)
+    {
+        perror("[Primary Server] Error while mapping the write-ahead log");
+        exit(EXIT_FAILURE);
+    }
+    return (const int *)((const char *)*mapping + (start - aligned));
+}
+
+/*
+ * The pid of the primary holding the rw_sem of a graph as its writer, 0 when no writer holds it,
+ * kept in the shared memory object RW_OWNER_PREFIX<graph>. It outlives a primary that is killed,
+ * so the next one can tell a semaphore left taken by it from one held by readers.
+ */
+void setRwOwner(const char *filename, pid_t owner)
+{
+    char name[256];
+    snprintf(name, sizeof(name), "%s%s", RW_OWNER_PREFIX, filename);
+    int fd = shm_open(name, O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+    if (fd == -1 || pwrite(fd, &owner, sizeof(owner), 0) != sizeof(owner))
+    {
+        perror("[Primary Server] Error while recording the writer of a graph");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+}
+
+pid_t getRwOwner(const char *filename)
+{
+    char name[256];
+    snprintf(name, sizeof(name), "%s%s", RW_OWNER_PREFIX, filename);
+    pid_t owner = 0;
+    int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if (fd != -1)
+    {
+        if (pread(fd, &owner, sizeof(owner), 0) != sizeof(owner))
+        {
+            owner = 0;
+        }
+        close(fd);
+    }
+    return owner;
+}
+
+/**
+ * @brief Writes a payload to its graph file under rw_sem. Binary graph files are built under a
+ * temporary name first and only renamed over the old file while holding the semaphore, readers
+ * that have the old file mapped keep it. A write that a newer logged one to the same graph
+ * replaces is dropped instead, before it is built or after it waited for the semaphore.
+ *
+ * @param filename
+ * @param payload
+ * @param seq_num names the temporary file and the trace events
+ * @param pending NULL when nothing can supersede the write
+ * @param ticket
+ * @return int 0 when the file was written, 1 when it was left to a newer logged write
+ */
+int storeGraph(const char *filename, const int *payload, long seq_num, struct pending_graph *pending, long ticket)
+{
+    // SEMAPHORE PART
+    char sema_name_rw[256];
+    snprintf(sema_name_rw, sizeof(sema_name_rw), "rw_%s", filename);
+    // If O_CREAT is specified, and a semaphore with the given name already exists,
+    // then mode and value are ignored.
+    sem_t *rw_sem = sem_open(sema_name_rw, O_CREAT, 0644, 1);
+
+    if (pending != NULL && pendingWriteOverwritten(pending, ticket))
+    {
+        return 1;
+    }
+    char temporary_filename[300];
+    int csr = isCsrGraphName(filename);
+    if (csr)
+    {
+        snprintf(temporary_filename, sizeof(temporary_filename), "%s.%ld.tmp", filename, seq_num);
+        if (writeCsrGraphFile(temporary_filename, payload) == -1)
+        {
+            perror("[Primary Server] Error while writing the binary graph file");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // It's time to open the file and write the data to it
+    // Wait for the semaphore to be available
+    LOG_DEBUG("[Primary Server] Waiting for the semaphore to be available\n");
+    long lock_wait_start = nowNs();
+    sem_wait(rw_sem);
+    setRwOwner(filename, getpid());
+    long lock_acquired = nowNs();
+    STATS_ADD(lock_waits, 1);
+    STATS_ADD(lock_wait_ns, lock_acquired - lock_wait_start);
+    traceSpan("wait rw_sem", lock_wait_start, lock_acquired, "seq", seq_num, NULL, 0);
+
+    int superseded = pending != NULL && pendingWriteOverwritten(pending, ticket);
+    if (superseded)
+    {
+        if (csr)
+        {
+            unlink(temporary_filename);
+        }
+    }
+    else if (csr && rename(temporary_filename, filename) == -1)
+    {
+        perror("[Primary Server] Error while replacing the binary graph file");
+        exit(EXIT_FAILURE);
+    }
+    else if (!csr && writeTextGraphFile(filename, payload) == -1)
+    {
+        perror("[Primary Server] Error while writing the file");
+        exit(EXIT_FAILURE);
+    }
+    else
+    {
+        traceSpan("store graph", lock_acquired, nowNs(), "seq", seq_num, "nodes", payload[1]);
+    }
+
+    // Release the semaphore. The owner is cleared first: dying in between leaves the semaphore
+    // taken with no owner, which blocks the graph, rather than an owner that would be posted twice
+    LOG_DEBUG("[Primary Server] Released the semaphore\n");
+    setRwOwner(filename, 0);
+    sem_post(rw_sem);
+    return superseded;
+}
+
+/*
+ * Gives back the rw_sem of a graph about to be replayed if the primary recorded as its writer is
+ * gone, which is a primary killed while it wrote the graph. A semaphore held by readers, or by a
+ * writer that is still running, is left alone and waited for by the replay as usual.
+ */
+static void walReclaimLock(const char *filename)
+{
+    pid_t owner = getRwOwner(filename);
+    if (owner == 0 || owner == getpid() || kill(owner, 0) == 0 || errno != ESRCH)
+    {
+        return;
+    }
+    char sema_name_rw[256];
+    snprintf(sema_name_rw, sizeof(sema_name_rw), "rw_%s", filename);
+    sem_t *rw_sem = sem_open(sema_name_rw, O_CREAT, 0644, 1);
+    setRwOwner(filename, 0);
+    sem_post(rw_sem);
+    sem_close(rw_sem);
+    LOG_WARN("[Primary Server] Gave back the rw_sem of %s left taken by the killed primary %d\n", filename, (int)owner);
+}
+
+static int compareWalSegmentIds(const void *a, const void *b)
+{
+    long first = *(const long *)a;
+    long second = *(const long *)b;
+    return (first > second) - (first < second);
+}
+
+static int compareWalRecords(const void *a, const void *b)
+{
+    const struct wal_record *first = *(const struct wal_record *const *)a;
+    const struct wal_record *second = *(const struct wal_record *const *)b;
+    int names = strcmp(first->graph_name, second->graph_name);
+    if (names != 0)
+    {
+        return names;
+    }
+    return (first->ticket > second->ticket) - (first->ticket < second->ticket);
+}
+
+/**
+ * @brief Reads the records of a mapped segment up to the first torn or damaged one
+ *
+ * @param log
+ * @param size
+ * @param records grown as records are found
+ * @param record_count
+ * @param record_capacity
+ * @return long the bytes of the segment that hold records
+ */
+static long walReadSegment(const char *log, long size, const struct wal_record ***records, long *record_count, long *record_capacity)
+{
+    long offset = 0;
+    while (offset + (long)sizeof(struct wal_record) <= size)
+    {
+        const struct wal_record *record = (const struct wal_record *)(log + offset);
+        const int *payload = (const int *)(record + 1);
+        long padded_bytes = (record->payload_bytes + 7) & ~7L;
+        if (memcmp(record->magic, WAL_MAGIC, 4) != 0 || record->version != 1 || record->payload_bytes < 3 * (long)sizeof(int) ||
+            padded_bytes > size - offset - (long)sizeof(struct wal_record) ||
+            memchr(record->graph_name, '\0', sizeof(record->graph_name)) == NULL || record->graph_name[0] == '\0' ||
+            payloadChecksum(payload, record->payload_bytes) != record->checksum || payloadBytes(payload) != record->payload_bytes)
+        {
+            break;
+        }
+        if (*record_count == *record_capacity)
+        {
+            *record_capacity = *record_capacity ? 2 * *record_capacity : 64;
+            *records = (const struct wal_record **)realloc(*records, *record_capacity * sizeof(struct wal_record *));
+            if (*records == NULL)
+            {
+                perror("[Primary Server] Memory allocation failed");
+                exit(EXIT_FAILURE);
+            }
+        }
+        (*records)[(*record_count)++] = record;
+        offset += sizeof(struct wal_record) + padded_bytes;
+    }
+    return offset;
+}
+
+/**
+ * @brief Replays what a previous primary left in the write-ahead log and starts a new segment.
+ * Every write replaces the whole graph, so writing the newest logged payload of every graph
+ * again restores all acknowledged writes, whether or not they reached their file. Each segment
+ * is read up to its first torn or damaged record, and all of them are deleted once the graphs
+ * are on disk. Tickets continue after the highest one logged, so a record of this run always
+ * ranks after the records of the previous one.
+ *
+ * @return long the highest ticket found in the log
+ */
+long walRecover()
+{
+    long *ids = NULL;
+    long id_count = 0;
+    long id_capacity = 0;
+    DIR *directory = opendir(".");
+    if (directory == NULL)
+    {
+        perror("[Primary Server] Error while looking for the write-ahead log");
+        exit(EXIT_FAILURE);
+    }
+    struct dirent *entry;
+    while ((entry = readdir(directory)) != NULL)
+    {
+        char *end;
+        if (strncmp(entry->d_name, WAL_SEGMENT_PREFIX, strlen(WAL_SEGMENT_PREFIX)) != 0)
+        {
+            continue;
+        }
+        long id = strtol(entry->d_name + strlen(WAL_SEGMENT_PREFIX), &end, 10);
+        if (*end != '\0' || end == entry->d_name + strlen(WAL_SEGMENT_PREFIX))
+        {
+            continue;
+        }
+        if (id_count == id_capacity)
+        {
+            id_capacity = id_capacity ? 2 * id_capacity : 16;
+            ids = (long *)realloc(ids, id_capacity * sizeof(long));
+            if (ids == NULL)
+            {
+                perror("[Primary Server] Memory allocation failed");
+                exit(EXIT_FAILURE);
+            }
+        }
+        ids[id_count++] = id;
+    }
+    closedir(directory);
+    // Oldest first, which is also the order they are deleted in
+    qsort(ids, id_count, sizeof(long), compareWalSegmentIds);
+
+    const struct wal_record **records = NULL;
+    long record_count = 0;
+    long record_capacity = 0;
+    long unusable = 0;
+    long last_id = 0;
+    long max_ticket = 0;
+    int *fds = (int *)malloc((id_count + 1) * sizeof(int));
+    const char **logs = (const char **)malloc((id_count + 1) * sizeof(char *));
+    long *sizes = (long *)malloc((id_count + 1) * sizeof(long));
+    if (fds == NULL || logs == NULL || sizes == NULL)
+    {
+        perror("[Primary Server] Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    for (long i = 0; i < id_count; i++)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "%s%ld", WAL_SEGMENT_PREFIX, ids[i]);
+        struct stat st;
+        if ((fds[i] = open(name, O_RDONLY | O_CLOEXEC)) == -1 || fstat(fds[i], &st) == -1)
+        {
+            perror("[Primary Server] Error while reading the write-ahead log");
+            exit(EXIT_FAILURE);
+        }
+        last_id = ids[i] > last_id ? ids[i] : last_id;
+        sizes[i] = st.st_size;
+        logs[i] = NULL;
+        if (st.st_size == 0)
+        {
+            continue;
+        }
+        logs[i] = (const char *)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fds[i], 0);
+        if (logs[i] == MAP_FAILED)
+        {
+            perror("[Primary Server] Error while mapping the write-ahead log");
+            exit(EXIT_FAILURE);
+        }
+        unusable += st.st_size - walReadSegment(logs[i], st.st_size, &records, &record_count, &record_capacity);
+    }
+
+    // Sorted by graph and ticket, the last record of a graph is its newest write
+    qsort(records, record_count, sizeof(struct wal_record *), compareWalRecords);
+    long replayed = 0;
+    for (long i = 0; i < record_count; i++)
+    {
+        const struct wal_record *record = records[i];
+        max_ticket = record->ticket > max_ticket ? record->ticket : max_ticket;
+        if (i + 1 < record_count && strcmp(record->graph_name, records[i + 1]->graph_name) == 0)
+        {
+            continue;
+        }
+        walReclaimLock(record->graph_name);
+        storeGraph(record->graph_name, (const int *)(record + 1), record->ticket, NULL, 0);
+        LOG_INFO("[Primary Server] Replayed the logged write to %s\n", record->graph_name);
+        replayed++;
+    }
+    if (id_count > 0)
+    {
+        LOG_INFO("[Primary Server] Replayed %ld graphs from %ld logged writes in %ld segments, %ld bytes of the log were not usable\n", replayed,
+                 record_count, id_count, unusable);
+    }
+
+    // The replayed graphs are on disk before the log goes
+    if (id_count > 0 && syncfs(fds[0]) == -1)
+    {
+        perror("[Primary Server] Error while syncing the replayed graphs");
+        exit(EXIT_FAILURE);
+    }
+    for (long i = 0; i < id_count; i++)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "%s%ld", WAL_SEGMENT_PREFIX, ids[i]);
+        if (logs[i] != NULL)
+        {
+            munmap((void *)logs[i], sizes[i]);
+        }
+        close(fds[i]);
+        if (unlink(name) == -1)
+        {
+            perror("[Primary Server] Error while removing a segment of the write-ahead log");
+            exit(EXIT_FAILURE);
+        }
+    }
+    free(records);
+    free(fds);
+    free(logs);
+    free(sizes);
+    free(ids);
+
+    // The new segment is numbered after the old ones, whose removal is made durable with it
+    wal.active = walCreateSegment(last_id + 1);
+    return max_ticket;
+}
+
+/**
+ * @brief Writes the graph file of a logged write from its record, or leaves it to a newer
+ * logged write, and releases the record
+ *
+ * @param dtt
+ * @param filename
+ * @param segment
+ * @param offset
+ * @param payload_bytes
+ */
+void applyLoggedWrite(struct data_to_thread *dtt, const char *filename, struct wal_segment *segment, long offset, long payload_bytes)
+{
+    void *mapping;
+    size_t mapping_size;
+    const int *payload = walMapPayload(segment, offset, payload_bytes, &mapping, &mapping_size);
+    if (storeGraph(filename, payload, dtt->msg.data.seq_num, dtt->pending, dtt->ticket) == 0)
+    {
+        pendingWriteStored(dtt->pending, dtt->ticket);
+        LOG_INFO("[Primary Server] Successfully written to the file %s for seq: %ld\n", filename, dtt->msg.data.seq_num);
+    }
+    else
+    {
+        STATS_ADD(coalesced_writes, 1);
+        LOG_INFO("[Primary Server] Left the logged write to %s for seq: %ld to a newer one\n", filename, dtt->msg.data.seq_num);
+    }
+    munmap(mapping, mapping_size);
+    walApplied(segment);
+}
+
+/**
+ * @brief This function is executed by the thread which is responsible for writing to the new graph file.
+ * It answers once the write is in the write-ahead log and writes the graph file afterwards, or
+ * before the answer when the graph has no file yet, so that a read never finds it missing. When
+ * newer writes to the same graph are already waiting, it leaves the graph to the newest and only
+ * answers once a newer write is in the graph file.
  *
  * @param arg
  * @return void*
@@ -61,6 +1279,7 @@ struct data_to_thread
 void *writeToNewGraphFile(void *arg)
 {
     struct data_to_thread *dtt = (struct data_to_thread *)arg;
+    long operation = dtt->msg.data.operation;
     // On the server side for storing data, we just start with an integer
     // NOTE: Here we can use this and get away with it because we are not storing data here but only reading
     // Refer: https://man7.org/linux/man-pages/man3/shmget.3p.html
@@ -77,7 +1296,7 @@ void *writeToNewGraphFile(void *arg)
         perror("[Primary Server] Error while generating key for shared memory");
         exit(EXIT_FAILURE);
     }
-    printf("[Primary Server] Generated shared memory key %d\n", shm_key);
+    LOG_DEBUG("[Primary Server] Generated shared memory key %d\n", shm_key);
     // Connect to the shared memory using the key
     if ((shm_id = shmget(shm_key, sizeof(number_of_nodes), 0666)) == -1)
     {
@@ -92,81 +1311,89 @@ void *writeToNewGraphFile(void *arg)
         exit(EXIT_FAILURE);
     }
 
-    int shmptr_index = 0;
-    number_of_nodes = shmptr[shmptr_index++];
-    int adjacency_matrix[number_of_nodes][number_of_nodes];
-    for (int i = 0; i < number_of_nodes; i++)
-    {
-        for (int j = 0; j < number_of_nodes; j++)
-        {
-            adjacency_matrix[i][j] = shmptr[shmptr_index++];
-        }
-    }
+    // Layout: format, number of nodes, then either the n*n cells or the number of edges and the (u, v) pairs
+    number_of_nodes = shmptr[1];
+    long payload_bytes = payloadBytes(shmptr);
 
     // Choose an appropriate size for your filename
     char filename[250];
     // Make sure the filename is null-terminated, and copy it to the 'filename' array
     snprintf(filename, sizeof(filename), "%s", dtt->msg.data.graph_name);
-    // SEMAPHORE PART
-    char sema_name_rw[256];
-    snprintf(sema_name_rw, sizeof(sema_name_rw), "rw_%s", filename);
-    // If O_CREAT is specified, and a semaphore with the given name already exists,
-    // then mode and value are ignored.
-    sem_t *rw_sem = sem_open(sema_name_rw, O_CREAT, 0644, 1);
 
-    // It's time to open the file and write the data to it
-    // Wait for the semaphore to be available
-    printf("[Primary Server] Waiting for the semaphore to be available\n");
-    sem_wait(rw_sem);
-
-    FILE *fp = fopen(filename, "w");
-    if (fp == NULL)
+    // The write is acknowledged as soon as it is in the write-ahead log, and the graph file is
+    // written afterwards from the log. A write that a newer one to the same graph is queued
+    // behind is not even logged.
+    long wal_offset = -1;
+    struct wal_segment *wal_segment = NULL;
+    long log_start = nowNs();
+    if (!pendingWriteSuperseded(dtt->pending, dtt->ticket))
     {
-        perror("[Primary Server] Error while opening the file");
-        exit(EXIT_FAILURE);
+        wal_offset = walAppend(filename, dtt->ticket, shmptr, payload_bytes, dtt->pending, &wal_segment);
+    }
+    if (wal_offset != -1)
+    {
+        pendingWriteLogged(dtt->pending, dtt->ticket);
+        dtt->msg.data.stage_ns[STAGE_GRAPH_LOADED] = nowNs();
+        traceSpan("log write", log_start, dtt->msg.data.stage_ns[STAGE_GRAPH_LOADED], "seq", dtt->msg.data.seq_num, "nodes", number_of_nodes);
+        LOG_INFO("[Primary Server] Logged the write to %s for seq: %ld\n", filename, dtt->msg.data.seq_num);
     }
     else
     {
-        printf("[Primary Server] Successfully opened the file %s\n", filename);
-        // Write the data to the file
-        fprintf(fp, "%d\n", number_of_nodes);
-        for (int i = 0; i < number_of_nodes; i++)
-        {
-            for (int j = 0; j < number_of_nodes; j++)
-            {
-                fprintf(fp, "%d ", adjacency_matrix[i][j]);
-            }
-            fprintf(fp, "\n");
-        }
-        fclose(fp);
-        printf("[Primary Server] Successfully written to the file %s for seq: %ld\n", filename, dtt->msg.data.seq_num);
+        pendingWriteAwait(dtt->pending, dtt->ticket);
+        dtt->msg.data.stage_ns[STAGE_GRAPH_LOADED] = nowNs();
+        STATS_ADD(coalesced_writes, 1);
+        traceSpan("coalesced write", log_start, dtt->msg.data.stage_ns[STAGE_GRAPH_LOADED], "seq", dtt->msg.data.seq_num, NULL, 0);
+        LOG_INFO("[Primary Server] Coalesced the write to %s for seq: %ld into a newer one\n", filename, dtt->msg.data.seq_num);
+    }
+
+    // A read right after the reply would find no graph at all, rather than the previous version
+    int store_first = wal_offset != -1 && access(filename, F_OK) == -1;
+    if (store_first)
+    {
+        applyLoggedWrite(dtt, filename, wal_segment, wal_offset, payload_bytes);
+    }
+
+    // The payload is in the log, the client may reuse its shared memory once it has the reply
+    if (shmdt(shmptr) == -1)
+    {
+        perror("[Primary Server] Could not detach from shared memory\n");
+        exit(EXIT_FAILURE);
     }
-    // Release the semaphore
-    printf("[Primary Server] Released the semaphore\n");
-    sem_post(rw_sem);
 
-    // Send reply to the client
+    // Send reply to the client. It only promises that the write is durable: unless the graph is
+    // new, its file is written below, after the reply, so until then the secondaries can still
+    // answer reads of this graph, even from this client, with the previous version (see
+    // Write-Ahead Log in README.md)
     dtt->msg.msg_type = dtt->msg.data.seq_num;
     dtt->msg.data.operation = 0;
 
-    printf("[Primary Server] Sending reply to the client %ld @ %d\n", dtt->msg.msg_type, dtt->msg_queue_id);
-    printf("[Primary Server] Message: %ld %ld %s\n", dtt->msg.data.seq_num, dtt->msg.data.operation, dtt->msg.data.graph_name);
+    LOG_DEBUG("[Primary Server] Sending reply to the client %ld @ %d\n", dtt->msg.msg_type, dtt->msg_queue_id);
+    LOG_DEBUG("[Primary Server] Message: %ld %ld %s\n", dtt->msg.data.seq_num, dtt->msg.data.operation, dtt->msg.data.graph_name);
+    dtt->msg.data.stage_ns[STAGE_REPLY_SENT] = nowNs();
     if (msgsnd(dtt->msg_queue_id, &(dtt->msg), sizeof(dtt->msg.data), 0) == -1)
     {
         perror("[Primary Server] Message could not be sent, please try again");
         exit(EXIT_FAILURE);
     }
+    recordStages(dtt->msg.data.stage_ns);
+    traceFlow('f', dtt->msg.data.stage_ns[STAGE_CLIENT_SEND], dtt->msg.data.stage_ns[STAGE_SERVER_DEQUEUE]);
+    traceSpan("request", dtt->msg.data.stage_ns[STAGE_SERVER_DEQUEUE], dtt->msg.data.stage_ns[STAGE_REPLY_SENT], "seq", dtt->msg.data.seq_num,
+              "operation", operation);
 
-    // Detach from the shared memory
-    if (shmdt(shmptr) == -1)
+    // Apply the logged write to the graph file
+    if (wal_offset != -1 && !store_first)
     {
-        perror("[Primary Server] Could not detach from shared memory\n");
-        exit(EXIT_FAILURE);
+        applyLoggedWrite(dtt, filename, wal_segment, wal_offset, payload_bytes);
     }
-    printf("[Primary Server] Successfully Completed Operation 1\n");
+    pendingWriteEnd(dtt->pending);
+    LOG_INFO("[Primary Server] Successfully Completed Operation 1\n");
+
+    STATS_ADD(completed, 1);
+    STATS_ADD(in_flight, -1);
+    STATS_ADD(active_threads, -1);
 
     // Free dtt
-    printf("[Primary Server] Freeing dtt\n");
+    LOG_DEBUG("[Primary Server] Freeing dtt\n");
     free(dtt);
     pthread_exit(NULL);
 }
@@ -181,7 +1408,8 @@ void *writeToNewGraphFile(void *arg)
 int main()
 {
     // Iniitalize the server
-    printf("[Primary Server] Initializing Primary Server...\n");
+    logInit();
+    LOG_INFO("[Primary Server] Initializing Primary Server...\n");
 
     // Create the message queue
     key_t key;
@@ -201,12 +1429,17 @@ int main()
         perror("[Primary Server] Error while connecting with Message Queue");
         exit(EXIT_FAILURE);
     }
-    printf("[Primary Server] Successfully connected to the Message Queue with Key:%d ID:%d\n", key, msg_queue_id);
+    LOG_INFO("[Primary Server] Successfully connected to the Message Queue with Key:%d ID:%d\n", key, msg_queue_id);
+
+    processStats = openStats(STATS_SLOT_PRIMARY, "[Primary Server]");
+    traceInit("primary server");
+    // Numbers the writes in the order they are dequeued, after those already in the log
+    long writeTicket = walRecover();
 
-    // Store the thread_ids
-    pthread_t thread_ids[MAX_THREADS];
-    int threads[200];
+    // Store the thread_ids of every request, grown as requests come in
+    pthread_t *thread_ids = NULL;
     int threadIndex = 0;
+    int threadCapacity = 0;
 
     // Listen to the message queue for new requests from the clients
     while (1)
@@ -218,7 +1451,12 @@ int main()
         }
         else
         {
-            printf("[Primary Server] Received a message from Client %ld: Op: %ld File Name: %s\n", msg.data.seq_num, msg.data.operation, msg.data.graph_name);
+            msg.data.stage_ns[STAGE_SERVER_DEQUEUE] = nowNs();
+            if (msg.data.operation >= 1 && msg.data.operation <= MAX_OPERATION)
+            {
+                STATS_ADD(requests[msg.data.operation], 1);
+            }
+            LOG_INFO("[Primary Server] Received a message from Client %ld: Op: %ld File Name: %s\n", msg.data.seq_num, msg.data.operation, msg.data.graph_name);
 
             if (msg.data.operation == 1 || msg.data.operation == 2)
             {
@@ -226,26 +1464,47 @@ int main()
                 struct data_to_thread *dtt = (struct data_to_thread *)malloc(sizeof(struct data_to_thread));
                 dtt->msg_queue_id = msg_queue_id;
                 dtt->msg = msg;
-                // thread_exists[msg.data.seq_num] = 1;
-                pthread_create(&thread_ids[msg.data.seq_num], NULL, writeToNewGraphFile, (void *)dtt);
-                threads[threadIndex++] = msg.data.seq_num;
+                dtt->ticket = ++writeTicket;
+                dtt->pending = pendingWriteBegin(msg.data.graph_name, dtt->ticket);
+                if (threadIndex == threadCapacity)
+                {
+                    threadCapacity = threadCapacity ? 2 * threadCapacity : MAX_THREADS;
+                    thread_ids = (pthread_t *)realloc(thread_ids, threadCapacity * sizeof(pthread_t));
+                    if (thread_ids == NULL)
+                    {
+                        perror("[Primary Server] Memory allocation failed");
+                        exit(EXIT_FAILURE);
+                    }
+                }
+                STATS_ADD(in_flight, 1);
+                STATS_ADD(active_threads, 1);
+                if (pthread_create(&thread_ids[threadIndex], NULL, writeToNewGraphFile, (void *)dtt) != 0)
+                {
+                    perror("[Primary Server] Error in thread creation");
+                    exit(EXIT_FAILURE);
+                }
+                threadIndex++;
             }
             else if (msg.data.operation == 5)
             {
                 // Operation code for cleanup
                 for (int i = 0; i < threadIndex; i++)
                 {
-                    // printf("Attempting to Clean: %d %lu\n", i, thread_ids[i]);
-                    if (thread_ids[threads[i]] != 0)
+                    if (pthread_join(thread_ids[i], NULL) != 0)
                     {
-                        if (pthread_join(thread_ids[threads[i]], NULL) != 0)
-                        {
-                            perror("[Primary Server] Error joining thread");
-                        }
+                        perror("[Primary Server] Error joining thread");
                     }
                 }
 
-                printf("[Primary Server] Terminating...\n");
+                // Every logged write has been applied by now
+                walCheckpoint();
+                LOG_INFO("[Primary Server] Logged %ld writes with %ld syncs in %ld segments\n", wal.appends, wal.syncs, wal.segments);
+
+                // The histograms go straight to stdout, after everything logged so far
+                logFlush();
+                printStageHistograms("[Primary Server]", stageNames);
+                STATS_SET(pid, 0);
+                LOG_INFO("[Primary Server] Terminating...\n");
                 exit(EXIT_SUCCESS);
             }
         }
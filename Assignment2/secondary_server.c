@@ -20,6 +20,15 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "logger.h"
+#include "trace.h"
+#include "stats.h"
 
 #define MESSAGE_LENGTH 100
 #define LOAD_BALANCER_CHANNEL 4000
@@ -28,16 +37,34 @@
 #define SECONDARY_SERVER_CHANNEL_2 4003
 #define MAX_THREADS 200
 #define MAX_VERTICES 100
-#define MAX_QUEUE_SIZE 100
+#define REPLY_DONE 0
+#define REPLY_BFS_LEVEL 6
+#define REPLY_ERROR 7
+#define INLINE_RESULT_SIZE (MESSAGE_LENGTH / (int)sizeof(int))
+#define MAX_LEVEL_THREADS 16
+#define MAX_DFS_THREADS 64
+#define CSR_MAGIC "GCSR"
+#define PREFETCH_BLOCK 1024
+#define BITS_PER_WORD (8 * (int)sizeof(unsigned long))
+#define MAX_PARSE_THREADS 16
+#define MIN_BYTES_PER_PARSE_THREAD (1 << 20)
 
 /**
  * This structure, struct data, is used to store message data. It includes sequence numbers, operation codes, a graph name, and arrays for storing BFS sequence and its length.
+ * Stage_ns holds the CLOCK_MONOTONIC time in nanoseconds at which the request reached each STAGE_*, 0 for the stages it skips.
+ * Level is the BFS level carried by a REPLY_BFS_LEVEL chunk; it is unused by requests.
+ * Replies carry count vertices. Up to INLINE_RESULT_SIZE of them are stored as ints in graph_name,
+ * longer lists are placed in the shared memory segment result_shm_id (-1 when inline).
  */
 struct data
 {
     long seq_num;
     long operation;
+    long level;
+    long count;
+    int result_shm_id;
     char graph_name[MESSAGE_LENGTH];
+    long stage_ns[NUMBER_OF_STAGES];
 };
 
 /**
@@ -51,28 +78,41 @@ struct msg_buffer
 
 /*
  * Implementation of Queue
+ * Every vertex is enqueued at most once per traversal, so a capacity of the number of nodes is enough
  */
 struct Queue
 {
-    int items[MAX_QUEUE_SIZE];
+    int *items;
+    int capacity;
     int front;
     int rear;
 };
 
 // Function to create an empty queue
-struct Queue *createQueue()
+struct Queue *createQueue(int capacity)
 {
     struct Queue *queue = (struct Queue *)malloc(sizeof(struct Queue));
-    if (queue == NULL)
+    if (queue != NULL)
+    {
+        queue->items = (int *)malloc((capacity > 0 ? capacity : 1) * sizeof(int));
+    }
+    if (queue == NULL || queue->items == NULL)
     {
         fprintf(stderr, "Memory allocation failed. Exiting program.\n");
         exit(EXIT_FAILURE);
     }
+    queue->capacity = capacity;
     queue->front = -1;
     queue->rear = -1;
     return queue;
 }
 
+void freeQueue(struct Queue *q)
+{
+    free(q->items);
+    free(q);
+}
+
 int isEmpty(struct Queue *q)
 {
     return q->front == -1;
@@ -80,14 +120,14 @@ int isEmpty(struct Queue *q)
 
 int isFull(struct Queue *q)
 {
-    return q->rear == MAX_QUEUE_SIZE - 1;
+    return q->rear == q->capacity - 1;
 }
 
 void enqueue(struct Queue *q, int value)
 {
     if (isFull(q))
     {
-        printf("Queue is full. Cannot enqueue.\n");
+        LOG_WARN("Queue is full. Cannot enqueue.\n");
         return;
     }
 
@@ -98,7 +138,28 @@ void enqueue(struct Queue *q, int value)
 
     q->rear++;
     q->items[q->rear] = value;
-    printf("Enqueued: %d\n", value);
+}
+
+// Appends count values at once
+void enqueueMany(struct Queue *q, const int *values, int count)
+{
+    if (count <= 0)
+    {
+        return;
+    }
+    if (q->rear + count > q->capacity - 1)
+    {
+        LOG_WARN("Queue is full. Cannot enqueue.\n");
+        return;
+    }
+
+    if (isEmpty(q))
+    {
+        q->front = 0;
+    }
+
+    memcpy(&q->items[q->rear + 1], values, count * sizeof(int));
+    q->rear += count;
 }
 
 int dequeue(struct Queue *q)
@@ -107,7 +168,7 @@ int dequeue(struct Queue *q)
 
     if (isEmpty(q))
     {
-        printf("Queue is empty. Cannot dequeue.\n");
+        LOG_WARN("Queue is empty. Cannot dequeue.\n");
         return -1;
     }
 
@@ -122,7 +183,6 @@ int dequeue(struct Queue *q)
         q->front++;
     }
 
-    printf("Dequeued: %d\n", value);
     return value;
 }
 
@@ -154,86 +214,951 @@ int queueSize(struct Queue *q)
     }
 }
 
+// Moves every element into values and empties the queue, returns the number of elements
+int dequeueAll(struct Queue *q, int *values)
+{
+    int count = queueSize(q);
+    if (count > 0)
+    {
+        memcpy(values, &q->items[q->front], count * sizeof(int));
+    }
+    q->front = q->rear = -1;
+    return count;
+}
+
+/*
+ * Graph file loader
+ * The graph file is mapped into memory and the cells after the header are split into
+ * byte ranges that are parsed by separate threads. A first pass counts the numbers in
+ * every range so that each thread knows which cell its first number belongs to, and
+ * a second pass parses the numbers straight into the adjacency matrix.
+ */
+struct parse_range
+{
+    const char *begin;
+    const char *end;
+    long first_cell;
+    long cells;
+    int *matrix;
+    long total_cells;
+};
+
+// Matches the signed byte compare used by numberMask
+static int isGraphSpace(char c)
+{
+    return (signed char)c <= ' ';
+}
+
+// Parses one number starting at p and returns the position right after it
+static const char *parseNumber(const char *p, const char *end, int *value)
+{
+    int sign = 1;
+    int result = 0;
+    if (p < end && *p == '-')
+    {
+        sign = -1;
+        p++;
+    }
+    while (p < end && !isGraphSpace(*p))
+    {
+        result = result * 10 + (*p - '0');
+        p++;
+    }
+    *value = sign * result;
+    return p;
+}
+
+#ifdef __SSE2__
+// Bit i is set when byte i of the block is part of a number
+static unsigned int numberMask(const char *p)
+{
+    __m128i block = _mm_loadu_si128((const __m128i *)p);
+    return (unsigned int)_mm_movemask_epi8(_mm_cmpgt_epi8(block, _mm_set1_epi8(' ')));
+}
+#endif
+
+// First pass: count the numbers in the range
+void *countRangeCells(void *arg)
+{
+    struct parse_range *range = (struct parse_range *)arg;
+    const char *p = range->begin;
+    long cells = 0;
+    int previous_in_number = 0;
+
+#ifdef __SSE2__
+    for (; p + 16 <= range->end; p += 16)
+    {
+        unsigned int in_number = numberMask(p);
+        unsigned int starts = in_number & ~((in_number << 1) | previous_in_number);
+        cells += __builtin_popcount(starts);
+        previous_in_number = (in_number >> 15) & 1;
+    }
+#endif
+    for (; p < range->end; p++)
+    {
+        int in_number = !isGraphSpace(*p);
+        if (in_number && !previous_in_number)
+        {
+            cells++;
+        }
+        previous_in_number = in_number;
+    }
+
+    range->cells = cells;
+    return NULL;
+}
+
+// Second pass: parse the numbers of the range into the matrix
+void *parseRangeCells(void *arg)
+{
+    struct parse_range *range = (struct parse_range *)arg;
+    const char *p = range->begin;
+    long cell = range->first_cell;
+    int value;
+
+#ifdef __SSE2__
+    // Adjacency matrices are almost entirely single digit numbers, which can be taken
+    // straight out of the block. Anything longer falls back to parseNumber.
+    while (p + 16 <= range->end && cell < range->total_cells)
+    {
+        unsigned int in_number = numberMask(p);
+        unsigned int starts = in_number & ~(in_number << 1);
+        // Numbers that run into the next block are left for the next iteration
+        unsigned int complete = starts & ~(in_number >> 1) & 0x7FFF;
+        unsigned int long_numbers = starts & (in_number >> 1);
+
+        if (long_numbers == 0)
+        {
+            while (complete != 0 && cell < range->total_cells)
+            {
+                int bit = __builtin_ctz(complete);
+                range->matrix[cell++] = p[bit] - '0';
+                complete &= complete - 1;
+            }
+            // If the last byte starts a number, the next block begins with it
+            p += ((in_number >> 15) & 1) ? 15 : 16;
+        }
+        else
+        {
+            // Consume the single digits before the first long number and parse that one
+            int first_long = __builtin_ctz(long_numbers);
+            complete &= (1u << first_long) - 1;
+            while (complete != 0 && cell < range->total_cells)
+            {
+                int bit = __builtin_ctz(complete);
+                range->matrix[cell++] = p[bit] - '0';
+                complete &= complete - 1;
+            }
+            p = parseNumber(p + first_long, range->end, &value);
+            if (cell < range->total_cells)
+            {
+                range->matrix[cell++] = value;
+            }
+        }
+    }
+#endif
+    while (p < range->end && cell < range->total_cells)
+    {
+        if (isGraphSpace(*p))
+        {
+            p++;
+            continue;
+        }
+        p = parseNumber(p, range->end, &value);
+        range->matrix[cell++] = value;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Parses the numbers between begin and end into cells, splitting the work
+ * between threads. Returns how many numbers were found.
+ *
+ * @param begin must be the start of the text or follow a whitespace character
+ * @param end
+ * @param cells
+ * @param total_cells
+ * @return long
+ */
+long parseCells(const char *begin, const char *end, int *cells, long total_cells)
+{
+    // Split the text into ranges, moving every split forward so no number is cut in two
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    long thread_count = (end - begin) / MIN_BYTES_PER_PARSE_THREAD;
+    if (thread_count > online)
+        thread_count = online;
+    if (thread_count > MAX_PARSE_THREADS)
+        thread_count = MAX_PARSE_THREADS;
+    if (thread_count < 1)
+        thread_count = 1;
+
+    struct parse_range ranges[MAX_PARSE_THREADS];
+    pthread_t parse_threads[MAX_PARSE_THREADS];
+    const char *split = begin;
+    for (int t = 0; t < thread_count; t++)
+    {
+        ranges[t].begin = split;
+        split = (t == thread_count - 1) ? end : begin + (end - begin) * (t + 1) / thread_count;
+        if (split < ranges[t].begin)
+            split = ranges[t].begin;
+        while (split < end && split > begin && !isGraphSpace(split[-1]))
+        {
+            split++;
+        }
+        ranges[t].end = split;
+        ranges[t].matrix = cells;
+        ranges[t].total_cells = total_cells;
+    }
+
+    if (thread_count == 1)
+    {
+        countRangeCells(&ranges[0]);
+    }
+    else
+    {
+        for (int t = 0; t < thread_count; t++)
+            pthread_create(&parse_threads[t], NULL, countRangeCells, &ranges[t]);
+        for (int t = 0; t < thread_count; t++)
+            pthread_join(parse_threads[t], NULL);
+    }
+
+    long first_cell = 0;
+    for (int t = 0; t < thread_count; t++)
+    {
+        ranges[t].first_cell = first_cell;
+        first_cell += ranges[t].cells;
+    }
+
+    if (thread_count == 1)
+    {
+        parseRangeCells(&ranges[0]);
+    }
+    else
+    {
+        for (int t = 0; t < thread_count; t++)
+            pthread_create(&parse_threads[t], NULL, parseRangeCells, &ranges[t]);
+        for (int t = 0; t < thread_count; t++)
+            pthread_join(parse_threads[t], NULL);
+    }
+
+    return first_cell;
+}
+
+/*
+ * Graphs are kept in compressed sparse row form: the neighbours of vertex v are
+ * neighbours[offsets[v]] to neighbours[offsets[v + 1] - 1]. Memory is proportional
+ * to the number of edges, not to the square of the number of nodes.
+ * For binary graph files the offsets and neighbours point straight into the mapped
+ * file (mapping), so graphs bigger than memory are paged in as they are traversed.
+ */
+struct graph
+{
+    int number_of_nodes;
+    long number_of_edges;
+    long *offsets;
+    int *neighbours;
+    void *mapping;
+    size_t mapping_size;
+};
+
+/*
+ * Header of a binary graph file, followed by the n + 1 offsets and the m neighbours.
+ * The primary server writes this format for graph names ending in .csr
+ */
+struct csr_header
+{
+    char magic[4];
+    int version;
+    long number_of_nodes;
+    long number_of_edges;
+    long reserved;
+};
+
+void freeGraph(struct graph *graph)
+{
+    if (graph->mapping != NULL)
+    {
+        munmap(graph->mapping, graph->mapping_size);
+    }
+    else
+    {
+        free(graph->offsets);
+        free(graph->neighbours);
+    }
+    free(graph);
+}
+
+/**
+ * @brief Gives the kernel advice about the pages holding the neighbour lists of count vertices
+ * of a mapped graph: MADV_WILLNEED reads them in ahead of use, MADV_DONTNEED drops them once
+ * they have been used. Neighbouring ranges are merged to keep the number of calls down.
+ *
+ * @param graph
+ * @param vertices
+ * @param count
+ * @param advice
+ */
+void adviseNeighbours(struct graph *graph, const int *vertices, int count, int advice)
+{
+    if (graph->mapping == NULL)
+    {
+        return;
+    }
+    long page_size = sysconf(_SC_PAGESIZE);
+    char *base = (char *)graph->mapping;
+    char *range_begin = NULL;
+    char *range_end = NULL;
+
+    for (int i = 0; i < count; i++)
+    {
+        char *begin = (char *)&graph->neighbours[graph->offsets[vertices[i]]];
+        char *end = (char *)&graph->neighbours[graph->offsets[vertices[i] + 1]];
+        if (begin == end)
+        {
+            continue;
+        }
+        begin = base + ((begin - base) / page_size) * page_size;
+        end = base + ((end - base + page_size - 1) / page_size) * page_size;
+
+        if (range_begin != NULL && begin <= range_end && end >= range_begin)
+        {
+            range_begin = begin < range_begin ? begin : range_begin;
+            range_end = end > range_end ? end : range_end;
+            continue;
+        }
+        if (range_begin != NULL)
+        {
+            madvise(range_begin, range_end - range_begin, advice);
+        }
+        range_begin = begin;
+        range_end = end;
+    }
+    if (range_begin != NULL)
+    {
+        madvise(range_begin, range_end - range_begin, advice);
+    }
+}
+
+// Allocates a graph whose offsets are all zero, neighbours are allocated once the edges are counted
+static struct graph *allocateGraph(int number_of_nodes)
+{
+    struct graph *graph = (struct graph *)malloc(sizeof(struct graph));
+    if (graph != NULL)
+    {
+        graph->number_of_nodes = number_of_nodes;
+        graph->number_of_edges = 0;
+        graph->offsets = (long *)calloc((long)number_of_nodes + 1, sizeof(long));
+        graph->neighbours = NULL;
+        graph->mapping = NULL;
+        graph->mapping_size = 0;
+    }
+    if (graph == NULL || graph->offsets == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed. Exiting program.\n");
+        exit(EXIT_FAILURE);
+    }
+    return graph;
+}
+
+// Turns the per vertex degrees in offsets[1..n] into offsets and allocates the neighbours
+static void allocateNeighbours(struct graph *graph)
+{
+    for (int v = 0; v < graph->number_of_nodes; v++)
+    {
+        graph->offsets[v + 1] += graph->offsets[v];
+    }
+    graph->number_of_edges = graph->offsets[graph->number_of_nodes];
+    graph->neighbours = (int *)malloc((graph->number_of_edges > 0 ? graph->number_of_edges : 1) * sizeof(int));
+    if (graph->neighbours == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed. Exiting program.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Reads a graph file into a compressed sparse row graph.
+ * The file is either the number of nodes followed by all n*n cells, an edge list
+ * written by the primary server as "E n m" followed by m lines of "u v", or a binary
+ * graph file which is used in place through its mapping instead of being read.
+ * Returns NULL if the file cannot be opened or mapped.
+ *
+ * @param filename
+ * @return struct graph*
+ */
+struct graph *loadGraphFile(const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == -1)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = file_stat.st_size;
+    const char *file = NULL;
+    if (size > 0)
+    {
+        file = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (file == MAP_FAILED)
+        {
+            close(fd);
+            return NULL;
+        }
+    }
+    close(fd);
+
+    if (size >= sizeof(struct csr_header) && memcmp(file, CSR_MAGIC, 4) == 0)
+    {
+        const struct csr_header *header = (const struct csr_header *)file;
+        size_t offsets_size = (header->number_of_nodes + 1) * sizeof(long);
+        if (header->number_of_nodes < 0 || header->number_of_nodes > INT_MAX || header->number_of_edges < 0 ||
+            sizeof(struct csr_header) + offsets_size + header->number_of_edges * sizeof(int) > size)
+        {
+            LOG_WARN("[Secondary Server] %s is not a valid binary graph file\n", filename);
+            munmap((void *)file, size);
+            return NULL;
+        }
+
+        // Traversals touch the file in frontier order, pages are requested explicitly with adviseNeighbours
+        madvise((void *)file, size, MADV_RANDOM);
+        struct graph *graph = (struct graph *)malloc(sizeof(struct graph));
+        if (graph == NULL)
+        {
+            fprintf(stderr, "Memory allocation failed. Exiting program.\n");
+            exit(EXIT_FAILURE);
+        }
+        graph->number_of_nodes = (int)header->number_of_nodes;
+        graph->number_of_edges = header->number_of_edges;
+        graph->offsets = (long *)(file + sizeof(struct csr_header));
+        graph->neighbours = (int *)(file + sizeof(struct csr_header) + offsets_size);
+        graph->mapping = (void *)file;
+        graph->mapping_size = size;
+        return graph;
+    }
+    if (size > 0)
+    {
+        madvise((void *)file, size, MADV_SEQUENTIAL);
+    }
+
+    // Header: number of nodes, preceded by E for edge lists
+    const char *p = file;
+    const char *end = file + size;
+    int n = 0;
+    int number_of_edges = -1;
+    while (p < end && isGraphSpace(*p))
+    {
+        p++;
+    }
+    if (p < end && *p == 'E')
+    {
+        p++;
+        while (p < end && isGraphSpace(*p))
+            p++;
+        p = parseNumber(p, end, &n);
+        while (p < end && isGraphSpace(*p))
+            p++;
+        p = parseNumber(p, end, &number_of_edges);
+        if (number_of_edges < 0)
+        {
+            number_of_edges = 0;
+        }
+    }
+    else
+    {
+        p = parseNumber(p, end, &n);
+    }
+    if (n < 0)
+    {
+        n = 0;
+    }
+    struct graph *graph = allocateGraph(n);
+
+    if (number_of_edges >= 0)
+    {
+        // Parse the (u, v) pairs, count the degrees and place every pair in its row
+        long total_numbers = 2 * (long)number_of_edges;
+        int *edges = (int *)malloc((total_numbers > 0 ? total_numbers : 1) * sizeof(int));
+        if (edges == NULL)
+        {
+            fprintf(stderr, "Memory allocation failed. Exiting program.\n");
+            exit(EXIT_FAILURE);
+        }
+        long found = parseCells(p, end, edges, total_numbers);
+        if (found < total_numbers)
+        {
+            LOG_WARN("[Secondary Server] %s has %ld of %d edges, the rest are ignored\n", filename, found / 2, number_of_edges);
+            total_numbers = found - found % 2;
+        }
+        for (long i = 0; i < total_numbers; i += 2)
+        {
+            int u = edges[i] - 1;
+            int v = edges[i + 1] - 1;
+            if (u >= 0 && u < n && v >= 0 && v < n)
+            {
+                graph->offsets[u + 1]++;
+            }
+            else
+            {
+                edges[i] = 0;
+            }
+        }
+        allocateNeighbours(graph);
+        long *next = (long *)malloc(((long)n + 1) * sizeof(long));
+        if (next == NULL)
+        {
+            fprintf(stderr, "Memory allocation failed. Exiting program.\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(next, graph->offsets, ((long)n + 1) * sizeof(long));
+        for (long i = 0; i < total_numbers; i += 2)
+        {
+            if (edges[i] != 0)
+            {
+                graph->neighbours[next[edges[i] - 1]++] = edges[i + 1] - 1;
+            }
+        }
+        free(next);
+        free(edges);
+    }
+    else
+    {
+        // Parse the n*n cells, then keep only the cells that are 1
+        long total_cells = (long)n * n;
+        int *cells = (int *)calloc(total_cells > 0 ? total_cells : 1, sizeof(int));
+        if (cells == NULL)
+        {
+            fprintf(stderr, "Memory allocation failed. Exiting program.\n");
+            exit(EXIT_FAILURE);
+        }
+        long found = parseCells(p, end, cells, total_cells);
+        if (found < total_cells)
+        {
+            LOG_WARN("[Secondary Server] %s has %ld of %ld cells, the rest are taken as 0\n", filename, found, total_cells);
+        }
+        for (long i = 0; i < total_cells; i++)
+        {
+            if (cells[i] == 1)
+            {
+                graph->offsets[i / n + 1]++;
+            }
+        }
+        allocateNeighbours(graph);
+        long edge = 0;
+        for (long i = 0; i < total_cells; i++)
+        {
+            if (cells[i] == 1)
+            {
+                graph->neighbours[edge++] = i % n;
+            }
+        }
+        free(cells);
+    }
+
+    if (size > 0)
+    {
+        munmap((void *)file, size);
+    }
+    return graph;
+}
+
+/*
+ * A growable list of vertices, used for the DFS leaves
+ */
+struct vertex_list
+{
+    int *vertices;
+    long count;
+    long capacity;
+};
+
+void appendVertex(struct vertex_list *list, int vertex)
+{
+    if (list->count == list->capacity)
+    {
+        list->capacity = list->capacity ? 2 * list->capacity : 64;
+        list->vertices = (int *)realloc(list->vertices, list->capacity * sizeof(int));
+        if (list->vertices == NULL)
+        {
+            fprintf(stderr, "Memory allocation failed. Exiting program.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    list->vertices[list->count++] = vertex;
+}
+
+/**
+ * @brief Sends count vertices (numbered from 0) to the client as 1 based vertex numbers.
+ * Lists of up to INLINE_RESULT_SIZE vertices travel inside the message. Longer lists are
+ * copied into a new shared memory segment whose id is sent instead, the client removes it
+ * after reading it. This keeps big results out of the message queue that every request shares.
+ * The reply carries the stage timestamps of the request, stamped with the time it is sent.
+ *
+ * @param msg_queue_id
+ * @param request
+ * @param operation
+ * @param level
+ * @param vertices
+ * @param count
+ */
+void sendResult(int msg_queue_id, struct data *request, long operation, long level, const int *vertices, long count)
+{
+    struct msg_buffer reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.msg_type = request->seq_num;
+    reply.data.seq_num = request->seq_num;
+    reply.data.operation = operation;
+    reply.data.level = level;
+    reply.data.count = count;
+    reply.data.result_shm_id = -1;
+
+    if (count <= INLINE_RESULT_SIZE)
+    {
+        int inline_vertices[INLINE_RESULT_SIZE];
+        for (long i = 0; i < count; i++)
+        {
+            inline_vertices[i] = vertices[i] + 1;
+        }
+        memcpy(reply.data.graph_name, inline_vertices, count * sizeof(int));
+    }
+    else
+    {
+        int shm_id = shmget(IPC_PRIVATE, count * sizeof(int), 0666 | IPC_CREAT);
+        if (shm_id == -1)
+        {
+            perror("[Secondary Server] Error while creating the result shared memory");
+            exit(EXIT_FAILURE);
+        }
+        int *shmptr = (int *)shmat(shm_id, NULL, 0);
+        if (shmptr == (void *)-1)
+        {
+            perror("[Secondary Server] Error while attaching to the result shared memory");
+            exit(EXIT_FAILURE);
+        }
+        for (long i = 0; i < count; i++)
+        {
+            shmptr[i] = vertices[i] + 1;
+        }
+        if (shmdt(shmptr) == -1)
+        {
+            perror("[Secondary Server] Could not detach from the result shared memory");
+        }
+        reply.data.result_shm_id = shm_id;
+    }
+
+    request->stage_ns[STAGE_REPLY_SENT] = nowNs();
+    memcpy(reply.data.stage_ns, request->stage_ns, sizeof(reply.data.stage_ns));
+    if (msgsnd(msg_queue_id, &reply, sizeof(struct data), 0) == -1)
+    {
+        perror("[Secondary Server] Message could not be sent, please try again");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Adds the span of a finished request to the trace, with the end of the arrow that the
+ * load balancer started when it forwarded the request
+ *
+ * @param data
+ */
+void traceRequest(const struct data *data)
+{
+    if (!TRACE_ON)
+    {
+        return;
+    }
+    traceFlow('f', data->stage_ns[STAGE_CLIENT_SEND], data->stage_ns[STAGE_SERVER_DEQUEUE]);
+    traceSpan("request", data->stage_ns[STAGE_SERVER_DEQUEUE], data->stage_ns[STAGE_REPLY_SENT], "seq", data->seq_num, "operation",
+              data->operation);
+}
+
 /**
  * Used to pass data to threads for BFS and dfs processing.
  * It includes a message queue ID and a message buffer.
- * Index is the index at which the next vertex number should be entered into graph_name[]
  * Number of nodes is the number of nodes in the graph.
- * Adjacency matrix is the adjacency matrix of the graph
- * Visited is an array to keep track of visited nodes.
- * Mutexlock to keep track of when we are editing the output i.e. graph_name[]
+ * Graph is the graph in compressed sparse row form
+ * Visited is a bitmap to keep track of visited nodes.
+ * Mutexlock to keep track of when we are editing the output i.e. leaves
  * QueueLock to keep track of when BFS threads are editing the queue
  * Current Vertex to keep track of current vertex
  * BFS Queue is the queue used in BFS
+ * Frontier, first and last give the slice of the current level a BFS thread works on
+ * Leaves collects the DFS leaves and active threads counts the running DFS threads
  */
 struct data_to_thread
 {
     int *msg_queue_id;
     struct msg_buffer *msg;
-    int *index;
     int *number_of_nodes;
-    int **adjacency_matrix;
-    int *visited;
+    struct graph *graph;
+    unsigned long *visited;
     pthread_mutex_t *mutexLock;
     pthread_mutex_t *queueLock;
     int current_vertex;
     struct Queue *bfs_queue;
+    int *frontier;
+    int first;
+    int last;
+    struct vertex_list *leaves;
+    int *active_threads;
 };
 
+// Allocates a visited bitmap with one bit per vertex
+unsigned long *createVisited(int number_of_nodes)
+{
+    unsigned long *visited = (unsigned long *)calloc(number_of_nodes / BITS_PER_WORD + 1, sizeof(unsigned long));
+    if (visited == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed. Exiting program.\n");
+        exit(EXIT_FAILURE);
+    }
+    return visited;
+}
+
+// Marks vertex as visited, returns 1 if this call is the one that did it
+static int claimVertex(unsigned long *visited, int vertex)
+{
+    unsigned long *word = &visited[vertex / BITS_PER_WORD];
+    unsigned long bit = 1UL << (vertex % BITS_PER_WORD);
+    return (__atomic_load_n(word, __ATOMIC_RELAXED) & bit) == 0 && (__atomic_fetch_or(word, bit, __ATOMIC_RELAXED) & bit) == 0;
+}
+
+void *dfs_subthread(void *arg);
+
+/**
+ * @brief Walks the graph depth first from start. Every unvisited neighbour of a vertex starts
+ * a new path which gets its own thread while fewer than MAX_DFS_THREADS are running. Once
+ * that limit is reached the path is followed on the current thread with an explicit stack,
+ * so long paths never need one thread (and one stack) per vertex.
+ * A vertex that finds no unvisited neighbours is a leaf.
+ *
+ * @param dtt
+ * @param start
+ */
+void dfsExplore(struct data_to_thread *dtt, int start)
+{
+    struct graph *graph = dtt->graph;
+
+    struct vertex_list stack = {NULL, 0, 0};
+    pthread_t *dfs_thread_id = NULL;
+    int threadIndex = 0;
+    int threadCapacity = 0;
+
+    // For a mapped graph the neighbour lists of the vertices waiting on the stack are read in
+    // PREFETCH_BLOCK vertices at a time, entries below advised have been asked for already.
+    // Pages are never dropped, other paths and other readers of the mapping still need them.
+    long advised = 0;
+    appendVertex(&stack, start);
+    while (stack.count > 0)
+    {
+        int vertex = stack.vertices[--stack.count];
+        int flag = 0;
+        if (advised > stack.count)
+        {
+            advised = stack.count;
+        }
+
+        for (long e = graph->offsets[vertex]; e < graph->offsets[vertex + 1]; e++)
+        {
+            int next = graph->neighbours[e];
+            if (!claimVertex(dtt->visited, next))
+            {
+                continue;
+            }
+            flag = 1;
+
+            if (__atomic_add_fetch(dtt->active_threads, 1, __ATOMIC_RELAXED) <= MAX_DFS_THREADS)
+            {
+                struct data_to_thread *newdtt = malloc(sizeof(struct data_to_thread));
+                *newdtt = *dtt;
+                newdtt->current_vertex = next;
+
+                if (threadIndex == threadCapacity)
+                {
+                    threadCapacity = threadCapacity ? 2 * threadCapacity : 16;
+                    dfs_thread_id = (pthread_t *)realloc(dfs_thread_id, threadCapacity * sizeof(pthread_t));
+                }
+                long create_start = TRACE_ON ? nowNs() : 0;
+                if (pthread_create(&dfs_thread_id[threadIndex], NULL, dfs_subthread, (void *)newdtt) == 0)
+                {
+                    if (TRACE_ON)
+                        traceSpan("create thread", create_start, nowNs(), "vertex", next, NULL, 0);
+                    threadIndex++;
+                    continue;
+                }
+                free(newdtt);
+            }
+            __atomic_sub_fetch(dtt->active_threads, 1, __ATOMIC_RELAXED);
+            appendVertex(&stack, next);
+        }
+
+        if (stack.count - advised >= PREFETCH_BLOCK)
+        {
+            adviseNeighbours(graph, &stack.vertices[advised], stack.count - advised, MADV_WILLNEED);
+            advised = stack.count;
+        }
+
+        if (flag == 0)
+        {
+            pthread_mutex_lock(dtt->mutexLock);
+            appendVertex(dtt->leaves, vertex);
+            pthread_mutex_unlock(dtt->mutexLock);
+        }
+    }
+
+    // Join all the subthreads
+    long join_start = TRACE_ON ? nowNs() : 0;
+    for (int i = 0; i < threadIndex; i++)
+    {
+        pthread_join(dfs_thread_id[i], NULL);
+    }
+    if (TRACE_ON && threadIndex > 0)
+        traceSpan("join threads", join_start, nowNs(), "threads", threadIndex, NULL, 0);
+    free(dfs_thread_id);
+    free(stack.vertices);
+}
+
 /**
  * @brief Called by the thread on creation. Every child spawns the thread and calls this function for DFA task.
  *
- * @param arg
- * @return void*
+ * @param arg
+ * @return void*
+ */
+void *dfs_subthread(void *arg)
+{
+    struct data_to_thread *dtt = (struct data_to_thread *)arg;
+    STATS_ADD(active_threads, 1);
+    long thread_start = TRACE_ON ? nowNs() : 0;
+
+    dfsExplore(dtt, dtt->current_vertex);
+    if (TRACE_ON)
+        traceSpan("dfs thread", thread_start, nowNs(), "vertex", dtt->current_vertex + 1, NULL, 0);
+
+    __atomic_sub_fetch(dtt->active_threads, 1, __ATOMIC_RELAXED);
+    free(dtt);
+    STATS_ADD(active_threads, -1);
+    pthread_exit(NULL);
+}
+
+/**
+ * @brief Runs the DFS kernel from start over dtt->graph and collects the leaves.
+ * The caller initialises dtt->mutexLock, the visited bitmap lives only for the traversal.
+ *
+ * @param dtt
+ * @param start 0-based starting vertex, a vertex outside the graph gives no leaves
+ * @param leaves
+ */
+void dfsTraverse(struct data_to_thread *dtt, int start, struct vertex_list *leaves)
+{
+    int active_threads = 0;
+    dtt->visited = createVisited(dtt->graph->number_of_nodes);
+    dtt->leaves = leaves;
+    dtt->active_threads = &active_threads;
+
+    if (start >= 0 && start < dtt->graph->number_of_nodes)
+    {
+        claimVertex(dtt->visited, start);
+        dfsExplore(dtt, start);
+    }
+
+    free(dtt->visited);
+    dtt->visited = NULL;
+}
+
+/**
+ * @brief Loads a graph file as one of its readers. The first reader of a graph takes rw_sem and
+ * the last one gives it back, read_sem guards the count of readers in count_<graph>. The
+ * semaphores are released whether or not the graph could be read.
+ *
+ * @param filename
+ * @param request stamped with the lock acquired and graph loaded stages
+ * @return struct graph* NULL when the file cannot be read
+ */
+struct graph *readGraph(const char *filename, struct data *request)
+{
+    // SEMAPHORE PART
+    char sema_name_rw[256];
+    snprintf(sema_name_rw, sizeof(sema_name_rw), "rw_%s", filename);
+    char sema_name_read[256];
+    snprintf(sema_name_read, sizeof(sema_name_read), "read_%s", filename);
+    // Readers are counted per graph, a count shared by all graphs lets a reader skip the lock
+    // of its own file and release the lock of another one
+    char sema_name_count[256];
+    snprintf(sema_name_count, sizeof(sema_name_count), "count_%s", filename);
+
+    // If O_CREAT is specified, and a semaphore with the given name already exists,
+    // then mode and value are ignored.
+    sem_t *rw_sem = sem_open(sema_name_rw, O_CREAT, 0644, 1);
+    sem_t *read_sem = sem_open(sema_name_read, O_CREAT, 0644, 1);
+    sem_t *read_count = sem_open(sema_name_count, O_CREAT, 0644, 0);
+
+    long lock_wait_start = nowNs();
+    LOG_DEBUG("[Secondary Server] Waiting for the semaphore to be available\n");
+    sem_wait(read_sem);
+    sem_post(read_count);
+    int current_readers = 0;
+    sem_getvalue(read_count, &current_readers);
+    if (current_readers == 1)
+        sem_wait(rw_sem);
+    sem_post(read_sem);
+    request->stage_ns[STAGE_LOCK_ACQUIRED] = nowNs();
+    STATS_ADD(lock_waits, 1);
+    STATS_ADD(lock_wait_ns, request->stage_ns[STAGE_LOCK_ACQUIRED] - lock_wait_start);
+    traceSpan("wait read_sem/rw_sem", lock_wait_start, request->stage_ns[STAGE_LOCK_ACQUIRED], "seq", request->seq_num, NULL, 0);
+
+    struct graph *graph = loadGraphFile(filename);
+    if (graph != NULL)
+    {
+        request->stage_ns[STAGE_GRAPH_LOADED] = nowNs();
+        traceSpan("load graph", request->stage_ns[STAGE_LOCK_ACQUIRED], request->stage_ns[STAGE_GRAPH_LOADED], "seq", request->seq_num, "nodes",
+                  graph->number_of_nodes);
+    }
+
+    LOG_DEBUG("[Secondary Server] Releasing the semaphore\n");
+    sem_wait(read_sem);
+    sem_wait(read_count);
+    sem_getvalue(read_count, &current_readers);
+    if (current_readers == 0)
+        sem_post(rw_sem);
+    sem_post(read_sem);
+    return graph;
+}
+
+/**
+ * @brief Answers a request whose graph could not be read with a REPLY_ERROR message and ends
+ * its thread, the server goes on with the other requests
+ *
+ * @param dtt
+ * @param shmptr
  */
-void *dfs_subthread(void *arg)
+void abandonRequest(struct data_to_thread *dtt, int *shmptr)
 {
-    struct data_to_thread *dtt = (struct data_to_thread *)arg;
-
-    int currentVertex = dtt->current_vertex + 1;
-    printf("[Secondary Server] DFS Sub Thread: Current vertex: %d\n", currentVertex);
-
-    int flag = 0;
-    pthread_t dfs_thread_id[*dtt->number_of_nodes];
-    int threads[*dtt->number_of_nodes];
-    int threadIndex = 0;
-
-    for (int i = 0; i < *dtt->number_of_nodes; i++)
+    sendResult(*dtt->msg_queue_id, &dtt->msg->data, REPLY_ERROR, 0, NULL, 0);
+    traceRequest(&dtt->msg->data);
+    if (shmdt(shmptr) == -1)
     {
-        if ((dtt->adjacency_matrix[dtt->current_vertex][i] == 1) && (dtt->visited[i] == 0))
-        {
-            flag = 1;
-            dtt->visited[i] = 1;
-
-            struct data_to_thread *newdtt = malloc(sizeof(struct data_to_thread));
-            *newdtt = *dtt;
-            newdtt->current_vertex = i;
-
-            pthread_create(&dfs_thread_id[i], NULL, dfs_subthread, (void *)newdtt);
-            threads[threadIndex++] = i;
-        }
-        else if ((i == (*dtt->number_of_nodes - 1)) && (flag == 0))
-        {
-            int leaf = dtt->current_vertex + 1;
-            printf("[Secondary Server] DFS Sub Thread: New Leaf: %d\n", leaf);
-            printf("[Secondary Server] DFS Sub Thread: Storing %d at Index: %d\n", leaf, *dtt->index);
-
-            pthread_mutex_lock(dtt->mutexLock);
-            dtt->msg->data.graph_name[*dtt->index] = (char)(leaf);
-            *dtt->index = *dtt->index + 1;
-            dtt->msg->data.graph_name[*dtt->index] = '*';
-            pthread_mutex_unlock(dtt->mutexLock);
-        }
+        perror("[Secondary Server] Could not detach from shared memory\n");
     }
-
-    // Join all the subthreads
-    for (int i = 0; i < threadIndex; i++)
+    pthread_mutex_destroy(dtt->mutexLock);
+    free(dtt->mutexLock);
+    if (dtt->queueLock != NULL)
     {
-        pthread_join(dfs_thread_id[threads[i]], NULL);
+        pthread_mutex_destroy(dtt->queueLock);
+        free(dtt->queueLock);
     }
-
-    // Exit the DFS thread
-    printf("[Secondary Server] DFS Sub Thread: Exiting DFS Thread\n");
+    free(dtt->number_of_nodes);
+    free(dtt->msg_queue_id);
+    free(dtt->msg);
+    free(dtt);
+    STATS_ADD(completed, 1);
+    STATS_ADD(in_flight, -1);
+    STATS_ADD(active_threads, -1);
     pthread_exit(NULL);
 }
 
@@ -248,6 +1173,7 @@ void *dfs_subthread(void *arg)
 void *dfs_mainthread(void *arg)
 {
     struct data_to_thread *dtt = (struct data_to_thread *)arg;
+    STATS_ADD(active_threads, 1);
 
     // Connect to shared memory
     key_t shm_key;
@@ -262,7 +1188,7 @@ void *dfs_mainthread(void *arg)
         perror("[Secondary Server] DFS Main Thread: Error while generating key for shared memory");
         exit(EXIT_FAILURE);
     }
-    printf("[Secondary Server] Generated shared memory key %d\n", shm_key);
+    LOG_DEBUG("[Secondary Server] Generated shared memory key %d\n", shm_key);
 
     // Connect to the shared memory using the key
     if ((shm_id = shmget(shm_key, sizeof(int), 0666)) < 0)
@@ -286,131 +1212,33 @@ void *dfs_mainthread(void *arg)
     // Make sure the filename is null-terminated, and copy it to the 'filename' array
     snprintf(filename, sizeof(filename), "%s", dtt->msg->data.graph_name);
 
-    // SEMAPHORE PART
-    char sema_name_rw[256];
-    snprintf(sema_name_rw, sizeof(sema_name_rw), "rw_%s", filename);
-    char sema_name_read[256];
-    snprintf(sema_name_read, sizeof(sema_name_read), "read_%s", filename);
-
-    // If O_CREAT is specified, and a semaphore with the given name already exists,
-    // then mode and value are ignored.
-    sem_t *rw_sem = sem_open(sema_name_rw, O_CREAT, 0644, 1);
-    sem_t *read_sem = sem_open(sema_name_read, O_CREAT, 0644, 1);
-    sem_t *read_count = sem_open("Assignment_Read_Count", O_CREAT, 0644, 0);
-
-    printf("[Secondary Server] Waiting for the semaphore to be available\n");
-    sem_wait(read_sem);
-    sem_post(read_count);
-    int current_readers = 0;
-    sem_getvalue(read_count, &current_readers);
-    if (current_readers == 1)
-        sem_wait(rw_sem);
-    sem_post(read_sem);
-
-    FILE *fptr = fopen(filename, "r");
-    if (fptr == NULL)
-    {
-        printf("[Seconday Server] DFS Main Thread: Error opening file");
-        exit(EXIT_FAILURE);
-    }
-    else
+    dtt->graph = readGraph(filename, &dtt->msg->data);
+    if (dtt->graph == NULL)
     {
-        printf("[Secondary Server] Successfully opened the file %s\n", filename);
-        fscanf(fptr, "%d", dtt->number_of_nodes);
-
-        // Allocate space for adjacency matrix
-        dtt->adjacency_matrix = (int **)malloc((*dtt->number_of_nodes) * sizeof(int *));
-        for (int i = 0; i < (*dtt->number_of_nodes); i++)
-        {
-            dtt->adjacency_matrix[i] = (int *)malloc((*dtt->number_of_nodes) * sizeof(int));
-        }
-        for (int i = 0; i < (*dtt->number_of_nodes); i++)
-        {
-            for (int j = 0; j < (*dtt->number_of_nodes); j++)
-            {
-                fscanf(fptr, "%d", &(dtt->adjacency_matrix[i][j]));
-            }
-        }
-        fclose(fptr);
+        LOG_ERROR("[Secondary Server] DFS Main Thread: Could not read the graph %s\n", filename);
+        abandonRequest(dtt, shmptr);
     }
+    *dtt->number_of_nodes = dtt->graph->number_of_nodes;
+    LOG_DEBUG("[Secondary Server] Successfully read the file %s\n", filename);
 
-    printf("[Secondary Server] Releasing the semaphore\n");
-    sem_wait(read_sem);
-    sem_wait(read_count);
-    sem_getvalue(read_count, &current_readers);
-    if (current_readers == 0)
-        sem_post(rw_sem);
-    sem_post(read_sem);
-
-    // Allocate space for visited array
-    dtt->visited = (int *)malloc((*dtt->number_of_nodes) * sizeof(int));
-    for (int i = 0; i < *dtt->number_of_nodes; i++)
-    {
-        dtt->visited[i] = 0;
-    }
-    dtt->visited[dtt->current_vertex] = 1;
     int startingNode = dtt->current_vertex + 1;
 
     // Debug logs
-    printf("[Secondary Server] DFS Main Thread: Adjacency Matrix Read Successfully\n");
-    printf("[Secondary Server] DFS Main Thread: Number of nodes: %d\n", *dtt->number_of_nodes);
-    printf("[Secondary Server] DFS Main Thread: Starting vertex: %d\n", startingNode);
-
-    // All the subthreads
-    pthread_t dfs_thread_id[*dtt->number_of_nodes];
-    int threads[*dtt->number_of_nodes];
-    int threadIndex = 0;
-    int currentVertex = dtt->current_vertex;
-
-    // flag variable to check if it's leaf or not
-    int flag = 0;
-    for (int i = 0; i < (*dtt->number_of_nodes); i++)
-    {
-        if ((dtt->adjacency_matrix[currentVertex][i] == 1) && (dtt->visited[i] == 0))
-        {
-            flag = 1;
-            dtt->visited[i] = 1;
-
-            struct data_to_thread *newdtt = malloc(sizeof(struct data_to_thread));
-            *newdtt = *dtt;
-            newdtt->current_vertex = i;
-
-            pthread_create(&dfs_thread_id[i], NULL, dfs_subthread, (void *)newdtt);
-            threads[threadIndex++] = i;
-        }
-        else if ((i == ((*dtt->number_of_nodes) - 1)) && (flag == 0))
-        {
-            int leaf = dtt->current_vertex + 1;
-            printf("[Secondary Server] DFS Main Thread: New Leaf: %d\n", leaf);
-            printf("[Secondary Server] DFS Main Thread: Storing %d at Index: %d\n", leaf, *dtt->index);
-
-            pthread_mutex_lock(dtt->mutexLock);
-            dtt->msg->data.graph_name[*dtt->index] = (char)(leaf);
-            *dtt->index = *dtt->index + 1;
-            dtt->msg->data.graph_name[*dtt->index] = '*';
-            pthread_mutex_unlock(dtt->mutexLock);
-        }
-    }
-
-    // Join all subthreads
-    for (int i = 0; i < threadIndex; i++)
-    {
-        pthread_join(dfs_thread_id[threads[i]], NULL);
-    }
+    LOG_DEBUG("[Secondary Server] DFS Main Thread: Graph Read Successfully\n");
+    LOG_DEBUG("[Secondary Server] DFS Main Thread: Number of nodes: %d\n", *dtt->number_of_nodes);
+    LOG_DEBUG("[Secondary Server] DFS Main Thread: Starting vertex: %d\n", startingNode);
 
-    dtt->msg->data.graph_name[++(*dtt->index)] = '\0';
+    struct vertex_list leaves = {NULL, 0, 0};
+    dfsTraverse(dtt, dtt->current_vertex, &leaves);
+    dtt->msg->data.stage_ns[STAGE_TRAVERSAL_DONE] = nowNs();
+    traceSpan("traversal", dtt->msg->data.stage_ns[STAGE_GRAPH_LOADED], dtt->msg->data.stage_ns[STAGE_TRAVERSAL_DONE], "seq", dtt->msg->data.seq_num,
+              NULL, 0);
 
     // Send the list of Leaf Nodes to the client via message queue
-    dtt->msg->msg_type = dtt->msg->data.seq_num;
-    dtt->msg->data.operation = 0;
-
-    printf("[Secondary Server] DFS Main Thread: Sending reply to the client %ld @ %d\n", dtt->msg->msg_type, *dtt->msg_queue_id);
-
-    if (msgsnd(*dtt->msg_queue_id, dtt->msg, sizeof(struct data), 0) == -1)
-    {
-        perror("[Secondary Server] DFS Main Thread: Message could not be sent, please try again");
-        exit(EXIT_FAILURE);
-    }
+    LOG_DEBUG("[Secondary Server] DFS Main Thread: Sending %ld leaves to the client %ld @ %d\n", leaves.count, dtt->msg->data.seq_num, *dtt->msg_queue_id);
+    sendResult(*dtt->msg_queue_id, &dtt->msg->data, REPLY_DONE, 0, leaves.vertices, leaves.count);
+    recordStages(dtt->msg->data.stage_ns);
+    traceRequest(&dtt->msg->data);
 
     // Detach from the shared memory
     if (shmdt(shmptr) == -1)
@@ -419,23 +1247,33 @@ void *dfs_mainthread(void *arg)
         exit(EXIT_FAILURE);
     }
 
-    printf("[Secondary Server] DFS Main Thread: Freeing dtt\n");
-    free(dtt);
-
     // Destroy mutexLock
     if (pthread_mutex_destroy(dtt->mutexLock) != 0)
     {
-        printf("[Secondary Server] BFS Main Thread: Error destroying mutexLock");
+        LOG_ERROR("[Secondary Server] DFS Main Thread: Error destroying mutexLock\n");
     }
 
+    LOG_DEBUG("[Secondary Server] DFS Main Thread: Freeing dtt\n");
+    free(leaves.vertices);
+    freeGraph(dtt->graph);
+    free(dtt->mutexLock);
+    free(dtt->number_of_nodes);
+    free(dtt->msg_queue_id);
+    free(dtt->msg);
+    free(dtt);
+
     // Exit the DFS thread
-    printf("[Secondary Server] DFS Main Thread: Exiting DFS Request\n");
-    printf("[Secondary Server] Successfully Completed Operation 3\n");
+    LOG_DEBUG("[Secondary Server] DFS Main Thread: Exiting DFS Request\n");
+    LOG_INFO("[Secondary Server] Successfully Completed Operation 3\n");
+    STATS_ADD(completed, 1);
+    STATS_ADD(in_flight, -1);
+    STATS_ADD(active_threads, -1);
     pthread_exit(NULL);
 }
 
 /**
- * @brief Called by the thread on creation. Every child spawns the thread and calls this function for BFS task.
+ * @brief Called by the thread on creation. Every BFS thread expands its slice of the current level
+ * and puts the unvisited neighbours into the queue for the next level.
  *
  * @param arg
  * @return void*
@@ -443,36 +1281,151 @@ void *dfs_mainthread(void *arg)
 void *bfs_subthread(void *arg)
 {
     struct data_to_thread *dtt = (struct data_to_thread *)arg;
+    STATS_ADD(active_threads, 1);
+    struct graph *graph = dtt->graph;
+
+    // Vertices are marked visited when they are claimed so that two nodes of the
+    // same level cannot both push a shared neighbour into the next level.
+    // Claimed vertices are collected locally and the queue lock is taken once.
+    // The slice is walked in blocks. For a mapped graph the next block's neighbour lists are
+    // read in while this block is expanded, and the pages of finished blocks are dropped.
+    struct vertex_list claimed = {NULL, 0, 0};
+    int first_block_size = dtt->last - dtt->first < PREFETCH_BLOCK ? dtt->last - dtt->first : PREFETCH_BLOCK;
+    adviseNeighbours(graph, &dtt->frontier[dtt->first], first_block_size, MADV_WILLNEED);
+    for (int block = dtt->first; block < dtt->last; block += PREFETCH_BLOCK)
+    {
+        int block_end = block + PREFETCH_BLOCK < dtt->last ? block + PREFETCH_BLOCK : dtt->last;
+        if (block_end < dtt->last)
+        {
+            int next_block_end = block_end + PREFETCH_BLOCK < dtt->last ? block_end + PREFETCH_BLOCK : dtt->last;
+            adviseNeighbours(graph, &dtt->frontier[block_end], next_block_end - block_end, MADV_WILLNEED);
+        }
+
+        for (int k = block; k < block_end; k++)
+        {
+            int vertex = dtt->frontier[k];
+            for (long e = graph->offsets[vertex]; e < graph->offsets[vertex + 1]; e++)
+            {
+                int next = graph->neighbours[e];
+                if (claimVertex(dtt->visited, next))
+                {
+                    appendVertex(&claimed, next);
+                }
+            }
+        }
+
+        adviseNeighbours(graph, &dtt->frontier[block], block_end - block, MADV_DONTNEED);
+    }
+
+    pthread_mutex_lock(dtt->queueLock);
+    enqueueMany(dtt->bfs_queue, claimed.vertices, claimed.count);
+    pthread_mutex_unlock(dtt->queueLock);
+
+    free(claimed.vertices);
+    free(dtt);
+    STATS_ADD(active_threads, -1);
+    pthread_exit(NULL);
+}
+
+/**
+ * @brief Runs the BFS kernel from start over dtt->graph. When dtt->msg is set every level is
+ * streamed to the client as soon as it is known. The caller initialises dtt->queueLock, the
+ * visited bitmap, the queue and the frontier live only for the traversal.
+ *
+ * @param dtt
+ * @param start 0-based starting vertex, a vertex outside the graph gives no levels
+ * @param reached if not NULL, receives the number of vertices reached
+ * @return long the number of levels
+ */
+long bfsTraverse(struct data_to_thread *dtt, int start, long *reached)
+{
+    int number_of_nodes = dtt->graph->number_of_nodes;
+    dtt->visited = createVisited(number_of_nodes);
+    dtt->bfs_queue = createQueue(number_of_nodes);
+    dtt->frontier = (int *)malloc((number_of_nodes > 0 ? number_of_nodes : 1) * sizeof(int));
+    if (dtt->frontier == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed. Exiting program.\n");
+        exit(EXIT_FAILURE);
+    }
 
-    //  Lock
-    pthread_mutex_lock(dtt->mutexLock);
-    int node = dtt->current_vertex + 1;
-    dtt->msg->data.graph_name[*dtt->index] = (char)node;
-    *dtt->index = *dtt->index + 1;
-    dtt->msg->data.graph_name[*dtt->index] = '*';
+    // push starting vertex into queue
+    if (start >= 0 && start < number_of_nodes)
+    {
+        claimVertex(dtt->visited, start);
+        enqueue((dtt->bfs_queue), start);
+    }
 
-    // Unlock
-    pthread_mutex_unlock(dtt->mutexLock);
-    dtt->visited[dtt->current_vertex] = 1;
+    // Every level is streamed to the client as its own chunk as soon as it is known,
+    // so the client sees the first level without waiting for the whole traversal
+    long level = 0;
+    long vertices = 0;
 
-    // Loop
-    for (int i = 0; i < *dtt->number_of_nodes; i++)
+    while (!isEmpty((dtt->bfs_queue)))
     {
-        if ((dtt->adjacency_matrix[dtt->current_vertex][i] == 1) && (dtt->visited[i] == 0))
+        // Move the level out of the queue, the threads fill the queue with the next one
+        int queue_size = dequeueAll(dtt->bfs_queue, dtt->frontier);
+        long level_start = TRACE_ON ? nowNs() : 0;
+        vertices += queue_size;
+        if (dtt->msg != NULL)
+        {
+            LOG_DEBUG("[Secondary Server] BFS Main Thread: Sending level %ld of %d vertices to the client %ld\n", level, queue_size, dtt->msg->data.seq_num);
+            sendResult(*dtt->msg_queue_id, &dtt->msg->data, REPLY_BFS_LEVEL, level, dtt->frontier, queue_size);
+        }
+        level++;
+
+        // The level is split into at most MAX_LEVEL_THREADS slices, one thread per slice
+        int thread_count = queue_size < MAX_LEVEL_THREADS ? queue_size : MAX_LEVEL_THREADS;
+        pthread_t subthread_ids[MAX_LEVEL_THREADS];
+        int threadIndex = 0;
+
+        long create_start = TRACE_ON ? nowNs() : 0;
+        for (int i = 0; i < thread_count; i++)
+        {
+            struct data_to_thread *newdtt = malloc(sizeof(struct data_to_thread));
+            *newdtt = *dtt;
+            newdtt->first = (int)((long)queue_size * i / thread_count);
+            newdtt->last = (int)((long)queue_size * (i + 1) / thread_count);
+            if (pthread_create(&subthread_ids[threadIndex], NULL, bfs_subthread, (void *)newdtt) != 0)
+            {
+                perror("[Secondary Server] BFS Main Thread: Error in BFS thread creation");
+                exit(EXIT_FAILURE);
+            }
+            threadIndex++;
+        }
+
+        // Join all the subthreads
+        long join_start = TRACE_ON ? nowNs() : 0;
+        for (int i = 0; i < threadIndex; i++)
         {
-            pthread_mutex_lock(dtt->queueLock);
-            enqueue((dtt->bfs_queue), i);
-            pthread_mutex_unlock(dtt->queueLock);
+            pthread_join(subthread_ids[i], NULL);
+        }
+
+        if (TRACE_ON)
+        {
+            long level_end = nowNs();
+            traceSpan("create threads", create_start, join_start, "threads", threadIndex, NULL, 0);
+            traceSpan("join threads", join_start, level_end, "threads", threadIndex, NULL, 0);
+            traceSpan("bfs level", level_start, level_end, "level", level - 1, "vertices", queue_size);
         }
     }
 
-    // Exit
-    printf("[Secondary Server] BFS Sub Thread: Exiting...");
-    pthread_exit(NULL);
+    freeQueue(dtt->bfs_queue);
+    free(dtt->frontier);
+    free(dtt->visited);
+    dtt->bfs_queue = NULL;
+    dtt->frontier = NULL;
+    dtt->visited = NULL;
+
+    if (reached != NULL)
+    {
+        *reached = vertices;
+    }
+    return level;
 }
 
 /**
- * @brief Called by the main thread of secondary server for BFS task. Uses the starting vertex from the shared memory and performs dfs.
+ * @brief Called by the main thread of secondary server for BFS task. Uses the starting vertex from the shared memory and performs bfs.
  *
  * @param arg
  * @return void*
@@ -480,6 +1433,7 @@ void *bfs_subthread(void *arg)
 void *bfs_mainthread(void *arg)
 {
     struct data_to_thread *dtt = (struct data_to_thread *)arg;
+    STATS_ADD(active_threads, 1);
 
     // Connect to shared memory
     key_t shm_key;
@@ -494,7 +1448,7 @@ void *bfs_mainthread(void *arg)
         perror("[Secondary Server] BFS Main Thread: Error while generating key for shared memory");
         exit(EXIT_FAILURE);
     }
-    printf("[Secondary Server] BFS Main Thread: Generated shared memory key %d\n", shm_key);
+    LOG_DEBUG("[Secondary Server] BFS Main Thread: Generated shared memory key %d\n", shm_key);
 
     // Connect to the shared memory using the key
     if ((shm_id = shmget(shm_key, sizeof(int), 0666)) < 0)
@@ -513,124 +1467,33 @@ void *bfs_mainthread(void *arg)
     char filename[250];
     // Make sure the filename is null-terminated, and copy it to the 'filename' array
     snprintf(filename, sizeof(filename), "%s", dtt->msg->data.graph_name);
-    // SEMAPHORE PART
-    char sema_name_rw[256];
-    snprintf(sema_name_rw, sizeof(sema_name_rw), "rw_%s", filename);
-    char sema_name_read[256];
-    snprintf(sema_name_read, sizeof(sema_name_read), "read_%s", filename);
-
-    // If O_CREAT is specified, and a semaphore with the given name already exists,
-    // then mode and value are ignored.
-    sem_t *rw_sem = sem_open(sema_name_rw, O_CREAT, 0644, 1);
-    sem_t *read_sem = sem_open(sema_name_read, O_CREAT, 0644, 1);
-    sem_t *read_count = sem_open("Assignment_Read_Count", O_CREAT, 0644, 200);
-
-    printf("[Secondary Server] Waiting for the semaphore to be available\n");
-    sem_wait(read_sem);
-    int current_readers = 0;
-    sem_post(read_count);
-    sem_getvalue(read_count, &current_readers);
-    if (current_readers == 1)
-        sem_wait(rw_sem);
-    sem_post(read_sem);
-
-    // Opening the Graph file to read the read the adjacency matrix
-    FILE *fptr = fopen(dtt->msg->data.graph_name, "r");
-    if (fptr == NULL)
-    {
-        printf("[Seconday Server] BFS Main Thread: Error opening file");
-        exit(EXIT_FAILURE);
-    }
-    fscanf(fptr, "%d", dtt->number_of_nodes);
-
-    // Allocate space for adjacency matrix
-    dtt->adjacency_matrix = (int **)malloc((*dtt->number_of_nodes) * sizeof(int *));
-    for (int i = 0; i < (*dtt->number_of_nodes); i++)
-    {
-        dtt->adjacency_matrix[i] = (int *)malloc((*dtt->number_of_nodes) * sizeof(int));
-    }
-    for (int i = 0; i < (*dtt->number_of_nodes); i++)
-    {
-        for (int j = 0; j < (*dtt->number_of_nodes); j++)
-        {
-            fscanf(fptr, "%d", &(dtt->adjacency_matrix[i][j]));
-        }
-    }
-    fclose(fptr);
-
-    printf("[Secondary Server] Releasing the semaphore\n");
-
-    sem_wait(read_sem);
-    sem_wait(read_count);
-    sem_getvalue(read_count, &current_readers);
-    if (current_readers == 0)
-        sem_post(rw_sem);
-    sem_post(read_sem);
-
-    dtt->visited = (int *)malloc(*dtt->number_of_nodes * sizeof(int));
-    for (int i = 0; i < *dtt->number_of_nodes; i++)
+    // Reading the Graph file
+    dtt->graph = readGraph(filename, &dtt->msg->data);
+    if (dtt->graph == NULL)
     {
-        dtt->visited[i] = 0;
+        LOG_ERROR("[Secondary Server] BFS Main Thread: Could not read the graph %s\n", filename);
+        abandonRequest(dtt, shmptr);
     }
+    *dtt->number_of_nodes = dtt->graph->number_of_nodes;
 
     int starting_vertex = dtt->current_vertex + 1;
-    dtt->visited[dtt->current_vertex] = 1;
 
     // Debugging
-    printf("[Secondary Server] BFS Main Thread: Adjacency Matrix Read Successfully\n");
-    printf("[Secondary Server] BFS Main Thread: Number of nodes: %d\n", *dtt->number_of_nodes);
-    printf("[Secondary Server] BFS Main Thread: Starting vertex: %d\n", starting_vertex);
-
-    // push starting vertex into queue
-    enqueue((dtt->bfs_queue), dtt->current_vertex);
-    // printf("Entry in queue is: %d", starting_vertex);
-
-    while (!isEmpty((dtt->bfs_queue)))
-    {
-        int entry = 0;
-        int queue_size = queueSize((dtt->bfs_queue));
-        printf("Queue size: %d\n", queue_size);
-        int array[queue_size];
-
-        // Copy entries into array, empty queue
-        while (!isEmpty(dtt->bfs_queue))
-        {
-            array[entry++] = dequeue((dtt->bfs_queue));
-        }
-
-        pthread_t subthread_ids[queue_size];
-        int threads[queue_size];
-        int threadIndex = 0;
-
-        for (int i = 0; i < queue_size; i++)
-        {
-            struct data_to_thread *newdtt = malloc(sizeof(struct data_to_thread));
-            *newdtt = *dtt;
-            newdtt->current_vertex = array[i];
-            pthread_create(&subthread_ids[i], NULL, bfs_subthread, (void *)newdtt);
-            threads[threadIndex++] = i;
-        }
+    LOG_DEBUG("[Secondary Server] BFS Main Thread: Graph Read Successfully\n");
+    LOG_DEBUG("[Secondary Server] BFS Main Thread: Number of nodes: %d\n", *dtt->number_of_nodes);
+    LOG_DEBUG("[Secondary Server] BFS Main Thread: Starting vertex: %d\n", starting_vertex);
 
-        // Join all the subthreads
-        for (int i = 0; i < threadIndex; i++)
-        {
-            pthread_join(subthread_ids[threads[i]], NULL);
-        }
-    }
-
-    dtt->msg->data.graph_name[++(*dtt->index)] = '\0';
+    long level = bfsTraverse(dtt, dtt->current_vertex, NULL);
 
-    // Sending shit to client
-    dtt->msg->msg_type = dtt->msg->data.seq_num;
-    dtt->msg->data.operation = 0;
+    dtt->msg->data.stage_ns[STAGE_TRAVERSAL_DONE] = nowNs();
+    traceSpan("traversal", dtt->msg->data.stage_ns[STAGE_GRAPH_LOADED], dtt->msg->data.stage_ns[STAGE_TRAVERSAL_DONE], "seq", dtt->msg->data.seq_num,
+              NULL, 0);
 
-    printf("[Secondary Server] BFS Main Thread: Sending reply to the client %ld @ %d\n", dtt->msg->msg_type, *dtt->msg_queue_id);
-
-    if (msgsnd(*dtt->msg_queue_id, dtt->msg, sizeof(struct data), 0) == -1)
-    {
-        perror("[Secondary Server] BFS Main Thread: Message could not be sent, please try again");
-        exit(EXIT_FAILURE);
-    }
+    // The final message carries no vertices and tells the client the traversal is over
+    LOG_DEBUG("[Secondary Server] BFS Main Thread: Sending reply to the client %ld @ %d\n", dtt->msg->data.seq_num, *dtt->msg_queue_id);
+    sendResult(*dtt->msg_queue_id, &dtt->msg->data, REPLY_DONE, level, NULL, 0);
+    recordStages(dtt->msg->data.stage_ns);
+    traceRequest(&dtt->msg->data);
 
     // Detach from the shared memory
     if (shmdt(shmptr) == -1)
@@ -639,32 +1502,47 @@ void *bfs_mainthread(void *arg)
         exit(EXIT_FAILURE);
     }
 
-    // Free the structs
-    printf("[Secondary Server] BFS Main Thread: Freeing dtt\n");
-    free(dtt);
-
     // Destroy mutexLock
     if (pthread_mutex_destroy(dtt->mutexLock) != 0)
     {
-        printf("[Secondary Server] BFS Main Thread: Error destroying mutexLock");
+        LOG_ERROR("[Secondary Server] BFS Main Thread: Error destroying mutexLock\n");
     }
 
     // Destroy queueLock
     if (pthread_mutex_destroy(dtt->queueLock) != 0)
     {
-        printf("[Secondary Server] BFS Main Thread: Error destroying queueLock");
+        LOG_ERROR("[Secondary Server] BFS Main Thread: Error destroying queueLock\n");
     }
 
+    // Free the structs
+    LOG_DEBUG("[Secondary Server] BFS Main Thread: Freeing dtt\n");
+    freeGraph(dtt->graph);
+    free(dtt->mutexLock);
+    free(dtt->queueLock);
+    free(dtt->number_of_nodes);
+    free(dtt->msg_queue_id);
+    free(dtt->msg);
+    free(dtt);
+
     // Exit the BFS thread
-    printf("[Secondary Server] BFS Main Thread: Exiting...\n");
-    printf("[Secondary Server] Successfully Completed Operation 4\n");
+    LOG_DEBUG("[Secondary Server] BFS Main Thread: Exiting...\n");
+    LOG_INFO("[Secondary Server] Successfully Completed Operation 4\n");
+    STATS_ADD(completed, 1);
+    STATS_ADD(in_flight, -1);
+    STATS_ADD(active_threads, -1);
     pthread_exit(NULL);
 }
 
+#ifndef SECONDARY_SERVER_NO_MAIN
+// Labels of the stage histograms printed on exit
+static const char *stageNames[NUMBER_OF_STAGES] = {"client send", "lb receive", "lb forward", "server dequeue",
+                                                   "lock acquired", "graph loaded", "traversal done", "reply sent"};
+
 int main()
 {
     // Initialize the server
-    printf("[Secondary Server] Initializing Secondary Server...\n");
+    logInit();
+    LOG_INFO("[Secondary Server] Initializing Secondary Server...\n");
 
     // Create the message queue
     key_t key;
@@ -683,12 +1561,12 @@ int main()
         perror("[Secondary Server] Error while connecting with Message Queue");
         exit(EXIT_FAILURE);
     }
-    printf("[Secondary Server] Successfully connected to the Message Queue with Key:%d ID:%d\n", key, msg_queue_id);
+    LOG_INFO("[Secondary Server] Successfully connected to the Message Queue with Key:%d ID:%d\n", key, msg_queue_id);
 
-    // Store the thread_ids thread
-    pthread_t thread_ids[200];
-    int threads[200];
+    // Store the thread_ids of every request, grown as requests come in
+    pthread_t *thread_ids = NULL;
     int threadIndex = 0;
+    int threadCapacity = 0;
 
     int channel;
     printf("[Secondary Server] Enter the channel number: ");
@@ -702,11 +1580,12 @@ int main()
         channel = SECONDARY_SERVER_CHANNEL_2;
     }
 
-    printf("[Secondary Server] Using Channel: %d\n", channel);
+    LOG_INFO("[Secondary Server] Using Channel: %d\n", channel);
+    processStats = openStats(channel == SECONDARY_SERVER_CHANNEL_1 ? STATS_SLOT_SECONDARY_1 : STATS_SLOT_SECONDARY_2, "[Secondary Server]");
+    traceInit(channel == SECONDARY_SERVER_CHANNEL_1 ? "secondary server 1" : "secondary server 2");
     // Listen to the message queue for new requests from the clients
     while (1)
     {
-        struct data_to_thread *dtt = (struct data_to_thread *)malloc(sizeof(struct data_to_thread)); // Declare dtt here
         struct msg_buffer *msg = (struct msg_buffer *)malloc(sizeof(struct msg_buffer));
 
         if (msgrcv(msg_queue_id, msg, sizeof(msg->data), channel, 0) == -1)
@@ -716,58 +1595,20 @@ int main()
         }
         else
         {
-            printf("[Secondary Server] Received a message from Client: Op: %ld File Name: %s\n", msg->data.operation, msg->data.graph_name);
+            msg->data.stage_ns[STAGE_SERVER_DEQUEUE] = nowNs();
+            if (msg->data.operation >= 1 && msg->data.operation <= MAX_OPERATION)
+            {
+                STATS_ADD(requests[msg->data.operation], 1);
+            }
+            LOG_INFO("[Secondary Server] Received a message from Client: Op: %ld File Name: %s\n", msg->data.operation, msg->data.graph_name);
 
-            if (msg->data.operation == 3)
+            if (msg->data.operation == 3 || msg->data.operation == 4)
             {
-                // Operation code for DFS request
                 // Create a data_to_thread structure
+                struct data_to_thread *dtt = (struct data_to_thread *)calloc(1, sizeof(struct data_to_thread));
                 dtt->msg_queue_id = (int *)malloc(sizeof(int));
-                dtt->msg = (struct msg_buffer *)malloc(sizeof(struct msg_buffer));
-                dtt->index = (int *)malloc(sizeof(int));
-                *dtt->index = 0;
-                dtt->number_of_nodes = (int *)malloc(sizeof(int));
-
-                dtt->mutexLock = (pthread_mutex_t *)malloc(sizeof(pthread_mutex_t));
-                if (pthread_mutex_init(dtt->mutexLock, NULL) != 0)
-                {
-                    perror("[Secondary Server] Error initializing mutexLock");
-                    exit(EXIT_FAILURE);
-                }
-
                 *dtt->msg_queue_id = msg_queue_id;
                 dtt->msg = msg;
-
-                // Determine the channel based on seq_num
-                int channel;
-                if (msg->data.seq_num % 2 == 1)
-                {
-                    channel = SECONDARY_SERVER_CHANNEL_1;
-                }
-                else
-                {
-                    channel = SECONDARY_SERVER_CHANNEL_2;
-                }
-
-                // Set the channel in the message structure
-                dtt->msg->msg_type = channel;
-
-                // Create a new thread to handle BFS
-                if (pthread_create(&thread_ids[msg->data.seq_num], NULL, dfs_mainthread, (void *)dtt) != 0)
-                {
-                    perror("[Secondary Server] Error in DFS thread creation");
-                    exit(EXIT_FAILURE);
-                }
-                threads[threadIndex++] = msg->data.seq_num;
-            }
-            else if (msg->data.operation == 4)
-            {
-                // Operation code for BFS request
-                // Create a data_to_thread structure
-                dtt->msg_queue_id = (int *)malloc(sizeof(int));
-                dtt->msg = (struct msg_buffer *)malloc(sizeof(struct msg_buffer));
-                dtt->index = (int *)malloc(sizeof(int));
-                *dtt->index = 0;
                 dtt->number_of_nodes = (int *)malloc(sizeof(int));
 
                 dtt->mutexLock = (pthread_mutex_t *)malloc(sizeof(pthread_mutex_t));
@@ -777,60 +1618,61 @@ int main()
                     exit(EXIT_FAILURE);
                 }
 
-                dtt->queueLock = (pthread_mutex_t *)malloc(sizeof(pthread_mutex_t));
-                if (pthread_mutex_init(dtt->queueLock, NULL) != 0)
+                if (msg->data.operation == 4)
                 {
-                    perror("[Secondary Server] Error initializing queueLock");
-                    exit(EXIT_FAILURE);
+                    dtt->queueLock = (pthread_mutex_t *)malloc(sizeof(pthread_mutex_t));
+                    if (pthread_mutex_init(dtt->queueLock, NULL) != 0)
+                    {
+                        perror("[Secondary Server] Error initializing queueLock");
+                        exit(EXIT_FAILURE);
+                    }
                 }
 
-                dtt->bfs_queue = createQueue();
-
-                *dtt->msg_queue_id = msg_queue_id;
-                dtt->msg = msg;
-
-                // Determine the channel based on seq_num
-                int channel;
-                if (msg->data.seq_num % 2 == 1)
-                {
-                    channel = SECONDARY_SERVER_CHANNEL_1;
-                }
-                else
+                if (threadIndex == threadCapacity)
                 {
-                    channel = SECONDARY_SERVER_CHANNEL_2;
+                    threadCapacity = threadCapacity ? 2 * threadCapacity : MAX_THREADS;
+                    thread_ids = (pthread_t *)realloc(thread_ids, threadCapacity * sizeof(pthread_t));
+                    if (thread_ids == NULL)
+                    {
+                        fprintf(stderr, "Memory allocation failed. Exiting program.\n");
+                        exit(EXIT_FAILURE);
+                    }
                 }
 
-                // Set the channel in the message structure
-                dtt->msg->msg_type = channel;
-
-                // Create a new thread to handle BFS
-                if (pthread_create(&thread_ids[msg->data.seq_num], NULL, bfs_mainthread, (void *)dtt) != 0)
+                // Create a new thread to handle DFS (operation 3) or BFS (operation 4)
+                STATS_ADD(in_flight, 1);
+                if (pthread_create(&thread_ids[threadIndex], NULL, msg->data.operation == 3 ? dfs_mainthread : bfs_mainthread, (void *)dtt) != 0)
                 {
-                    perror("[Secondary Server] Error in BFS thread creation");
+                    perror("[Secondary Server] Error in thread creation");
                     exit(EXIT_FAILURE);
                 }
-                threads[threadIndex++] = msg->data.seq_num;
+                threadIndex++;
             }
             else if (msg->data.operation == 5)
             {
                 // Operation code for cleanup
                 for (int i = 0; i < threadIndex; i++)
                 {
-                    // printf("Attempting to Clean: %d %lu\n", i, thread_ids[i]);
-                    if (thread_ids[threads[i]] != 0)
+                    if (pthread_join(thread_ids[i], NULL) != 0)
                     {
-                        if (pthread_join(thread_ids[threads[i]], NULL) != 0)
-                        {
-                            perror("[Secondary Server] Error joining thread");
-                        }
+                        perror("[Secondary Server] Error joining thread");
                     }
                 }
 
-                printf("[Secondary Server] Terminating...\n");
+                // The histograms go straight to stdout, after everything logged so far
+                logFlush();
+                printStageHistograms("[Secondary Server]", stageNames);
+                STATS_SET(pid, 0);
+                LOG_INFO("[Secondary Server] Terminating...\n");
                 exit(EXIT_SUCCESS);
             }
+            else
+            {
+                free(msg);
+            }
         }
     }
 
     return 0;
 }
+#endif
@@ -0,0 +1,229 @@
+/**
+ * @file stats.h
+ * @author Divyateja Pasupuleti
+ * @brief
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2023
+ * POSIX-compliant C header stats.h
+ *
+ * Request statistics shared by the load balancer, the primary server and the secondary servers.
+ *
+ * Every process publishes counters and gauges in its own slot of the named shared memory region
+ * STATS_SHM_NAME, which graphstat maps read-only. The servers keep running without statistics
+ * if the region cannot be opened, STATS_ADD and STATS_SET then do nothing.
+ *
+ * Every request carries stage_ns, the CLOCK_MONOTONIC time in nanoseconds at which it reached
+ * each STAGE_*, 0 for the stages it skips. A server adds the intervals between the stages of
+ * every finished request to log2 histograms and prints them when it exits.
+ *
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NUMBER_OF_STAGES 8
+#define STAGE_CLIENT_SEND 0
+#define STAGE_LB_RECEIVE 1
+#define STAGE_LB_FORWARD 2
+#define STAGE_SERVER_DEQUEUE 3
+#define STAGE_LOCK_ACQUIRED 4
+#define STAGE_GRAPH_LOADED 5
+#define STAGE_TRAVERSAL_DONE 6
+#define STAGE_REPLY_SENT 7
+#define HISTOGRAM_BUCKETS 64
+#define STATS_SHM_NAME "/graph_database_stats"
+#define STATS_SLOTS 4
+#define STATS_SLOT_LOAD_BALANCER 0
+#define STATS_SLOT_PRIMARY 1
+#define STATS_SLOT_SECONDARY_1 2
+#define STATS_SLOT_SECONDARY_2 3
+#define MAX_OPERATION 5
+
+#define STATS_ADD(field, value)                                                     \
+    do                                                                              \
+    {                                                                               \
+        if (processStats != NULL)                                                   \
+            __atomic_fetch_add(&processStats->field, (value), __ATOMIC_RELAXED);    \
+    } while (0)
+
+#define STATS_SET(field, value)                                                     \
+    do                                                                              \
+    {                                                                               \
+        if (processStats != NULL)                                                   \
+            __atomic_store_n(&processStats->field, (value), __ATOMIC_RELAXED);      \
+    } while (0)
+
+/**
+ * Counters and gauges a process publishes in its slot of the stats region. Requests are counted
+ * by operation, the queue fields are copied from msgctl(IPC_STAT) by the load balancer after every
+ * message. Active threads and lock waits are those of the servers' request threads, coalesced
+ * writes are the writes the primary answered without storing because a newer one replaced them.
+ */
+struct process_stats
+{
+    long pid;
+    long started_ns;
+    long requests[MAX_OPERATION + 1];
+    long completed;
+    long in_flight;
+    long active_threads;
+    long lock_waits;
+    long lock_wait_ns;
+    long queue_messages;
+    long queue_bytes;
+    long queue_capacity;
+    long coalesced_writes;
+};
+
+struct stats_region
+{
+    struct process_stats slots[STATS_SLOTS];
+};
+
+// Slot of this process in the stats region, NULL when the region could not be opened
+__attribute__((unused)) static struct process_stats *processStats = NULL;
+
+/**
+ * Log2 histograms of the time requests spend between consecutive stages. Bucket b of a stage
+ * counts the requests that took [2^b, 2^(b+1)) ns to reach that stage from the latest earlier
+ * stage they went through. They are updated atomically by the request threads.
+ */
+struct stage_histograms
+{
+    unsigned long count[NUMBER_OF_STAGES];
+    unsigned long total_ns[NUMBER_OF_STAGES];
+    unsigned long buckets[NUMBER_OF_STAGES][HISTOGRAM_BUCKETS];
+};
+
+static struct stage_histograms stageHistograms;
+
+// Returns the current CLOCK_MONOTONIC time in nanoseconds, used for the stage timestamps
+__attribute__((unused)) static long nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/**
+ * @brief Adds the intervals between the stages a finished request went through to the histograms
+ *
+ * @param stage_ns
+ */
+__attribute__((unused)) static void recordStages(const long *stage_ns)
+{
+    int previous = -1;
+    for (int stage = 0; stage < NUMBER_OF_STAGES; stage++)
+    {
+        if (stage_ns[stage] == 0)
+        {
+            continue;
+        }
+        if (previous != -1 && stage_ns[stage] >= stage_ns[previous])
+        {
+            unsigned long ns = stage_ns[stage] - stage_ns[previous];
+            int bucket = ns == 0 ? 0 : 63 - __builtin_clzl(ns);
+            __atomic_fetch_add(&stageHistograms.count[stage], 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&stageHistograms.total_ns[stage], ns, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&stageHistograms.buckets[stage][bucket], 1, __ATOMIC_RELAXED);
+        }
+        previous = stage;
+    }
+}
+
+// Upper bound in microseconds of the bucket that holds the given fraction of the intervals of a stage
+static double histogramPercentileUs(int stage, double fraction)
+{
+    unsigned long rank = (unsigned long)(fraction * stageHistograms.count[stage] + 0.999999);
+    unsigned long seen = 0;
+    for (int bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++)
+    {
+        seen += stageHistograms.buckets[stage][bucket];
+        if (seen >= rank)
+        {
+            return (double)(2UL << bucket) / 1000.0;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Prints the stage histograms, one line per stage with its count, mean and percentiles
+ * followed by the non-empty buckets as 'upper bound in us: count'. Stage names label the
+ * stages the way the process sees them.
+ *
+ * @param process
+ * @param stage_names
+ */
+__attribute__((unused)) static void printStageHistograms(const char *process, const char *const *stage_names)
+{
+    printf("%s Time spent reaching each stage\n", process);
+    for (int stage = 1; stage < NUMBER_OF_STAGES; stage++)
+    {
+        unsigned long count = stageHistograms.count[stage];
+        if (count == 0)
+        {
+            continue;
+        }
+        printf("%s %-15s count %lu mean %.1f us p50 <= %.1f us p99 <= %.1f us\n", process, stage_names[stage], count,
+               stageHistograms.total_ns[stage] / 1000.0 / count, histogramPercentileUs(stage, 0.5), histogramPercentileUs(stage, 0.99));
+        printf("%s    ", process);
+        for (int bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++)
+        {
+            if (stageHistograms.buckets[stage][bucket] != 0)
+            {
+                printf(" %g: %lu", (double)(2UL << bucket) / 1000.0, stageHistograms.buckets[stage][bucket]);
+            }
+        }
+        printf("\n");
+    }
+}
+
+/**
+ * @brief Maps the stats region, creating it if this is the first process, and resets the given slot.
+ * Errors are reported with the process name as prefix.
+ *
+ * @param slot
+ * @param process
+ * @return struct process_stats*
+ */
+__attribute__((unused)) static struct process_stats *openStats(int slot, const char *process)
+{
+    int fd = shm_open(STATS_SHM_NAME, O_CREAT | O_RDWR, 0644);
+    if (fd == -1)
+    {
+        fprintf(stderr, "%s Error while opening the stats region: %s\n", process, strerror(errno));
+        return NULL;
+    }
+    if (ftruncate(fd, sizeof(struct stats_region)) == -1)
+    {
+        fprintf(stderr, "%s Error while sizing the stats region: %s\n", process, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    struct stats_region *region = (struct stats_region *)mmap(NULL, sizeof(struct stats_region), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED)
+    {
+        fprintf(stderr, "%s Error while mapping the stats region: %s\n", process, strerror(errno));
+        return NULL;
+    }
+    struct process_stats *stats = &region->slots[slot];
+    memset(stats, 0, sizeof(*stats));
+    stats->started_ns = nowNs();
+    __atomic_store_n(&stats->pid, (long)getpid(), __ATOMIC_RELEASE);
+    return stats;
+}
+
+#endif
@@ -0,0 +1,254 @@
+/**
+ * @file trace.h
+ * @author Divyateja Pasupuleti
+ * @brief
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2023
+ * POSIX-compliant C header trace.h
+ *
+ * Opt-in Chrome / Perfetto trace-event export. When GRAPH_TRACE names a file, traceInit makes
+ * the process collect events in memory: complete events (a name, a thread, a start and a
+ * duration) and flow events that link the hops of one request across processes. The events
+ * are appended to the file when the process exits.
+ *
+ * Every process appends to the same file with O_APPEND. The process that creates it writes the
+ * opening bracket, the closing one is optional in the trace-event format, so the file can be
+ * opened in chrome://tracing or ui.perfetto.dev as it is. Timestamps are CLOCK_MONOTONIC, which
+ * all processes share, so their events line up.
+ *
+ * Without GRAPH_TRACE every trace call is a single test of a NULL pointer.
+ *
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define TRACE_ENV "GRAPH_TRACE"
+#define TRACE_MAX_EVENTS (1 << 20)
+#define TRACE_LINE_LENGTH 512
+#define TRACE_WRITE_CHUNK (1 << 16)
+#define TRACE_ON (tracer.events != NULL)
+
+/**
+ * One trace event. Names and argument names must be string literals.
+ * Phase is 'X' for a complete event, 's' and 'f' for the start and the end of a flow.
+ */
+struct trace_event
+{
+    const char *name;
+    char phase;
+    int tid;
+    long ts_ns;
+    long dur_ns;
+    long id;
+    const char *arg_names[2];
+    long args[2];
+};
+
+struct tracer
+{
+    struct trace_event *events;
+    long count;
+    long dropped;
+    int pid;
+    char process[64];
+    char path[256];
+};
+
+static struct tracer tracer;
+static __thread int traceTid = 0;
+
+// Reserves the next event, NULL when tracing is off or the buffer is full
+static struct trace_event *traceReserve()
+{
+    if (tracer.events == NULL)
+    {
+        return NULL;
+    }
+    long index = __atomic_fetch_add(&tracer.count, 1, __ATOMIC_RELAXED);
+    if (index >= TRACE_MAX_EVENTS)
+    {
+        __atomic_add_fetch(&tracer.dropped, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    if (traceTid == 0)
+    {
+        traceTid = (int)syscall(SYS_gettid);
+    }
+    struct trace_event *event = &tracer.events[index];
+    event->tid = traceTid;
+    return event;
+}
+
+/**
+ * @brief Records a span of the calling thread from start_ns to end_ns with up to two
+ * numeric arguments, pass NULL as the name of an unused one
+ *
+ * @param name
+ * @param start_ns
+ * @param end_ns
+ * @param arg_name_1
+ * @param arg_1
+ * @param arg_name_2
+ * @param arg_2
+ */
+__attribute__((unused)) static void traceSpan(const char *name, long start_ns, long end_ns, const char *arg_name_1, long arg_1,
+                                              const char *arg_name_2, long arg_2)
+{
+    struct trace_event *event = traceReserve();
+    if (event == NULL)
+    {
+        return;
+    }
+    event->name = name;
+    event->phase = 'X';
+    event->ts_ns = start_ns;
+    event->dur_ns = end_ns - start_ns;
+    event->id = 0;
+    event->arg_names[0] = arg_name_1;
+    event->args[0] = arg_1;
+    event->arg_names[1] = arg_name_2;
+    event->args[1] = arg_2;
+}
+
+/**
+ * @brief Records one end of an arrow between two processes. The sending side records 's'
+ * and the receiving side 'f' with the same id, the arrow ends on the span enclosing ts_ns.
+ *
+ * @param phase
+ * @param id
+ * @param ts_ns
+ */
+__attribute__((unused)) static void traceFlow(char phase, long id, long ts_ns)
+{
+    struct trace_event *event = traceReserve();
+    if (event == NULL)
+    {
+        return;
+    }
+    event->name = "request";
+    event->phase = phase;
+    event->ts_ns = ts_ns;
+    event->dur_ns = 0;
+    event->id = id;
+    event->arg_names[0] = NULL;
+    event->arg_names[1] = NULL;
+}
+
+// Formats one event as a JSON line
+static int traceFormat(char *line, const struct trace_event *event)
+{
+    int length = snprintf(line, TRACE_LINE_LENGTH, "{\"name\": \"%s\", \"cat\": \"graph\", \"ph\": \"%c\", \"pid\": %d, \"tid\": %d, \"ts\": %.3f",
+                          event->name, event->phase, tracer.pid, event->tid, event->ts_ns / 1000.0);
+    if (event->phase == 'X')
+    {
+        length += snprintf(line + length, TRACE_LINE_LENGTH - length, ", \"dur\": %.3f, \"args\": {", event->dur_ns / 1000.0);
+        for (int i = 0; i < 2; i++)
+        {
+            if (event->arg_names[i] != NULL)
+            {
+                length += snprintf(line + length, TRACE_LINE_LENGTH - length, "%s\"%s\": %ld", i > 0 && event->arg_names[0] ? ", " : "",
+                                   event->arg_names[i], event->args[i]);
+            }
+        }
+        length += snprintf(line + length, TRACE_LINE_LENGTH - length, "}},\n");
+    }
+    else
+    {
+        length += snprintf(line + length, TRACE_LINE_LENGTH - length, ", \"id\": %ld%s},\n", event->id, event->phase == 'f' ? ", \"bp\": \"e\"" : "");
+    }
+    return length;
+}
+
+/**
+ * @brief Appends the collected events to the trace file. Registered with atexit by traceInit.
+ * Events are written in chunks of whole lines, O_APPEND keeps the lines of different processes apart.
+ */
+static void traceWrite()
+{
+    struct trace_event *events = __atomic_exchange_n(&tracer.events, NULL, __ATOMIC_ACQ_REL);
+    if (events == NULL)
+    {
+        return;
+    }
+    long count = tracer.count < TRACE_MAX_EVENTS ? tracer.count : TRACE_MAX_EVENTS;
+
+    int fd = open(tracer.path, O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0644);
+    if (fd != -1)
+    {
+        if (write(fd, "[\n", 2) != 2)
+        {
+            perror("[Trace] Error while writing the trace file");
+        }
+    }
+    else if ((fd = open(tracer.path, O_WRONLY | O_APPEND)) == -1)
+    {
+        perror("[Trace] Error while opening the trace file");
+        free(events);
+        return;
+    }
+
+    char *chunk = (char *)malloc(TRACE_WRITE_CHUNK);
+    int length = snprintf(chunk, TRACE_WRITE_CHUNK, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"%s\"}},\n",
+                          tracer.pid, tracer.process);
+    for (long i = 0; i <= count; i++)
+    {
+        char line[TRACE_LINE_LENGTH];
+        int line_length = i < count ? traceFormat(line, &events[i]) : 0;
+        if (i == count || length + line_length > TRACE_WRITE_CHUNK)
+        {
+            if (write(fd, chunk, length) != length)
+            {
+                perror("[Trace] Error while writing the trace file");
+                break;
+            }
+            length = 0;
+        }
+        memcpy(chunk + length, line, line_length);
+        length += line_length;
+    }
+    close(fd);
+    free(chunk);
+    free(events);
+
+    if (tracer.dropped > 0)
+    {
+        fprintf(stderr, "[Trace] %s dropped %ld events, the trace buffer holds %d\n", tracer.process, tracer.dropped, TRACE_MAX_EVENTS);
+    }
+}
+
+/**
+ * @brief Turns tracing on when GRAPH_TRACE is set. The process name labels the process in
+ * the trace viewer.
+ *
+ * @param process
+ */
+__attribute__((unused)) static void traceInit(const char *process)
+{
+    const char *path = getenv(TRACE_ENV);
+    if (path == NULL || path[0] == '\0')
+    {
+        return;
+    }
+    snprintf(tracer.path, sizeof(tracer.path), "%s", path);
+    snprintf(tracer.process, sizeof(tracer.process), "%s", process);
+    tracer.pid = (int)getpid();
+    tracer.events = (struct trace_event *)malloc(TRACE_MAX_EVENTS * sizeof(struct trace_event));
+    if (tracer.events == NULL)
+    {
+        perror("[Trace] Error while allocating the trace buffer");
+        exit(EXIT_FAILURE);
+    }
+    atexit(traceWrite);
+}
+
+#endif
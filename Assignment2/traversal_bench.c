@@ -0,0 +1,666 @@
+/**
+ * @file traversal_bench.c
+ * @author Divyateja Pasupuleti
+ * @brief
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2023
+ * POSIX-compliant C program traversal_bench.c
+ *
+ * Microbenchmark for the BFS and DFS kernels of the secondary server. It includes
+ * secondary_server.c without its main and calls bfsTraverse and dfsTraverse directly on
+ * graph files, so no message queue, shared memory or semaphore is involved. The same graphs
+ * are also run through the original thread-per-vertex kernels (one bfs_subthread per frontier
+ * vertex, one dfs_subthread per discovered vertex) to compare an engine against them.
+ *
+ * Every run happens in a child process and reports the traversal time, the arcs scanned per
+ * second, the peak RSS and the number of threads created. BFS results are checked against a
+ * sequential reference BFS.
+ *
+ */
+
+#include <pthread.h>
+
+/**
+ * Every thread the kernels create goes through this wrapper so that it can be counted.
+ * The macro has to be in place before secondary_server.c is included.
+ */
+static long threadsCreated = 0;
+
+static int countedThreadCreate(pthread_t *thread, const pthread_attr_t *attr, void *(*start_routine)(void *), void *arg)
+{
+    __atomic_add_fetch(&threadsCreated, 1, __ATOMIC_RELAXED);
+    return pthread_create(thread, attr, start_routine, arg);
+}
+
+#define pthread_create countedThreadCreate
+#define SECONDARY_SERVER_NO_MAIN
+#include "secondary_server.c"
+
+#include <getopt.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define MAX_GRAPHS 64
+#define DEFAULT_REPEATS 3
+#define DEFAULT_LEGACY_LIMIT 10000
+
+/**
+ * Shared state of one run of the thread-per-vertex kernels.
+ * Visited holds one byte per vertex, claimed with an atomic exchange.
+ * Lock protects the BFS queue and the list of DFS leaves.
+ * Failed is set when a thread could not be created and part of the graph was not walked.
+ */
+struct legacy_context
+{
+    struct graph *graph;
+    unsigned char *visited;
+    pthread_mutex_t lock;
+    struct Queue *queue;
+    struct vertex_list *leaves;
+    int failed;
+};
+
+struct legacy_task
+{
+    struct legacy_context *context;
+    int vertex;
+};
+
+/**
+ * What a child process reports back to the parent for one run
+ */
+struct run_result
+{
+    long elapsed_ns;
+    long threads;
+    long levels;
+    long reached;
+    long leaves;
+    long start_rss;
+    int failed;
+};
+
+/**
+ * The sequential BFS every BFS kernel is checked against.
+ * Arcs is the number of arcs leaving the reached vertices, i.e. the arcs a traversal scans.
+ */
+struct reference
+{
+    long levels;
+    long reached;
+    long arcs;
+};
+
+typedef void (*kernel_function)(struct graph *graph, int start, struct run_result *result);
+
+struct kernel
+{
+    const char *algorithm;
+    const char *engine;
+    kernel_function run;
+    int legacy;
+};
+
+static int legacyClaim(unsigned char *visited, int vertex)
+{
+    return __atomic_exchange_n(&visited[vertex], 1, __ATOMIC_RELAXED) == 0;
+}
+
+/**
+ * @brief The original BFS thread. It expands a single vertex and puts its unvisited neighbours
+ * into the queue for the next level, taking the queue lock once per neighbour.
+ * Neighbours are claimed when they are queued so that a vertex enters the queue only once.
+ *
+ * @param arg
+ * @return void*
+ */
+void *legacy_bfs_subthread(void *arg)
+{
+    struct legacy_task *task = (struct legacy_task *)arg;
+    struct legacy_context *context = task->context;
+    struct graph *graph = context->graph;
+
+    for (long e = graph->offsets[task->vertex]; e < graph->offsets[task->vertex + 1]; e++)
+    {
+        int next = graph->neighbours[e];
+        if (legacyClaim(context->visited, next))
+        {
+            pthread_mutex_lock(&context->lock);
+            enqueue(context->queue, next);
+            pthread_mutex_unlock(&context->lock);
+        }
+    }
+
+    free(task);
+    pthread_exit(NULL);
+}
+
+/**
+ * @brief The original DFS thread. Every unvisited neighbour gets a thread of its own, which
+ * is joined before this thread exits, so a path of k vertices keeps k threads alive.
+ * A vertex that finds no unvisited neighbours is a leaf.
+ *
+ * @param arg
+ * @return void*
+ */
+void *legacy_dfs_subthread(void *arg)
+{
+    struct legacy_task *task = (struct legacy_task *)arg;
+    struct legacy_context *context = task->context;
+    struct graph *graph = context->graph;
+
+    long degree = graph->offsets[task->vertex + 1] - graph->offsets[task->vertex];
+    pthread_t *thread_ids = (pthread_t *)malloc((degree > 0 ? degree : 1) * sizeof(pthread_t));
+    int threadIndex = 0;
+    int flag = 0;
+
+    for (long e = graph->offsets[task->vertex]; e < graph->offsets[task->vertex + 1]; e++)
+    {
+        int next = graph->neighbours[e];
+        if (!legacyClaim(context->visited, next))
+        {
+            continue;
+        }
+        flag = 1;
+
+        struct legacy_task *child = (struct legacy_task *)malloc(sizeof(struct legacy_task));
+        child->context = context;
+        child->vertex = next;
+        if (pthread_create(&thread_ids[threadIndex], NULL, legacy_dfs_subthread, (void *)child) != 0)
+        {
+            __atomic_store_n(&context->failed, 1, __ATOMIC_RELAXED);
+            free(child);
+            continue;
+        }
+        threadIndex++;
+    }
+
+    if (flag == 0)
+    {
+        pthread_mutex_lock(&context->lock);
+        appendVertex(context->leaves, task->vertex);
+        pthread_mutex_unlock(&context->lock);
+    }
+
+    // Join all the subthreads
+    for (int i = 0; i < threadIndex; i++)
+    {
+        pthread_join(thread_ids[i], NULL);
+    }
+    free(thread_ids);
+    free(task);
+    pthread_exit(NULL);
+}
+
+static void initLegacyContext(struct legacy_context *context, struct graph *graph)
+{
+    context->graph = graph;
+    context->visited = (unsigned char *)calloc(graph->number_of_nodes > 0 ? graph->number_of_nodes : 1, 1);
+    context->queue = NULL;
+    context->leaves = NULL;
+    context->failed = 0;
+    if (context->visited == NULL || pthread_mutex_init(&context->lock, NULL) != 0)
+    {
+        fprintf(stderr, "[Traversal Bench] Could not set up the legacy kernel\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief The original BFS main thread loop: one legacy_bfs_subthread per vertex of the level
+ *
+ * @param graph
+ * @param start
+ * @param result
+ */
+void runLegacyBfs(struct graph *graph, int start, struct run_result *result)
+{
+    struct legacy_context context;
+    initLegacyContext(&context, graph);
+    context.queue = createQueue(graph->number_of_nodes);
+    int *frontier = (int *)malloc((graph->number_of_nodes > 0 ? graph->number_of_nodes : 1) * sizeof(int));
+    pthread_t *subthread_ids = (pthread_t *)malloc((graph->number_of_nodes > 0 ? graph->number_of_nodes : 1) * sizeof(pthread_t));
+
+    legacyClaim(context.visited, start);
+    enqueue(context.queue, start);
+
+    while (!isEmpty(context.queue))
+    {
+        int queue_size = dequeueAll(context.queue, frontier);
+        result->reached += queue_size;
+        result->levels++;
+
+        int threadIndex = 0;
+        for (int i = 0; i < queue_size; i++)
+        {
+            struct legacy_task *task = (struct legacy_task *)malloc(sizeof(struct legacy_task));
+            task->context = &context;
+            task->vertex = frontier[i];
+            if (pthread_create(&subthread_ids[threadIndex], NULL, legacy_bfs_subthread, (void *)task) != 0)
+            {
+                context.failed = 1;
+                free(task);
+                continue;
+            }
+            threadIndex++;
+        }
+
+        // Join all the subthreads
+        for (int i = 0; i < threadIndex; i++)
+        {
+            pthread_join(subthread_ids[i], NULL);
+        }
+    }
+
+    result->failed = context.failed;
+    free(subthread_ids);
+    free(frontier);
+    freeQueue(context.queue);
+    free(context.visited);
+    pthread_mutex_destroy(&context.lock);
+}
+
+/**
+ * @brief The original DFS main thread: a single legacy_dfs_subthread for the starting vertex
+ *
+ * @param graph
+ * @param start
+ * @param result
+ */
+void runLegacyDfs(struct graph *graph, int start, struct run_result *result)
+{
+    struct legacy_context context;
+    struct vertex_list leaves = {NULL, 0, 0};
+    initLegacyContext(&context, graph);
+    context.leaves = &leaves;
+
+    legacyClaim(context.visited, start);
+    struct legacy_task *task = (struct legacy_task *)malloc(sizeof(struct legacy_task));
+    task->context = &context;
+    task->vertex = start;
+    pthread_t thread_id;
+    if (pthread_create(&thread_id, NULL, legacy_dfs_subthread, (void *)task) != 0)
+    {
+        context.failed = 1;
+        free(task);
+    }
+    else
+    {
+        pthread_join(thread_id, NULL);
+    }
+
+    result->leaves = leaves.count;
+    result->failed = context.failed;
+    free(leaves.vertices);
+    free(context.visited);
+    pthread_mutex_destroy(&context.lock);
+}
+
+/**
+ * @brief Runs the secondary server's BFS kernel
+ *
+ * @param graph
+ * @param start
+ * @param result
+ */
+void runCurrentBfs(struct graph *graph, int start, struct run_result *result)
+{
+    struct data_to_thread dtt;
+    pthread_mutex_t mutexLock;
+    pthread_mutex_t queueLock;
+    memset(&dtt, 0, sizeof(dtt));
+    pthread_mutex_init(&mutexLock, NULL);
+    pthread_mutex_init(&queueLock, NULL);
+    dtt.graph = graph;
+    dtt.mutexLock = &mutexLock;
+    dtt.queueLock = &queueLock;
+
+    result->levels = bfsTraverse(&dtt, start, &result->reached);
+
+    pthread_mutex_destroy(&mutexLock);
+    pthread_mutex_destroy(&queueLock);
+}
+
+/**
+ * @brief Runs the secondary server's DFS kernel
+ *
+ * @param graph
+ * @param start
+ * @param result
+ */
+void runCurrentDfs(struct graph *graph, int start, struct run_result *result)
+{
+    struct data_to_thread dtt;
+    pthread_mutex_t mutexLock;
+    struct vertex_list leaves = {NULL, 0, 0};
+    memset(&dtt, 0, sizeof(dtt));
+    pthread_mutex_init(&mutexLock, NULL);
+    dtt.graph = graph;
+    dtt.mutexLock = &mutexLock;
+
+    dfsTraverse(&dtt, start, &leaves);
+
+    result->leaves = leaves.count;
+    free(leaves.vertices);
+    pthread_mutex_destroy(&mutexLock);
+}
+
+static const struct kernel kernels[] = {
+    {"bfs", "current", runCurrentBfs, 0},
+    {"bfs", "legacy", runLegacyBfs, 1},
+    {"dfs", "current", runCurrentDfs, 0},
+    {"dfs", "legacy", runLegacyDfs, 1},
+};
+
+/**
+ * @brief Sequential BFS used to check the BFS kernels and to count the arcs they scan
+ *
+ * @param graph
+ * @param start
+ * @return struct reference
+ */
+struct reference referenceBfs(struct graph *graph, int start)
+{
+    struct reference reference = {0, 0, 0};
+    unsigned char *visited = (unsigned char *)calloc(graph->number_of_nodes, 1);
+    int *queue = (int *)malloc(graph->number_of_nodes * sizeof(int));
+    if (visited == NULL || queue == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed. Exiting program.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    long head = 0;
+    long tail = 0;
+    visited[start] = 1;
+    queue[tail++] = start;
+    while (head < tail)
+    {
+        long level_end = tail;
+        reference.levels++;
+        for (; head < level_end; head++)
+        {
+            int vertex = queue[head];
+            reference.arcs += graph->offsets[vertex + 1] - graph->offsets[vertex];
+            for (long e = graph->offsets[vertex]; e < graph->offsets[vertex + 1]; e++)
+            {
+                int next = graph->neighbours[e];
+                if (!visited[next])
+                {
+                    visited[next] = 1;
+                    queue[tail++] = next;
+                }
+            }
+        }
+    }
+    reference.reached = tail;
+
+    free(queue);
+    free(visited);
+    return reference;
+}
+
+/**
+ * @brief Runs one kernel once in a child process, so that every run starts from the same
+ * memory footprint and its peak RSS can be read from wait4.
+ *
+ * @param kernel
+ * @param graph
+ * @param start
+ * @param result
+ * @return long peak RSS of the child in KiB
+ */
+long runInChild(const struct kernel *kernel, struct graph *graph, int start, struct run_result *result)
+{
+    int result_pipe[2];
+    if (pipe(result_pipe) == -1)
+    {
+        perror("[Traversal Bench] Error while creating the result pipe");
+        exit(EXIT_FAILURE);
+    }
+
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        perror("[Traversal Bench] Error while forking a run");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0)
+    {
+        close(result_pipe[0]);
+        struct run_result child_result;
+        memset(&child_result, 0, sizeof(child_result));
+
+        // The child starts out with the pages it shares with the parent, which include the graph
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        child_result.start_rss = usage.ru_maxrss;
+
+        long started = nowNs();
+        kernel->run(graph, start, &child_result);
+        child_result.elapsed_ns = nowNs() - started;
+        child_result.threads = __atomic_load_n(&threadsCreated, __ATOMIC_RELAXED);
+
+        if (write(result_pipe[1], &child_result, sizeof(child_result)) != sizeof(child_result))
+        {
+            _exit(EXIT_FAILURE);
+        }
+        _exit(EXIT_SUCCESS);
+    }
+
+    close(result_pipe[1]);
+    memset(result, 0, sizeof(*result));
+    ssize_t bytes = read(result_pipe[0], result, sizeof(*result));
+    close(result_pipe[0]);
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) == -1)
+    {
+        perror("[Traversal Bench] Error while waiting for a run");
+        exit(EXIT_FAILURE);
+    }
+    if (bytes != sizeof(*result) || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        // A crashed run (for instance out of memory for thread stacks) counts as failed
+        memset(result, 0, sizeof(*result));
+        result->failed = 1;
+    }
+    return usage.ru_maxrss;
+}
+
+static int compareLong(const void *a, const void *b)
+{
+    long x = *(const long *)a;
+    long y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+// Picks the vertex with the most outgoing arcs, so that the traversal covers its component
+static int busiestVertex(struct graph *graph)
+{
+    int busiest = 0;
+    for (int vertex = 1; vertex < graph->number_of_nodes; vertex++)
+    {
+        if (graph->offsets[vertex + 1] - graph->offsets[vertex] > graph->offsets[busiest + 1] - graph->offsets[busiest])
+        {
+            busiest = vertex;
+        }
+    }
+    return busiest;
+}
+
+/**
+ * @brief Prints the command line options
+ *
+ * @param program
+ */
+void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-a bfs|dfs] [-e current|legacy] [-r repeats] [-v vertex] [-l legacy limit] [-j] graph...\n", program);
+    fprintf(stderr, "  graphs can be in any format the secondary server reads (dense, edge list or .csr)\n");
+    fprintf(stderr, "  -a and -e restrict the kernels that are run, by default every algorithm and engine runs\n");
+    fprintf(stderr, "  -r runs every kernel that many times and reports the median time (default %d)\n", DEFAULT_REPEATS);
+    fprintf(stderr, "  -v 1-based starting vertex, by default the vertex with the most arcs\n");
+    fprintf(stderr, "  -l skips the legacy kernels on graphs with more nodes than this (default %d), they need a thread per vertex\n",
+            DEFAULT_LEGACY_LIMIT);
+    fprintf(stderr, "  -j prints JSON instead of a table\n");
+}
+
+/**
+ * @brief Loads every graph, runs the selected kernels on it and prints one row per kernel
+ *
+ * @return int
+ */
+int main(int argc, char *argv[])
+{
+    const char *algorithm = NULL;
+    const char *engine = NULL;
+    int repeats = DEFAULT_REPEATS;
+    int start_vertex = 0;
+    long legacy_limit = DEFAULT_LEGACY_LIMIT;
+    int json = 0;
+
+    int option;
+    while ((option = getopt(argc, argv, "a:e:r:v:l:jh")) != -1)
+    {
+        switch (option)
+        {
+        case 'a':
+            algorithm = optarg;
+            break;
+        case 'e':
+            engine = optarg;
+            break;
+        case 'r':
+            repeats = atoi(optarg);
+            break;
+        case 'v':
+            start_vertex = atoi(optarg);
+            break;
+        case 'l':
+            legacy_limit = atol(optarg);
+            break;
+        case 'j':
+            json = 1;
+            break;
+        default:
+            usage(argv[0]);
+            exit(option == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    if (optind >= argc || argc - optind > MAX_GRAPHS || repeats < 1 || start_vertex < 0)
+    {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (json)
+        printf("[\n");
+    else
+        printf("%-28s %9s %10s %4s %8s %11s %9s %9s %9s %9s %11s %s\n", "GRAPH", "NODES", "ARCS", "ALGO", "ENGINE", "TIME(ms)",
+               "MARCS/s", "THREADS", "RSS(MB)", "+RSS(MB)", "LEVELS/LVS", "CHECK");
+
+    int first_row = 1;
+    int mismatches = 0;
+    for (int g = optind; g < argc; g++)
+    {
+        struct graph *graph = loadGraphFile(argv[g]);
+        if (graph == NULL || graph->number_of_nodes == 0)
+        {
+            fprintf(stderr, "[Traversal Bench] Could not load %s\n", argv[g]);
+            exit(EXIT_FAILURE);
+        }
+        int start = start_vertex > 0 ? start_vertex - 1 : busiestVertex(graph);
+        if (start >= graph->number_of_nodes)
+        {
+            fprintf(stderr, "[Traversal Bench] %s has no vertex %d\n", argv[g], start + 1);
+            exit(EXIT_FAILURE);
+        }
+
+        // Faults the whole reachable graph in once so that no run pays for reading it
+        struct reference reference = referenceBfs(graph, start);
+
+        const char *name = strrchr(argv[g], '/') ? strrchr(argv[g], '/') + 1 : argv[g];
+        for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+        {
+            const struct kernel *kernel = &kernels[k];
+            if ((algorithm && strcmp(algorithm, kernel->algorithm) != 0) || (engine && strcmp(engine, kernel->engine) != 0))
+            {
+                continue;
+            }
+
+            if (kernel->legacy && graph->number_of_nodes > legacy_limit)
+            {
+                if (!json)
+                    printf("%-28.28s %9d %10ld %4s %8s %11s   skipped, more than %ld nodes (-l)\n", name, graph->number_of_nodes,
+                           graph->number_of_edges, kernel->algorithm, kernel->engine, "-", legacy_limit);
+                continue;
+            }
+
+            long elapsed[repeats];
+            struct run_result result;
+            struct run_result last;
+            long peak_rss = 0;
+            long added_rss = 0;
+            int failed = 0;
+            for (int r = 0; r < repeats; r++)
+            {
+                long rss = runInChild(kernel, graph, start, &result);
+                peak_rss = rss > peak_rss ? rss : peak_rss;
+                added_rss = rss - result.start_rss > added_rss ? rss - result.start_rss : added_rss;
+                failed |= result.failed;
+                elapsed[r] = result.elapsed_ns;
+                last = result;
+            }
+            qsort(elapsed, repeats, sizeof(long), compareLong);
+            long median = elapsed[repeats / 2];
+
+            const char *check = "ok";
+            if (failed)
+            {
+                check = "FAILED";
+            }
+            else if (strcmp(kernel->algorithm, "bfs") == 0 && (last.levels != reference.levels || last.reached != reference.reached))
+            {
+                check = "MISMATCH";
+            }
+            else if (strcmp(kernel->algorithm, "dfs") == 0 && (last.leaves < 1 || last.leaves > reference.reached))
+            {
+                check = "MISMATCH";
+            }
+            if (strcmp(check, "ok") != 0)
+            {
+                mismatches++;
+            }
+
+            double arcs_per_second = median > 0 ? reference.arcs * 1e9 / median : 0;
+            long shape = strcmp(kernel->algorithm, "bfs") == 0 ? last.levels : last.leaves;
+            if (json)
+            {
+                printf("%s  {\"graph\": \"%s\", \"nodes\": %d, \"arcs\": %ld, \"algorithm\": \"%s\", \"engine\": \"%s\", "
+                       "\"time_ms\": %.3f, \"arcs_per_second\": %.0f, \"threads\": %ld, \"peak_rss_kb\": %ld, \"added_rss_kb\": %ld, "
+                       "\"%s\": %ld, \"check\": \"%s\"}",
+                       first_row ? "" : ",\n", name, graph->number_of_nodes, graph->number_of_edges, kernel->algorithm, kernel->engine,
+                       median / 1e6, arcs_per_second, last.threads, peak_rss, added_rss,
+                       strcmp(kernel->algorithm, "bfs") == 0 ? "levels" : "leaves", shape, check);
+            }
+            else
+            {
+                printf("%-28.28s %9d %10ld %4s %8s %11.3f %9.2f %9ld %9.1f %9.1f %11ld %s\n", name, graph->number_of_nodes,
+                       graph->number_of_edges, kernel->algorithm, kernel->engine, median / 1e6, arcs_per_second / 1e6, last.threads,
+                       peak_rss / 1024.0, added_rss / 1024.0, shape, check);
+            }
+            first_row = 0;
+            fflush(stdout);
+        }
+
+        freeGraph(graph);
+    }
+
+    if (json)
+        printf("\n]\n");
+    return mismatches > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
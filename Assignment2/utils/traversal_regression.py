@@ -0,0 +1,362 @@
+"""Correctness and performance regression harness for the DFS and BFS operations.
+
+Runs operation 3 (DFS) and operation 4 (BFS) for every G*.txt and every starting vertex
+through the live load balancer and secondary servers, driving client.out over its stdin.
+
+Every BFS reply is checked level by level against a reference BFS. Every DFS reply is checked
+against the leaves a DFS must find: on graphs whose reachable part is a tree the leaf set is
+exact, on other graphs the order in which threads claim vertices changes the leaves, so only
+what every DFS agrees on is checked (no duplicates, only reachable vertices, every reachable
+vertex without outgoing arcs is a leaf).
+
+The median time of a request per graph and operation is compared with the committed baseline
+utils/traversal_baseline.json, and the run fails if any reply is wrong, any median is more than
+--tolerance percent slower or there is no baseline to compare with. A baseline is only written
+by --store-baseline, never by a run that merely finds none.
+
+With --scale N it instead generates graphs of N vertices with graph_generator, far above the
+fixed limits the servers used to have, and checks DFS and BFS on them from a few starting
+vertices. There is no baseline for these.
+
+Run it from Assignment2:
+    python3 utils/traversal_regression.py                 # builds and starts the servers
+    python3 utils/traversal_regression.py --store-baseline
+    python3 utils/traversal_regression.py --no-start      # servers are already running
+    python3 utils/traversal_regression.py --scale 1000000
+"""
+
+import argparse
+import glob
+import json
+import os
+import selectors
+import statistics
+import subprocess
+import sys
+import time
+from collections import deque
+
+PROGRAMS = ["load_balancer", "primary_server", "secondary_server", "client", "cleanup"]
+DONE_MARKER = "[Client] Operation done successfully"
+FAILED_MARKER = "[Client] Operation failed"
+LEAVES_MARKER = "The list of Leaf Nodes while travelling from"
+FIRST_SEQ_NUM = 1
+LAST_SEQ_NUM = 250
+# Shapes of the --scale graphs: random has a few wide BFS levels, grid thousands of levels and long DFS paths
+SCALE_SHAPES = ["random", "grid"]
+SCALE_DEGREE = 4
+
+
+def read_graph(path):
+    """Reads a dense G*.txt or an 'E n m' edge list into 0-based adjacency lists."""
+    with open(path) as graph:
+        first = graph.readline().split()
+        if first and first[0] == "E":
+            # Edge lists are read a line at a time, the --scale graphs have millions of them
+            n = int(first[1])
+            adjacency = [[] for _ in range(n)]
+            for line in graph:
+                pair = line.split()
+                if len(pair) == 2:
+                    u, v = int(pair[0]), int(pair[1])
+                    if 1 <= u <= n and 1 <= v <= n:
+                        adjacency[u - 1].append(v - 1)
+            return [sorted(set(row)) for row in adjacency]
+    tokens = open(path).read().split()
+    if not tokens:
+        return []
+    n = int(tokens[0])
+    cells = tokens[1:1 + n * n]
+    return [[j for j in range(n) if i * n + j < len(cells) and cells[i * n + j] != "0"] for i in range(n)]
+
+
+def reference_bfs(adjacency, start):
+    """Returns the BFS levels from start as a list of sets of 1-based vertices."""
+    levels = []
+    visited = {start}
+    frontier = [start]
+    while frontier:
+        levels.append({v + 1 for v in frontier})
+        next_frontier = []
+        for vertex in frontier:
+            for neighbour in adjacency[vertex]:
+                if neighbour not in visited:
+                    visited.add(neighbour)
+                    next_frontier.append(neighbour)
+        frontier = next_frontier
+    return levels
+
+
+def reference_dfs(adjacency, start):
+    """Returns (reachable, sinks, exact leaves or None when the leaves depend on the order)."""
+    reachable = {start}
+    stack = [start]
+    while stack:
+        vertex = stack.pop()
+        for neighbour in adjacency[vertex]:
+            if neighbour not in reachable:
+                reachable.add(neighbour)
+                stack.append(neighbour)
+
+    sinks = {v + 1 for v in reachable if not adjacency[v]}
+
+    # The reachable part is a tree when the arcs are symmetric and there is one edge less than vertices,
+    # then the leaves are the vertices whose only neighbour is their parent, whatever the order
+    symmetric = all(vertex in adjacency[neighbour] for vertex in reachable for neighbour in adjacency[vertex])
+    arcs = sum(len(adjacency[v]) for v in reachable)
+    if not symmetric or arcs != 2 * (len(reachable) - 1):
+        return {v + 1 for v in reachable}, sinks, None
+    if len(reachable) == 1:
+        return {start + 1}, sinks, {start + 1}
+    leaves = {v + 1 for v in reachable if v != start and len(adjacency[v]) == 1}
+    return {v + 1 for v in reachable}, sinks, leaves
+
+
+class Client:
+    """A client.out process whose stdin takes one request at a time."""
+
+    def __init__(self, executable):
+        self.process = subprocess.Popen([executable], stdin=subprocess.PIPE, stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+        self.selector = selectors.DefaultSelector()
+        self.selector.register(self.process.stdout, selectors.EVENT_READ)
+        self.buffer = b""
+
+    def read_line(self, timeout):
+        deadline = time.monotonic() + timeout
+        while b"\n" not in self.buffer:
+            remaining = deadline - time.monotonic()
+            if remaining <= 0 or not self.selector.select(remaining):
+                raise TimeoutError("no reply from the client within %.0f s" % timeout)
+            chunk = os.read(self.process.stdout.fileno(), 65536)
+            if not chunk:
+                raise EOFError("the client exited")
+            self.buffer += chunk
+        line, self.buffer = self.buffer.split(b"\n", 1)
+        return line.decode(errors="replace")
+
+    def request(self, seq_num, operation, graph, vertex, timeout):
+        """Sends one DFS or BFS request and returns (seconds, output lines up to the done marker)."""
+        started = time.monotonic()
+        self.process.stdin.write(("%d\n%d\n%s\n%d\n" % (seq_num, operation, graph, vertex)).encode())
+        self.process.stdin.flush()
+        lines = []
+        while True:
+            line = self.read_line(timeout)
+            if DONE_MARKER in line:
+                return time.monotonic() - started, lines
+            if FAILED_MARKER in line:
+                raise RuntimeError(line)
+            lines.append(line)
+
+    def close(self):
+        try:
+            self.process.stdin.write(b"1\n5\n")
+            self.process.stdin.flush()
+            self.process.wait(timeout=5)
+        except (OSError, subprocess.TimeoutExpired):
+            self.process.kill()
+
+
+def parse_bfs(lines):
+    levels = []
+    for line in lines:
+        if line.startswith("Level "):
+            vertices = line.split("-->", 1)[1].split()
+            levels.append([int(v) for v in vertices])
+    return levels
+
+
+def parse_dfs(lines):
+    for index, line in enumerate(lines):
+        if LEAVES_MARKER in line:
+            return [int(v) for v in " ".join(lines[index + 1:]).split()]
+    return None
+
+
+def check_bfs(adjacency, start, lines):
+    levels = parse_bfs(lines)
+    expected = reference_bfs(adjacency, start)
+    if len(levels) != len(expected):
+        return "%d levels, expected %d" % (len(levels), len(expected))
+    for level, (got, want) in enumerate(zip(levels, expected)):
+        if len(got) != len(set(got)) or set(got) != want:
+            return "level %d is %s, expected %s" % (level, sorted(got), sorted(want))
+    return None
+
+
+def check_dfs(adjacency, start, lines):
+    leaves = parse_dfs(lines)
+    if leaves is None:
+        return "no leaf list in the reply"
+    reachable, sinks, exact = reference_dfs(adjacency, start)
+    if len(leaves) != len(set(leaves)):
+        return "duplicate leaves %s" % sorted(leaves)
+    if exact is not None:
+        return None if set(leaves) == exact else "leaves %s, expected %s" % (sorted(leaves), sorted(exact))
+    if not set(leaves) <= reachable:
+        return "leaves %s are not reachable" % sorted(set(leaves) - reachable)
+    if not sinks <= set(leaves):
+        return "vertices without arcs %s are missing from the leaves" % sorted(sinks - set(leaves))
+    if not leaves:
+        return "no leaves"
+    return None
+
+
+def generate_scale_graphs(vertices):
+    """Writes the --scale graphs as edge lists next to the G*.txt files, the servers take plain file names."""
+    subprocess.run(["gcc", "-Wall", "-g", "-O2", "graph_generator.c", "-o", "executables/graph_generator.out"], check=True)
+    paths = []
+    for shape in SCALE_SHAPES:
+        path = "scale_%s_%d.txt" % (shape, vertices)
+        subprocess.run(["./executables/graph_generator.out", "-t", shape, "-n", str(vertices), "-d", str(SCALE_DEGREE), "-s", "1", "-f", "edges",
+                        "-o", path], check=True, stdout=subprocess.DEVNULL)
+        paths.append(path)
+    return paths
+
+
+def start_servers(logs):
+    os.makedirs("executables", exist_ok=True)
+    os.makedirs(logs, exist_ok=True)
+    for program in PROGRAMS:
+        subprocess.run(["gcc", "-Wall", "-g", "-pthread", "-O2", program + ".c", "-o", "executables/%s.out" % program], check=True)
+
+    def launch(name, log, stdin=None):
+        process = subprocess.Popen(["./executables/%s.out" % name], stdin=subprocess.PIPE, stdout=open(os.path.join(logs, log), "w"),
+                                   stderr=subprocess.STDOUT)
+        if stdin is not None:
+            process.stdin.write(stdin)
+        process.stdin.close()
+        return process
+
+    servers = [launch("load_balancer", "load_balancer.log")]
+    time.sleep(1)
+    servers.append(launch("primary_server", "primary_server.log"))
+    servers.append(launch("secondary_server", "secondary_server_1.log", b"1\n"))
+    servers.append(launch("secondary_server", "secondary_server_2.log", b"2\n"))
+    time.sleep(1)
+    return servers
+
+
+def stop_servers(servers, logs):
+    with open(os.path.join(logs, "cleanup.log"), "w") as log:
+        subprocess.run(["./executables/cleanup.out"], input=b"Y\n", stdout=log, stderr=subprocess.STDOUT)
+    for server in servers:
+        try:
+            server.wait(timeout=15)
+        except subprocess.TimeoutExpired:
+            server.kill()
+
+
+def compare_with_baseline(timings, baseline, tolerance, slack_ms):
+    """Returns the list of (key, median, baseline median) that are too slow."""
+    regressions = []
+    for key, median in sorted(timings.items()):
+        if key not in baseline:
+            continue
+        limit = baseline[key] * (1 + tolerance / 100.0) + slack_ms / 1000.0
+        if median > limit:
+            regressions.append((key, median, baseline[key]))
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Checks DFS and BFS replies for every graph and starting vertex and compares timings with a baseline.")
+    parser.add_argument("--graphs", default="G*.txt", help="glob of the graphs to run (default G*.txt)")
+    parser.add_argument("--repeat", type=int, default=3, help="requests per graph, operation and vertex (default 3)")
+    parser.add_argument("--baseline", default="utils/traversal_baseline.json", help="timing baseline (default utils/traversal_baseline.json)")
+    parser.add_argument("--store-baseline", "--update-baseline", dest="store_baseline", action="store_true",
+                        help="store this run's timings as the baseline instead of comparing with it")
+    parser.add_argument("--tolerance", type=float, default=25.0, help="allowed slowdown against the baseline in percent (default 25)")
+    parser.add_argument("--slack-ms", type=float, default=1.0, help="slowdown in milliseconds that is always allowed (default 1)")
+    parser.add_argument("--timeout", type=float, default=10.0, help="seconds to wait for a reply (default 10)")
+    parser.add_argument("--no-start", action="store_true", help="use servers that are already running instead of starting them")
+    parser.add_argument("--logs", default="logs", help="directory for the server logs (default logs)")
+    parser.add_argument("--scale", type=int, metavar="N", help="check generated graphs of N vertices instead, from a few starting vertices")
+    args = parser.parse_args()
+
+    if not os.path.exists("client.c"):
+        sys.exit("Run the harness from Assignment2, the servers use ftok(\".\")")
+
+    os.makedirs("executables", exist_ok=True)
+    if args.scale:
+        graphs = generate_scale_graphs(args.scale)
+        args.repeat = 1
+        args.timeout = max(args.timeout, 300.0)
+    else:
+        graphs = sorted(path for path in glob.glob(args.graphs) if read_graph(path))
+    servers = [] if args.no_start else start_servers(args.logs)
+    if args.no_start:
+        subprocess.run(["gcc", "-Wall", "-g", "-pthread", "-O2", "client.c", "-o", "executables/client.out"], check=True)
+
+    client = Client("./executables/client.out")
+    failures = []
+    samples = {}
+    seq_num = FIRST_SEQ_NUM
+    try:
+        for graph in graphs:
+            adjacency = read_graph(graph)
+            # At scale the first, a middle and the last vertex stand for all of them
+            vertices = sorted({0, len(adjacency) // 2, len(adjacency) - 1}) if args.scale else range(len(adjacency))
+            for operation, name, check in ((3, "dfs", check_dfs), (4, "bfs", check_bfs)):
+                key = "%s %s" % (graph, name)
+                samples[key] = []
+                for vertex in vertices:
+                    for _ in range(args.repeat):
+                        seconds, lines = client.request(seq_num, operation, graph, vertex + 1, args.timeout)
+                        seq_num = seq_num + 1 if seq_num < LAST_SEQ_NUM else FIRST_SEQ_NUM
+                        samples[key].append(seconds)
+                        error = check(adjacency, vertex, lines)
+                        if error is not None:
+                            failures.append("%s from %d: %s" % (key, vertex + 1, error))
+    finally:
+        client.close()
+        if servers:
+            stop_servers(servers, args.logs)
+        if args.scale:
+            for graph in graphs:
+                os.remove(graph)
+
+    timings = {key: statistics.median(values) for key, values in samples.items() if values}
+    baseline = {}
+    missing_baseline = False
+    if args.scale:
+        # Timings of generated graphs are not comparable with the baseline, and are not stored in it
+        args.store_baseline = False
+    elif not args.store_baseline:
+        if not os.path.exists(args.baseline):
+            missing_baseline = True
+        else:
+            baseline = json.load(open(args.baseline))["median_seconds"]
+    regressions = compare_with_baseline(timings, baseline, args.tolerance, args.slack_ms)
+
+    width = max([16] + [len(key) for key in timings])
+    print("%-*s %9s %12s %12s %8s" % (width, "GRAPH OP", "REQUESTS", "MEDIAN(ms)", "BASELINE(ms)", "CHANGE"))
+    for key in sorted(timings):
+        if key in baseline:
+            change = "%+7.1f%%" % ((timings[key] / baseline[key] - 1) * 100)
+            print("%-*s %9d %12.3f %12.3f %8s" % (width, key, len(samples[key]), timings[key] * 1000, baseline[key] * 1000, change))
+        else:
+            print("%-*s %9d %12.3f %12s %8s" % (width, key, len(samples[key]), timings[key] * 1000, "-", "-"))
+
+    if args.store_baseline:
+        if failures:
+            print("Not storing a baseline from a run with wrong replies")
+        else:
+            with open(args.baseline, "w") as out:
+                json.dump({"tolerance_percent": args.tolerance, "median_seconds": timings}, out, indent=2, sort_keys=True)
+                out.write("\n")
+            print("Stored the baseline in %s" % args.baseline)
+
+    for failure in failures:
+        print("WRONG  %s" % failure)
+    for key, median, previous in regressions:
+        print("SLOWER %s: %.3f ms against %.3f ms, more than %.0f%% + %.1f ms" % (key, median * 1000, previous * 1000, args.tolerance, args.slack_ms))
+    total = sum(len(values) for values in samples.values())
+    print("%d requests, %d wrong, %d slower than the baseline" % (total, len(failures), len(regressions)))
+    if missing_baseline:
+        print("No baseline in %s to compare with, store one with --store-baseline" % args.baseline)
+    sys.exit(1 if failures or regressions or missing_baseline else 0)
+
+
+if __name__ == "__main__":
+    main()